@@ -1,3 +1,4 @@
+from collections import OrderedDict
 from math import floor
 from world import World
 import queue
@@ -7,10 +8,12 @@ import random
 import re
 import requests
 import sqlite3
+import struct
 import sys
 import threading
 import time
 import traceback
+import zlib
 
 DEFAULT_HOST = '0.0.0.0'
 DEFAULT_PORT = 4080
@@ -22,6 +25,15 @@ CHUNK_SIZE = 32
 BUFFER_SIZE = 4096
 COMMIT_INTERVAL = 5
 
+BLOCK_STATE_SIZE = 1024
+WRITE_BEHIND_INTERVAL = 1
+WRITE_BEHIND_SIZE = 1000
+CHUNK_CACHE_SIZE = 4096
+CHUNK_CACHE_STATS_INTERVAL = 60
+
+ALLOW_COMPRESSION = True
+COMPRESSION_LEVEL = 6
+
 AUTH_REQUIRED = True
 AUTH_URL = 'https://craft.michaelfogleman.com/api/1/access'
 
@@ -38,6 +50,7 @@ ALLOWED_ITEMS = set([
 
 AUTHENTICATE = 'A'
 BLOCK = 'B'
+BLOCKS = 'M'
 CHUNK = 'C'
 DISCONNECT = 'D'
 KEY = 'K'
@@ -50,6 +63,10 @@ TALK = 'T'
 TIME = 'E'
 VERSION = 'V'
 YOU = 'U'
+COMPRESS = 'Z'
+
+# Queued in place of data to switch a client's send side to compression
+START_COMPRESSION = object()
 
 try:
     from config import *
@@ -90,6 +107,43 @@ class RateLimiter(object):
             self.allowance -= 1
             return False # okay
 
+class ChunkCache(object):
+    # Serialized chunk responses keyed by (p, q, key). Any edit to a chunk
+    # drops every response cached for it, so a hit is always what the
+    # queries would have returned.
+    def __init__(self, size):
+        self.size = size
+        self.responses = OrderedDict()
+        self.keys = {}
+        self.hits = self.misses = self.evictions = self.invalidations = 0
+    def get(self, p, q, key):
+        data = self.responses.get((p, q, key))
+        if data is None:
+            self.misses += 1
+            return None
+        self.hits += 1
+        self.responses.move_to_end((p, q, key))
+        return data
+    def put(self, p, q, key, data):
+        self.responses[(p, q, key)] = data
+        self.keys.setdefault((p, q), set()).add(key)
+        while len(self.responses) > self.size:
+            (op, oq, okey), _ = self.responses.popitem(False)
+            keys = self.keys[(op, oq)]
+            keys.discard(okey)
+            if not keys:
+                del self.keys[(op, oq)]
+            self.evictions += 1
+    def invalidate(self, p, q):
+        for key in self.keys.pop((p, q), ()):
+            del self.responses[(p, q, key)]
+            self.invalidations += 1
+    def stats(self):
+        requests = self.hits + self.misses
+        rate = 100.0 * self.hits / requests if requests else 0
+        return (requests, self.hits, '%.1f%%' % rate,
+            len(self.responses), self.evictions, self.invalidations)
+
 class Server(socketserver.ThreadingMixIn, socketserver.TCPServer):
     allow_reuse_address = True
     daemon_threads = True
@@ -104,23 +158,45 @@ class Handler(socketserver.BaseRequestHandler):
         self.nick = None
         self.queue = queue.Queue()
         self.running = True
+        self.compress_requested = False
+        self.compress_send = False
+        self.raw_sent = self.wire_sent = 0
+        self.raw_received = self.wire_received = 0
         self.start()
     def handle(self):
         model = self.server.model
         model.enqueue(model.on_connect, self)
         try:
-            buf = []
+            frames = b''
+            buf = b''
+            compress_recv = False
             while True:
                 data = self.request.recv(BUFFER_SIZE)
                 if not data:
                     break
-                buf.extend(data.replace(b'\r\n', b'\n'))
-                while '\n' in buf:
-                    index = buf.index('\n')
-                    line = ''.join(buf[:index])
+                self.wire_received += len(data)
+                if compress_recv:
+                    frames += data
+                    data, frames = self.decompress(frames)
+                buf += data
+                while b'\n' in buf:
+                    index = buf.index(b'\n')
+                    line = buf[:index].rstrip(b'\r').decode('utf-8', 'replace')
                     buf = buf[index + 1:]
+                    self.raw_received += index + 1
                     if not line:
                         continue
+                    if line == '%s,1' % COMPRESS and ALLOW_COMPRESSION:
+                        if not self.compress_requested:
+                            # Request: answer with our last uncompressed line
+                            self.compress_requested = True
+                            model.enqueue(model.on_compress, self)
+                        elif not compress_recv:
+                            # The client's last uncompressed line
+                            compress_recv = True
+                            data, frames = self.decompress(buf)
+                            buf = data
+                        continue
                     if line[0] == POSITION:
                         if self.position_limiter.tick():
                             log('RATE', self.client_id)
@@ -134,6 +210,17 @@ class Handler(socketserver.BaseRequestHandler):
                     model.enqueue(model.on_data, self, line)
         finally:
             model.enqueue(model.on_disconnect, self)
+    def decompress(self, frames):
+        # Returns the text of all complete frames and the remaining bytes.
+        # A frame is a 4 byte big-endian length followed by zlib data.
+        result = []
+        while len(frames) >= 4:
+            size, = struct.unpack('>I', frames[:4])
+            if len(frames) < 4 + size:
+                break
+            result.append(zlib.decompress(frames[4:4 + size]))
+            frames = frames[4 + size:]
+        return b''.join(result), frames
     def finish(self):
         self.running = False
     def stop(self):
@@ -155,11 +242,29 @@ class Handler(socketserver.BaseRequestHandler):
                         pass
                 except queue.Empty:
                     continue
-                data = ''.join(buf)
-                self.request.sendall(bytes(data, 'utf-8'))
+                if START_COMPRESSION in buf:
+                    index = buf.index(START_COMPRESSION)
+                    self.write(''.join(buf[:index]))
+                    self.compress_send = True
+                    buf = buf[index + 1:]
+                self.write(''.join(buf))
             except Exception:
                 self.request.close()
                 raise
+    def write(self, data):
+        if not data:
+            return
+        data = bytes(data, 'utf-8')
+        self.raw_sent += len(data)
+        if self.compress_send:
+            data = zlib.compress(data, COMPRESSION_LEVEL)
+            data = struct.pack('>I', len(data)) + data
+        self.wire_sent += len(data)
+        self.request.sendall(data)
+    def compression_ratios(self):
+        sent = self.raw_sent / float(max(self.wire_sent, 1))
+        received = self.raw_received / float(max(self.wire_received, 1))
+        return '%.2f' % sent, '%.2f' % received
     def send_raw(self, data):
         if data:
             self.queue.put(data)
@@ -169,12 +274,22 @@ class Handler(socketserver.BaseRequestHandler):
 class Model(object):
     def __init__(self, seed):
         self.world = World(seed)
+        self.chunk_cache = ChunkCache(CHUNK_CACHE_SIZE)
+        # Saved block rows of recently used chunks, kept current in memory:
+        # (p, q) -> {(x, y, z): w}
+        self.blocks = OrderedDict()
+        # Writes not yet sent to sqlite, and the chunks they touch
+        self.pending = []
+        self.pending_chunks = set()
+        self.last_flush = time.time()
+        self.last_chunk_stats = time.time()
         self.clients = []
         self.queue = queue.Queue()
         self.commands = {
             AUTHENTICATE: self.on_authenticate,
             CHUNK: self.on_chunk,
             BLOCK: self.on_block,
+            BLOCKS: self.on_blocks,
             LIGHT: self.on_light,
             POSITION: self.on_position,
             TALK: self.on_talk,
@@ -199,8 +314,13 @@ class Model(object):
         self.commit()
         while True:
             try:
+                if time.time() - self.last_flush > WRITE_BEHIND_INTERVAL:
+                    self.flush()
                 if time.time() - self.last_commit > COMMIT_INTERVAL:
                     self.commit()
+                if (time.time() - self.last_chunk_stats >
+                        CHUNK_CACHE_STATS_INTERVAL):
+                    self.log_chunk_stats()
                 self.dequeue()
             except Exception:
                 traceback.print_exc()
@@ -208,15 +328,47 @@ class Model(object):
         self.queue.put((func, args, kwargs))
     def dequeue(self):
         try:
-            func, args, kwargs = self.queue.get(timeout=5)
+            func, args, kwargs = self.queue.get(timeout=WRITE_BEHIND_INTERVAL)
             func(*args, **kwargs)
         except queue.Empty:
             pass
     def execute(self, *args, **kwargs):
         return self.connection.execute(*args, **kwargs)
     def commit(self):
+        self.flush()
         self.last_commit = time.time()
         self.connection.commit()
+    def write(self, p, q, query, params):
+        # Queue a write to chunk (p, q). Edits are validated and broadcast
+        # from memory; sqlite catches up in flush.
+        self.pending.append((query, params))
+        self.pending_chunks.add((p, q))
+        if len(self.pending) >= WRITE_BEHIND_SIZE:
+            self.flush()
+    def flush(self):
+        # Run the queued writes in order, batching runs of the same query.
+        self.last_flush = time.time()
+        pending, self.pending = self.pending, []
+        self.pending_chunks.clear()
+        index = 0
+        while index < len(pending):
+            query = pending[index][0]
+            end = index
+            while end < len(pending) and pending[end][0] == query:
+                end += 1
+            self.connection.executemany(
+                query, [params for _, params in pending[index:end]])
+            index = end
+    def flush_chunk(self, p, q):
+        # Make sqlite current for a chunk before reading it back.
+        if (p, q) in self.pending_chunks:
+            self.flush()
+    def log_chunk_stats(self):
+        # requests, hits, hit rate, cached responses, evictions, invalidations
+        self.last_chunk_stats = time.time()
+        stats = self.chunk_cache.stats()
+        if stats[0]:
+            log('CACHE', *stats)
     def create_tables(self):
         queries = [
             'create table if not exists block ('
@@ -266,16 +418,34 @@ class Model(object):
         p, q = chunked(x), chunked(z)
         chunk = self.world.get_chunk(p, q)
         return chunk.get((x, y, z), 0)
+    def get_chunk_blocks(self, p, q):
+        # Loaded once per chunk; after that, edits update it in set_block.
+        try:
+            blocks = self.blocks.pop((p, q))
+        except KeyError:
+            self.flush_chunk(p, q)
+            query = 'select x, y, z, w from block where p = :p and q = :q;'
+            rows = self.execute(query, dict(p=p, q=q))
+            blocks = dict(((x, y, z), w) for x, y, z, w in rows)
+        self.blocks[(p, q)] = blocks
+        if len(self.blocks) > BLOCK_STATE_SIZE:
+            self.blocks.popitem(False)
+        return blocks
     def get_block(self, x, y, z):
+        p, q = chunked(x), chunked(z)
+        w = self.get_chunk_blocks(p, q).get((x, y, z))
+        if w is None:
+            return self.get_default_block(x, y, z)
+        return w
+    def set_block(self, p, q, x, y, z, w):
         query = (
-            'select w from block where '
-            'p = :p and q = :q and x = :x and y = :y and z = :z;'
+            'insert or replace into block (p, q, x, y, z, w) '
+            'values (:p, :q, :x, :y, :z, :w);'
         )
-        p, q = chunked(x), chunked(z)
-        rows = list(self.execute(query, dict(p=p, q=q, x=x, y=y, z=z)))
-        if rows:
-            return rows[0][0]
-        return self.get_default_block(x, y, z)
+        self.write(p, q, query, dict(p=p, q=q, x=x, y=y, z=z, w=w))
+        if (p, q) in self.blocks:
+            self.blocks[(p, q)][(x, y, z)] = w
+        self.chunk_cache.invalidate(p, q)
     def next_client_id(self):
         result = 1
         client_ids = set(x.client_id for x in self.clients)
@@ -305,6 +475,8 @@ class Model(object):
             func(client, *args)
     def on_disconnect(self, client):
         log('DISC', client.client_id, *client.client_address)
+        if client.compress_send:
+            log('ZSTAT', client.client_id, *client.compression_ratios())
         self.clients.remove(client)
         self.send_disconnect(client)
         self.send_talk('%s has disconnected from the server.' % client.nick)
@@ -317,6 +489,10 @@ class Model(object):
             return
         client.version = version
         # TODO: client.start() here
+    def on_compress(self, client):
+        log('ZLIB', client.client_id)
+        client.send(COMPRESS, 1)
+        client.send_raw(START_COMPRESSION)
     def on_authenticate(self, client, username, access_token):
         user_id = None
         if username and access_token:
@@ -336,9 +512,24 @@ class Model(object):
         self.send_nick(client)
         # TODO: has left message if was already authenticated
         self.send_talk('%s has joined the game.' % client.nick)
-    def on_chunk(self, client, p, q, key=0):
+    def on_chunk(self, client, *args):
+        # A request lists one or more p,q,key triples, most important first.
+        # Each chunk is sent as soon as it has been queried so the client can
+        # start on the nearest chunks while the rest of the batch is served.
+        args = list(map(int, args))
+        if len(args) == 2:
+            args.append(0)
+        for index in range(0, len(args) - 2, 3):
+            self.send_chunk(client, *args[index:index + 3])
+    def send_chunk(self, client, p, q, key):
+        data = self.chunk_cache.get(p, q, key)
+        if data is None:
+            data = self.get_chunk_response(p, q, key)
+            self.chunk_cache.put(p, q, key, data)
+        client.send_raw(data)
+    def get_chunk_response(self, p, q, key):
+        self.flush_chunk(p, q)
         packets = []
-        p, q, key = map(int, (p, q, key))
         query = (
             'select rowid, x, y, z, w from block where '
             'p = :p and q = :q and rowid > :key;'
@@ -373,7 +564,7 @@ class Model(object):
         if blocks or lights or signs:
             packets.append(packet(REDRAW, p, q))
         packets.append(packet(CHUNK, p, q))
-        client.send_raw(''.join(packets))
+        return ''.join(packets)
     def on_block(self, client, x, y, z, w):
         x, y, z, w = map(int, (x, y, z, w))
         p, q = chunked(x), chunked(z)
@@ -401,13 +592,9 @@ class Model(object):
             'values (:timestamp, :user_id, :x, :y, :z, :w);'
         )
         if RECORD_HISTORY:
-            self.execute(query, dict(timestamp=time.time(),
+            self.write(p, q, query, dict(timestamp=time.time(),
                 user_id=client.user_id, x=x, y=y, z=z, w=w))
-        query = (
-            'insert or replace into block (p, q, x, y, z, w) '
-            'values (:p, :q, :x, :y, :z, :w);'
-        )
-        self.execute(query, dict(p=p, q=q, x=x, y=y, z=z, w=w))
+        self.set_block(p, q, x, y, z, w)
         self.send_block(client, p, q, x, y, z, w)
         for dx in range(-1, 2):
             for dz in range(-1, 2):
@@ -418,19 +605,23 @@ class Model(object):
                 if dz and chunked(z + dz) == q:
                     continue
                 np, nq = p + dx, q + dz
-                self.execute(query, dict(p=np, q=nq, x=x, y=y, z=z, w=-w))
+                self.set_block(np, nq, x, y, z, -w)
                 self.send_block(client, np, nq, x, y, z, -w)
         if w == 0:
             query = (
                 'delete from sign where '
                 'x = :x and y = :y and z = :z;'
             )
-            self.execute(query, dict(x=x, y=y, z=z))
+            self.write(p, q, query, dict(x=x, y=y, z=z))
             query = (
                 'update light set w = 0 where '
                 'x = :x and y = :y and z = :z;'
             )
-            self.execute(query, dict(x=x, y=y, z=z))
+            self.write(p, q, query, dict(x=x, y=y, z=z))
+    def on_blocks(self, client, *args):
+        # A batch of x,y,z,w groups, applied in order like BLOCK lines
+        for index in range(0, len(args) - 3, 4):
+            self.on_block(client, *args[index:index + 4])
     def on_light(self, client, x, y, z, w):
         x, y, z, w = map(int, (x, y, z, w))
         p, q = chunked(x), chunked(z)
@@ -451,7 +642,8 @@ class Model(object):
             'insert or replace into light (p, q, x, y, z, w) '
             'values (:p, :q, :x, :y, :z, :w);'
         )
-        self.execute(query, dict(p=p, q=q, x=x, y=y, z=z, w=w))
+        self.write(p, q, query, dict(p=p, q=q, x=x, y=y, z=z, w=w))
+        self.chunk_cache.invalidate(p, q)
         self.send_light(client, p, q, x, y, z, w)
     def on_sign(self, client, x, y, z, face, *args):
         if AUTH_REQUIRED and client.user_id is None:
@@ -471,14 +663,15 @@ class Model(object):
                 'insert or replace into sign (p, q, x, y, z, face, text) '
                 'values (:p, :q, :x, :y, :z, :face, :text);'
             )
-            self.execute(query,
+            self.write(p, q, query,
                 dict(p=p, q=q, x=x, y=y, z=z, face=face, text=text))
         else:
             query = (
                 'delete from sign where '
                 'x = :x and y = :y and z = :z and face = :face;'
             )
-            self.execute(query, dict(x=x, y=y, z=z, face=face))
+            self.write(p, q, query, dict(x=x, y=y, z=z, face=face))
+        self.chunk_cache.invalidate(p, q)
         self.send_sign(client, p, q, x, y, z, face, text)
     def on_position(self, client, x, y, z, rx, ry):
         x, y, z, rx, ry = map(float, (x, y, z, rx, ry))
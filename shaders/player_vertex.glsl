@@ -0,0 +1,69 @@
+#version 120
+
+uniform mat4 matrix;
+uniform vec3 camera;
+uniform float fog_distance;
+uniform int ortho;
+
+// Player model (see make_player_model())
+attribute vec4 position;
+attribute vec3 normal;
+attribute vec4 uv;
+attribute float head;
+
+// Per player instance
+attribute vec3 offset;   // player position
+attribute vec3 rotation; // head rotation x and y, body rotation x
+
+varying vec2 fragment_uv;
+varying float fragment_ao;
+varying float fragment_light;
+varying float fog_factor;
+varying float fog_height;
+varying float diffuse;
+
+const float pi = 3.14159265;
+const vec3 light_direction = normalize(vec3(-1.0, 1.0, -1.0));
+const vec3 head_center = vec3(0.0, 0.95, 0.0); // PLAYER_HEAD_Y
+
+// Same matrix as mat_rotate()
+mat3 rotate(vec3 axis, float angle) {
+    vec3 a = normalize(axis);
+    float s = sin(angle);
+    float c = cos(angle);
+    float m = 1.0 - c;
+    return mat3(
+        m * a.x * a.x + c, m * a.x * a.y - a.z * s, m * a.z * a.x + a.y * s,
+        m * a.x * a.y + a.z * s, m * a.y * a.y + c, m * a.y * a.z - a.x * s,
+        m * a.z * a.x - a.y * s, m * a.y * a.z + a.x * s, m * a.z * a.z + c);
+}
+
+void main() {
+    vec3 local = position.xyz;
+    if (head > 0.5) {
+        float rx = rotation.x;
+        mat3 turn = rotate(vec3(cos(rx), 0.0, sin(rx)), -rotation.y) *
+            rotate(vec3(0.0, 1.0, 0.0), rx);
+        local = turn * (local - head_center) + head_center;
+    }
+    else {
+        local = rotate(vec3(0.0, 1.0, 0.0), rotation.z) * local;
+    }
+    vec4 world = vec4(local + offset, 1.0);
+    gl_Position = matrix * world;
+    fragment_uv = uv.xy;
+    fragment_ao = 0.3 + (1.0 - uv.z) * 0.7;
+    fragment_light = uv.w;
+    diffuse = max(0.0, dot(normal, light_direction));
+    if (bool(ortho)) {
+        fog_factor = 0.0;
+        fog_height = 0.0;
+    }
+    else {
+        float camera_distance = distance(camera, vec3(world));
+        fog_factor = pow(clamp(camera_distance / fog_distance, 0.0, 1.0), 4.0);
+        float dy = world.y - camera.y;
+        float dx = distance(world.xz, camera.xz);
+        fog_height = (atan(dy, dx) + pi / 2) / pi;
+    }
+}
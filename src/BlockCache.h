@@ -0,0 +1,19 @@
+#ifndef _BlockCache_h
+#define _BlockCache_h
+
+// Dense copy of the block ids in a box of the world, for code that looks up
+// many blocks close to each other (such as collision tests). Filled by
+// block_cache_fill(); positions outside of the box read as empty.
+typedef struct {
+    int x;        // X of the lowest corner
+    int y;        // Y of the lowest corner
+    int z;        // Z of the lowest corner
+    int width;    // size along X
+    int height;   // size along Y
+    int depth;    // size along Z
+    int capacity; // number of ids data has room for
+    char *data;   // id of each block, at ((dx * height) + dy) * depth + dz
+} BlockCache;
+
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _BlockUpdate_h
+#define _BlockUpdate_h
+
+
+// Block update scheduled for a later simulation tick
+// - tick: block tick the update is due in
+// - x: x position
+// - y: y position
+// - z: z position
+typedef struct {
+    int tick;
+    int x;
+    int y;
+    int z;
+} BlockUpdate;
+
+
+#endif
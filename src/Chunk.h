@@ -1,6 +1,8 @@
 #ifndef _Chunk_h
 #define _Chunk_h
 
+#include "arena.h"
+#include "config.h"
 #include "map.h"
 #include "sign.h"
 #include <GL/glew.h>
@@ -11,15 +13,29 @@ typedef struct {
     Map map;         // block types
     Map lights;      // block lights
     Map damage;      // block damage
+    Map active;      // positions with a block update scheduled
+    int active_count;// number of positions in active
     SignList signs;  // signs in the chunk
     int p;           // chunk X
     int q;           // chunk Z
     int faces;       // number of block faces
     int sign_faces;  // number of sign faces
     int dirty;       // flag
+    int requested;   // flag: waiting to be requested from the server
     int miny;        // minimum Y value held by any block
     int maxy;        // maximum Y value held by any block
-    GLuint buffer;
+    // number of faces of each section
+    int section_faces[CHUNK_SECTIONS];
+    // first face of each group of the mesh, and the number of faces at the
+    // end; the mesh holds the opaque faces of section 0, then those of section
+    // 1, and so on, followed by the faces of cutout blocks (plants, glass,
+    // leaves) in the same order, and the faces of each section are grouped by
+    // the direction they face (-x, +x, +y, -y, -z, +z, then plants)
+    int group_first[MESH_GROUPS + 1];
+    // for each section and each of its faces (-x, +x, -y, +y, -z, +z), bits
+    // of the faces it can be seen through to without crossing opaque blocks
+    unsigned char connections[CHUNK_SECTIONS][6];
+    ArenaAlloc mesh; // block faces in the chunk arena
     GLuint sign_buffer;
 } Chunk;
 
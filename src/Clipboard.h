@@ -0,0 +1,24 @@
+#ifndef _Clipboard_h
+#define _Clipboard_h
+
+#include "Block.h"
+
+// Blocks copied by /copy, in a layout of their own: only the blocks that are
+// not empty, at offsets from the corner the copy started from. Pasting places
+// each of them, so it costs time in proportion to the number of blocks and
+// not to the size of the copied area.
+// - width: size of the copied area along the x offsets
+// - depth: size of the copied area along the z offsets
+// - count: number of blocks
+// - capacity: number of blocks allocated
+// - blocks: x, y, z offset and id of each block
+typedef struct {
+    int width;
+    int depth;
+    int count;
+    int capacity;
+    Block *blocks;
+} Clipboard;
+
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _EditTransaction_h
+#define _EditTransaction_h
+
+#include "Chunk.h"
+#include "map.h"
+
+// Block edits gathered for one chunk by an edit transaction
+// - p: chunk x
+// - q: chunk z
+// - chunk: the loaded chunk, or NULL
+// - edits: new block id + 1 at each edited position (one more, so that
+//   removals are kept in the map too)
+typedef struct {
+    int p;
+    int q;
+    Chunk *chunk;
+    Map edits;
+} EditChunk;
+
+// World edits (from the builder commands) gathered between edit_begin() and
+// edit_commit(), and applied together: chunk by chunk, with one database
+// batch per chunk, each chunk marked dirty once and one bulk edit message to
+// the server.
+// - depth: number of edit_begin() calls not committed yet (they nest)
+// - count: number of chunks with edits
+// - capacity: number of chunks allocated
+// - last: index of the chunk edited last
+// - chunks: edits of each chunk
+typedef struct {
+    int depth;
+    int count;
+    int capacity;
+    int last;
+    EditChunk *chunks;
+} EditTransaction;
+
+
+#endif
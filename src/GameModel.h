@@ -2,18 +2,33 @@
 #define _GameModel_h
 
 
+#include "arena.h"
 #include "config.h"
 #include "map.h"
 #include "Worker.h"
 #include "Block.h"
+#include "BlockUpdate.h"
 #include "Chunk.h"
+#include "Clipboard.h"
+#include "EditTransaction.h"
+#include "entity.h"
+#include "LodChunk.h"
 #include "Physics.h"
+#include "transient.h"
+#include "Visibility.h"
 #include "player.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <stdio.h>
 
 
 #define MAX_CHUNKS 8192
+// Enough simplified chunks for a LOD radius of 63
+#define MAX_LOD_CHUNKS 16384
+// Vertices in each buffer of the chunk arena (40 bytes each)
+#define CHUNK_ARENA_SIZE (1 << 20)
+// Bytes in the buffer for per-frame geometry (HUD text, wireframes, etc.)
+#define TRANSIENT_SIZE (1 << 20)
 #define MAX_PLAYERS 128
 #define MAX_TEXT_LENGTH 256
 #define MAX_PATH_LENGTH 256
@@ -24,13 +39,30 @@
 // - window:
 // - workers:
 // - chunks:
+// - chunk_arena: vertex buffers that chunk meshes are allocated from
 // - chunk_count:
+// - lod_chunks: simplified chunks drawn beyond the render radius, and in place
+//   of chunks that are not meshed yet
+// - lod_count: number of simplified chunks
+// - chunk_requests: number of chunks waiting to be requested from the server
+// - culled_faces: block faces in the frustum that cave culling skipped in the
+//   last frame
+// - visibility: main view (of the observe1 player), which chunk loading
+//   follows
+// - inset_visibility: picture-in-picture view (of the observe2 player)
+// - transient: vertex buffer for geometry that is rebuilt every frame
+// - text_data: vertices of the HUD text queued by render_text()
+// - text_length: number of characters queued
+// - text_capacity: number of characters text_data has room for
 // - create_radius:
 // - render_radius:
+// - lod_radius: simplified chunks are drawn out to this radius
 // - delete_radius:
 // - sign_radius:
 // - players:
 // - player_count:
+// - entities: simulated boxes that are not players (dropped items,
+//   projectiles, mobs)
 // - typing:
 // - typing_buffer:
 // - message_index:
@@ -50,23 +82,49 @@
 // - db_path:
 // - server_addr:
 // - server_port:
+// - compress: flag to request stream compression when connecting to a server
 // - day_length:
 // - time_changed:
+// - frame_log: file per-frame timings are written to, or NULL when not logging
+// - workers_time: seconds spent in check_workers() during the current frame
+// - tick_time: seconds spent in simulation ticks during the current frame
+// - tick_count: number of simulation ticks run during the current frame
+// - tick_from: local player position before the last tick
+// - tick_to: local player position after the last tick
+// - tick_shown: local player position drawn in the current frame, between
+//   tick_from and tick_to
+// - edit: builder edits gathered to be applied together
+// - block_updates: scheduled block updates, a binary heap ordered by tick
+// - block_update_count: number of scheduled block updates
+// - block_update_capacity: number of block updates allocated
+// - block_tick: number of block update ticks run
 // - block0:
 // - block1:
-// - copy0:
-// - copy1:
+// - clipboard: blocks copied by /copy for /paste
 typedef struct {
     GLFWwindow *window;
     Worker workers[WORKERS];
     Chunk chunks[MAX_CHUNKS];
+    Arena chunk_arena;
     int chunk_count;
+    LodChunk lod_chunks[MAX_LOD_CHUNKS];
+    int lod_count;
+    int chunk_requests;
+    int culled_faces;
+    Visibility visibility;
+    Visibility inset_visibility;
+    Transient transient;
+    GLfloat *text_data;
+    int text_length;
+    int text_capacity;
     int create_radius;
     int render_radius;
+    int lod_radius;
     int delete_radius;
     int sign_radius;
     Player players[MAX_PLAYERS];
     int player_count;
+    EntityList entities;
     int typing;
     char typing_buffer[MAX_TEXT_LENGTH];
     int message_index;
@@ -85,12 +143,24 @@ typedef struct {
     char db_path[MAX_PATH_LENGTH];
     char server_addr[MAX_ADDR_LENGTH];
     int server_port;
+    int compress;
     int day_length;
     int time_changed;
+    FILE *frame_log;
+    double workers_time;
+    double tick_time;
+    int tick_count;
+    float tick_from[3];
+    float tick_to[3];
+    float tick_shown[3];
+    EditTransaction edit;
+    BlockUpdate *block_updates;
+    int block_update_count;
+    int block_update_capacity;
+    int block_tick;
     Block block0;
     Block block1;
-    Block copy0;
-    Block copy1;
+    Clipboard clipboard;
     PhysicsConfig physics;
 } Model;
 
@@ -0,0 +1,19 @@
+#ifndef _LodChunk_h
+#define _LodChunk_h
+
+#include "arena.h"
+
+// Simplified stand-in for a chunk that is not drawn in full detail: a
+// heightmap of square columns made from the terrain generator and the block
+// changes stored in the database, without loading the chunk's blocks.
+typedef struct {
+    int p;           // chunk X
+    int q;           // chunk Z
+    int step;        // width of each column in blocks
+    int miny;        // lowest Y value of the mesh (rounded down)
+    int maxy;        // highest Y value of the mesh (rounded up)
+    ArenaAlloc mesh; // column faces in the chunk arena
+} LodChunk;
+
+
+#endif
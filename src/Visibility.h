@@ -0,0 +1,32 @@
+#ifndef _Visibility_h
+#define _Visibility_h
+
+#include "Chunk.h"
+#include "player.h"
+
+// A view of the world for one frame: its camera and the chunks around it that
+// are in the view frustum. Set up once per frame by update_visibility() with
+// a quadtree over the chunk positions, and shared by everything that draws
+// the view that frame.
+typedef struct {
+    Player *player;    // player whose view this is
+    int p;             // chunk X of the camera
+    int q;             // chunk Z of the camera
+    int radius;        // positions within this chunk radius are covered
+    int width;         // width of the grids: 2 * radius + 1
+    int size;          // width of the quadtree leaves (power of 2 >= width)
+    int capacity;      // number of grid cells allocated
+    int node_capacity; // number of quadtree nodes allocated
+    float matrix[16];  // camera matrix
+    float planes[6][4];// view frustum planes
+    Chunk **chunks;    // grid: loaded chunk at each position, or NULL
+    char *in_view;     // grid: flag: the full height of the position (0 to
+                       // 256) is at least partly in the frustum
+    int *bounds;       // quadtree: min and max block Y under each node, the
+                       // leaves (size * size) first, then each level up
+    Chunk **visible;   // loaded chunks whose blocks are in the frustum
+    int visible_count; // number of visible chunks
+} Visibility;
+
+
+#endif
@@ -2,6 +2,7 @@
 #define _Worker_h
 
 
+#include "config.h"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <tinycthread.h>
@@ -19,12 +20,17 @@ typedef struct {
     int p;                   // chunked X
     int q;                   // chunked Z
     int load;
+    int lod;                 // flag: build a simplified chunk instead
+    int step;                // column width of the simplified chunk
     Map *block_maps[3][3];
     Map *light_maps[3][3];
     Map *damage_maps[3][3];
     int miny;
     int maxy;
     int faces;
+    int section_faces[CHUNK_SECTIONS];
+    int group_first[MESH_GROUPS + 1];
+    unsigned char connections[CHUNK_SECTIONS][6];
     GLfloat *data;
 } WorkerItem;
 
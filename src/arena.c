@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+// Arena of large vertex buffers that chunk meshes are suballocated from, so
+// that many meshes can be drawn from one buffer with glMultiDrawArrays instead
+// of binding a buffer per mesh. Each pool keeps a sorted free list; space is
+// handed out first-fit and merged with its neighbours when it is released.
+
+// Allocations are rounded up to a multiple of this many vertices (16 faces),
+// so that a mesh that grows a little after an edit still fits in place
+#define ARENA_ALIGN 96
+
+// Set up an empty arena. No OpenGL buffers are created until they are needed.
+// Arguments:
+// - arena: pointer to arena structure to modify
+// - stride: number of floats per vertex
+// - pool_size: number of vertices in each pool
+// Returns:
+// - modifies the structure that arena points to
+void arena_init(Arena *arena, int stride, int pool_size) {
+    memset(arena, 0, sizeof(Arena));
+    arena->stride = stride;
+    arena->pool_size = pool_size;
+}
+
+// Delete all the arena's buffers (but does not free the given arena pointer).
+// Every allocation made from the arena becomes invalid.
+// Arguments:
+// - arena: pointer to arena structure
+// Returns: none
+void arena_free(Arena *arena) {
+    for (int i = 0; i < arena->pool_count; i++) {
+        ArenaPool *pool = arena->pools + i;
+        glDeleteBuffers(1, &pool->buffer);
+        free(pool->free);
+    }
+    arena_init(arena, arena->stride, arena->pool_size);
+}
+
+// Get the buffer an allocation lives in
+// Arguments:
+// - arena: pointer to arena structure
+// - alloc: allocation
+// Returns:
+// - OpenGL buffer handle, or 0 if nothing is reserved
+GLuint arena_buffer(Arena *arena, ArenaAlloc *alloc) {
+    return alloc->pool ? arena->pools[alloc->pool - 1].buffer : 0;
+}
+
+// Insert a free range into a pool's free list at a position
+static void pool_insert(ArenaPool *pool, int index, int offset, int count) {
+    if (pool->free_count == pool->free_capacity) {
+        pool->free_capacity = pool->free_capacity ? pool->free_capacity * 2 : 16;
+        pool->free = realloc(pool->free,
+                sizeof(ArenaRange) * pool->free_capacity);
+    }
+    memmove(pool->free + index + 1, pool->free + index,
+            sizeof(ArenaRange) * (pool->free_count - index));
+    pool->free[index].offset = offset;
+    pool->free[index].count = count;
+    pool->free_count++;
+}
+
+// Remove a free range from a pool's free list
+static void pool_remove(ArenaPool *pool, int index) {
+    pool->free_count--;
+    memmove(pool->free + index, pool->free + index + 1,
+            sizeof(ArenaRange) * (pool->free_count - index));
+}
+
+// Create a new pool with one buffer
+// Arguments:
+// - arena: pointer to arena structure
+// - size: number of vertices the pool holds
+// Returns:
+// - index of the new pool
+static int arena_add_pool(Arena *arena, int size) {
+    if (arena->pool_count == MAX_ARENA_POOLS) {
+        fprintf(stderr, "arena: out of pools\n");
+        exit(1);
+    }
+    ArenaPool *pool = arena->pools + arena->pool_count;
+    memset(pool, 0, sizeof(ArenaPool));
+    pool->size = size;
+    glGenBuffers(1, &pool->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, pool->buffer);
+    glBufferData(GL_ARRAY_BUFFER,
+            sizeof(GLfloat) * arena->stride * size, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    pool_insert(pool, 0, 0, size);
+    return arena->pool_count++;
+}
+
+// Reserve space for a number of vertices, making a new pool if none has room
+// Arguments:
+// - arena: pointer to arena structure
+// - alloc: allocation to fill in (must not hold anything)
+// - capacity: number of vertices to reserve (a multiple of ARENA_ALIGN)
+// Returns: none
+static void arena_reserve(Arena *arena, ArenaAlloc *alloc, int capacity) {
+    for (int i = 0; i <= arena->pool_count; i++) {
+        if (i == arena->pool_count) {
+            int size = arena->pool_size;
+            while (size < capacity) {
+                size *= 2;
+            }
+            arena_add_pool(arena, size);
+        }
+        ArenaPool *pool = arena->pools + i;
+        for (int j = 0; j < pool->free_count; j++) {
+            ArenaRange *range = pool->free + j;
+            if (range->count < capacity) {
+                continue;
+            }
+            alloc->pool = i + 1;
+            alloc->offset = range->offset;
+            alloc->capacity = capacity;
+            range->offset += capacity;
+            range->count -= capacity;
+            if (!range->count) {
+                pool_remove(pool, j);
+            }
+            return;
+        }
+    }
+}
+
+// Give an allocation's space back to its pool
+// Arguments:
+// - arena: pointer to arena structure
+// - alloc: allocation to release (cleared)
+// Returns: none
+void arena_release(Arena *arena, ArenaAlloc *alloc) {
+    if (!alloc->pool) {
+        return;
+    }
+    ArenaPool *pool = arena->pools + alloc->pool - 1;
+    int offset = alloc->offset;
+    int count = alloc->capacity;
+    memset(alloc, 0, sizeof(ArenaAlloc));
+    // Find where the range goes and merge it with its neighbours
+    int index = 0;
+    while (index < pool->free_count && pool->free[index].offset < offset) {
+        index++;
+    }
+    if (index > 0) {
+        ArenaRange *before = pool->free + index - 1;
+        if (before->offset + before->count == offset) {
+            offset = before->offset;
+            count += before->count;
+            pool_remove(pool, --index);
+        }
+    }
+    if (index < pool->free_count) {
+        ArenaRange *after = pool->free + index;
+        if (offset + count == after->offset) {
+            count += after->count;
+            pool_remove(pool, index);
+        }
+    }
+    pool_insert(pool, index, offset, count);
+}
+
+// Store a mesh in the arena, replacing what the allocation held before.
+// The mesh stays in place if it fits in the space already reserved.
+// Arguments:
+// - arena: pointer to arena structure
+// - alloc: allocation to update
+// - count: number of vertices
+// - data: vertex data (count * stride floats)
+// Returns:
+// - modifies the allocation that alloc points to
+void arena_store(Arena *arena, ArenaAlloc *alloc, int count, const GLfloat *data) {
+    int capacity = (count + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    if (capacity > alloc->capacity || capacity < alloc->capacity / 2) {
+        arena_release(arena, alloc);
+        if (capacity) {
+            arena_reserve(arena, alloc, capacity);
+        }
+    }
+    alloc->count = count;
+    if (!count) {
+        return;
+    }
+    GLsizeiptr size = sizeof(GLfloat) * arena->stride;
+    glBindBuffer(GL_ARRAY_BUFFER, arena_buffer(arena, alloc));
+    glBufferSubData(GL_ARRAY_BUFFER, size * alloc->offset, size * count, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
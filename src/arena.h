@@ -0,0 +1,79 @@
+#ifndef _arena_h_
+#define _arena_h_
+
+
+#include <GL/glew.h>
+
+
+#define MAX_ARENA_POOLS 128
+
+
+// Free range of vertices in a pool
+typedef struct {
+    int offset;
+    int count;
+} ArenaRange;
+
+// One large vertex buffer that meshes are suballocated from
+// - buffer: OpenGL buffer handle
+// - size: number of vertices the buffer holds
+// - free: free ranges, sorted by offset and never adjacent to each other
+// - free_count: number of free ranges
+// - free_capacity: number of free ranges allocated
+typedef struct {
+    GLuint buffer;
+    int size;
+    ArenaRange *free;
+    int free_count;
+    int free_capacity;
+} ArenaPool;
+
+// Set of pools holding vertices of one format
+// - stride: number of floats per vertex
+// - pool_size: number of vertices in each new pool
+// - pools: pools created so far (created as they are needed)
+// - pool_count: number of pools
+typedef struct {
+    int stride;
+    int pool_size;
+    ArenaPool pools[MAX_ARENA_POOLS];
+    int pool_count;
+} Arena;
+
+// Place of one mesh in an arena (all zero when it holds nothing)
+// - pool: index of the pool + 1, or 0 if nothing is reserved
+// - offset: first vertex in the pool
+// - capacity: number of vertices reserved
+// - count: number of vertices in use
+typedef struct {
+    int pool;
+    int offset;
+    int capacity;
+    int count;
+} ArenaAlloc;
+
+
+void arena_init(
+        Arena *arena,
+        int stride,
+        int pool_size);
+
+void arena_free(
+        Arena *arena);
+
+GLuint arena_buffer(
+        Arena *arena,
+        ArenaAlloc *alloc);
+
+void arena_release(
+        Arena *arena,
+        ArenaAlloc *alloc);
+
+void arena_store(
+        Arena *arena,
+        ArenaAlloc *alloc,
+        int count,
+        const GLfloat *data);
+
+
+#endif
@@ -0,0 +1,204 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+#include "entity.h"
+#include "item.h"
+#include "map.h"
+#include "tools/tools.h"
+#include "world.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+// Entity simulation benchmark.
+// Drops a number of item-sized entities onto generated terrain and runs
+// simulation ticks over them, the way the client runs update_entities():
+// gravity and resistance, movement with block collision, then the spatial
+// hash and the entity-entity pairs. Prints the average time each stage took
+// per tick.
+//
+// The terrain is the world generator's around the origin, held in one map,
+// so the numbers measure the entity code and not the chunk lookups.
+
+
+#define DEFAULT_ENTITIES 10000
+#define DEFAULT_TICKS 600
+// Chunks of terrain from the origin (in each direction)
+#define WORLD_CHUNKS 3
+#define SPAWN_RANGE (WORLD_CHUNKS * CHUNK_SIZE - 8)
+#define ENTITY_EXTENT 0.25
+
+
+// Options from the command line
+// - entities: number of entities
+// - ticks: number of simulation ticks to run
+// - seed: random seed for the entities
+typedef struct {
+    int entities;
+    int ticks;
+    unsigned int seed;
+} Options;
+
+// Time spent in each stage, in seconds
+typedef struct {
+    double accelerate;
+    double move;
+    double hash;
+    double pairs;
+} Timings;
+
+
+static unsigned int random_state = 1;
+
+
+// Get a pseudo-random number.
+// Arguments:
+// - n: number of possible values
+// Returns:
+// - integer from 0 to n - 1
+static int random_int(int n) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state % n;
+}
+
+
+// World callback: keep the blocks of the chunk itself (not the copies of its
+// neighbors' border blocks, which have negative ids)
+static void set_block(int x, int y, int z, int w, void *arg) {
+    if (w > 0) {
+        map_set((Map *)arg, x, y, z, w);
+    }
+}
+
+
+// Block callback for entity collision
+static int get_obstacle(int x, int y, int z, void *arg) {
+    return is_obstacle(map_get((Map *)arg, x, y, z)) ?
+        ENTITY_BLOCK_SOLID : ENTITY_BLOCK_OPEN;
+}
+
+
+// Get the height of the terrain at a column
+// Returns:
+// - Y of the highest obstacle block, or -1
+static int terrain_height(Map *map, int x, int z) {
+    for (int y = 255; y >= 0; y--) {
+        if (get_obstacle(x, y, z, map)) {
+            return y;
+        }
+    }
+    return -1;
+}
+
+
+// Pair callback: count the pairs (the client pushes them apart here)
+static void count_pair(int a, int b, void *arg) {
+    (void)a;
+    (void)b;
+    (*(int *)arg)++;
+}
+
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-n ENTITIES] [-t TICKS] [-s SEED]\n", program);
+    exit(1);
+}
+
+
+// Run the benchmark
+// Arguments:
+// - argc: number of arguments
+// - argv: options (see usage)
+// Returns:
+// - 0 when done
+int main(int argc, char **argv) {
+    Options options = {DEFAULT_ENTITIES, DEFAULT_TICKS, 1};
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:s:")) != -1) {
+        switch (opt) {
+            case 'n': options.entities = atoi(optarg); break;
+            case 't': options.ticks = atoi(optarg); break;
+            case 's': options.seed = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind < argc || options.entities < 0 || options.ticks < 1) {
+        usage(argv[0]);
+    }
+    random_state = options.seed ? options.seed : 1;
+
+    // Map positions are bytes, so one map holds 256 blocks along X and Z
+    Map map;
+    map_alloc(&map, -128, 0, -128, 0xffff);
+    for (int p = -WORLD_CHUNKS; p < WORLD_CHUNKS; p++) {
+        for (int q = -WORLD_CHUNKS; q < WORLD_CHUNKS; q++) {
+            create_world(p, q, set_block, &map);
+        }
+    }
+
+    // The client's default physics settings
+    PhysicsConfig physics = {0};
+    physics.grav = 60.0;
+    physics.airhr = 8.0;
+    physics.airvr = 0.1;
+    physics.groundr = 8.1;
+
+    // Items thrown up and outwards from a few blocks above the ground
+    EntityList list;
+    entity_list_alloc(&list, options.entities);
+    for (int i = 0; i < options.entities; i++) {
+        int x = random_int(2 * SPAWN_RANGE) - SPAWN_RANGE;
+        int z = random_int(2 * SPAWN_RANGE) - SPAWN_RANGE;
+        float y = terrain_height(&map, x, z) + 2 + random_int(100) / 10.0;
+        entity_list_add(&list, x, y, z,
+            ENTITY_EXTENT, ENTITY_EXTENT, ENTITY_EXTENT,
+            (random_int(200) - 100) / 20.0, random_int(100) / 10.0,
+            (random_int(200) - 100) / 20.0);
+    }
+
+    float dt = 1.0 / TICK_RATE;
+    Timings timings = {0};
+    int collisions = 0;
+    int pairs = 0;
+    for (int tick = 0; tick < options.ticks; tick++) {
+        double start = now();
+        entity_list_accelerate(&list, &physics, dt);
+        double moved = now();
+        collisions += entity_list_move(&list, dt, get_obstacle, &map);
+        double hashed = now();
+        entity_list_hash(&list, 1);
+        double paired = now();
+        entity_list_pairs(&list, count_pair, &pairs);
+        double end = now();
+        timings.accelerate += moved - start;
+        timings.move += hashed - moved;
+        timings.hash += paired - hashed;
+        timings.pairs += end - paired;
+    }
+
+    int grounded = 0;
+    for (int i = 0; i < list.size; i++) {
+        grounded += list.grounded[i];
+    }
+    double ms = 1000.0 / options.ticks;
+    double total = timings.accelerate + timings.move + timings.hash +
+        timings.pairs;
+    printf("%d entities, %d ticks\n", list.size, options.ticks);
+    printf("accelerate: %8.3f ms/tick\n", timings.accelerate * ms);
+    printf("move:       %8.3f ms/tick\n", timings.move * ms);
+    printf("hash:       %8.3f ms/tick\n", timings.hash * ms);
+    printf("pairs:      %8.3f ms/tick\n", timings.pairs * ms);
+    printf("total:      %8.3f ms/tick (%.1f ns per entity)\n",
+        total * ms, list.size ? total * 1e9 / options.ticks / list.size : 0);
+    printf("block collisions per tick: %.1f, pairs per tick: %.1f, "
+        "grounded at the end: %d\n",
+        (double)collisions / options.ticks, (double)pairs / options.ticks,
+        grounded);
+
+    entity_list_free(&list);
+    map_free(&map);
+    return 0;
+}
@@ -0,0 +1,479 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "client.h"
+#include "config.h"
+#include "tools/tools.h"
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// Headless load generator.
+// Runs N simulated players against a server and reports latency percentiles
+// and throughput. client.c keeps one connection per process, so every bot is
+// a forked process; bots send their measurements to the parent through a
+// pipe, and the parent matches edits with their echoes and prints the report.
+//
+// Bots walk in a straight line (turning now and then) and send their position
+// 10 times a second like the client does; they request chunks near them,
+// place and break blocks and chat, each at a configurable rate.
+// Latencies measured:
+// - chunk: from sending C,p,q,key until the C,p,q that ends the response
+// - edit: from sending B until another bot (or the sender, if the server
+//   rejected it) receives a B for that position
+// - chat: from sending T until the sender receives its own broadcast
+//
+// Edits are only broadcast if the server lets guests build (AUTH_REQUIRED
+// off); otherwise every edit is rejected and echoed back to its sender.
+
+
+#define TICK_NS 1000000
+#define MAX_PENDING 4096
+// Edits are made far from where the bots walk, so the block rows in chunk
+// responses are never mistaken for edit echoes
+#define EDIT_X 100000
+#define EDIT_Y 200
+#define EDIT_ITEM 3
+
+// Measurement sent from a bot to the parent
+// - type: 'C' chunk latency, 'T' chat latency, 'E' edit sent,
+//   'B' block received, 'S' totals
+// - x, y, z, w: block for 'E' and 'B'; for 'S': bytes sent, bytes
+//   received, lines received
+// - t: latency in seconds ('C', 'T') or monotonic time ('E', 'B')
+typedef struct {
+    char type;
+    int x;
+    int y;
+    int z;
+    int w;
+    double t;
+} Record;
+
+// Growable list of doubles
+typedef struct {
+    double *data;
+    int size;
+    int capacity;
+} Samples;
+
+// Block edit as seen by the parent
+typedef struct {
+    int x;
+    int y;
+    int z;
+    int w;
+    double t;
+} Edit;
+
+// Settings
+// - bots: number of simulated players
+// - duration: seconds to run
+// - speed: walking speed in blocks per second
+// - chunk_rate, edit_rate, chat_rate: per bot, per second
+// - position_rate: position updates per bot, per second
+// - radius: chunk request radius around a bot
+// - compress: request stream compression
+typedef struct {
+    const char *host;
+    int port;
+    int bots;
+    double duration;
+    double speed;
+    double chunk_rate;
+    double edit_rate;
+    double chat_rate;
+    double position_rate;
+    int radius;
+    int compress;
+} Options;
+
+
+// Decide whether an event with the given rate happens this tick
+// Arguments:
+// - rate: events per second
+// - dt: tick length in seconds
+// Returns:
+// - non-zero if the event happens
+static int chance(double rate, double dt) {
+    return rand() < rate * dt * RAND_MAX;
+}
+
+
+// Send a record to the parent
+static void emit(int fd, char type, int x, int y, int z, int w, double t) {
+    Record record = {type, x, y, z, w, t};
+    if (write(fd, &record, sizeof(record)) != sizeof(record)) {
+        perror("write");
+        exit(1);
+    }
+}
+
+
+// Run one bot until the duration is over
+// Arguments:
+// - options: settings
+// - index: bot number
+// - fd: pipe to the parent
+// Returns: none
+static void run_bot(const Options *options, int index, int fd) {
+    srand(index * 7919 + (unsigned int)time(NULL));
+    client_enable();
+    client_connect((char *)options->host, options->port);
+    client_start();
+    client_version(1);
+    if (options->compress) {
+        client_compress();
+    }
+    client_flush();
+
+    // Each bot edits its own column of positions so edits never collide
+    int edit_x = EDIT_X + index * 4;
+    int edit_z = 0;
+    int edit_count = 0;
+    int chat_count = 0;
+    double chat_sent[MAX_PENDING];
+    int chunk_p[MAX_PENDING];
+    int chunk_q[MAX_PENDING];
+    double chunk_sent[MAX_PENDING];
+    int chunk_count = 0;
+    int lines = 0;
+    char text[64];
+
+    float x = (rand() % 256) - 128;
+    float z = (rand() % 256) - 128;
+    float y = 40;
+    float heading = (rand() % 628) / 100.0;
+    double start = now();
+    double last = start;
+    double last_position = start;
+    while (last - start < options->duration) {
+        struct timespec delay = {0, TICK_NS};
+        nanosleep(&delay, NULL);
+        double t = now();
+        double dt = t - last;
+        last = t;
+
+        // Walk
+        if (chance(0.2, dt)) {
+            heading += ((rand() % 200) - 100) / 100.0;
+        }
+        x += cosf(heading) * options->speed * dt;
+        z += sinf(heading) * options->speed * dt;
+        if ((t - last_position) * options->position_rate >= 1) {
+            client_position(x, y, z, heading, 0);
+            last_position = t;
+        }
+
+        // Request a chunk near the bot
+        if (chance(options->chunk_rate, dt) && chunk_count < MAX_PENDING) {
+            int r = options->radius;
+            int p = chunked(x) + (rand() % (r * 2 + 1)) - r;
+            int q = chunked(z) + (rand() % (r * 2 + 1)) - r;
+            int key = 0;
+            client_chunks(1, &p, &q, &key);
+            chunk_p[chunk_count] = p;
+            chunk_q[chunk_count] = q;
+            chunk_sent[chunk_count] = t;
+            chunk_count++;
+        }
+
+        // Place a block, then break it on the next edit
+        if (chance(options->edit_rate, dt)) {
+            int w = (edit_count % 2) ? 0 : EDIT_ITEM;
+            client_block(edit_x, EDIT_Y, edit_z % 1024, w);
+            emit(fd, 'E', edit_x, EDIT_Y, edit_z % 1024, w, t);
+            edit_count++;
+            if (!w) {
+                edit_z++;
+            }
+        }
+
+        // Chat
+        if (chance(options->chat_rate, dt)) {
+            snprintf(text, sizeof(text), "bot%d %d", index, chat_count);
+            client_talk(text);
+            chat_sent[chat_count % MAX_PENDING] = t;
+            chat_count++;
+        }
+        client_flush();
+
+        // Read everything the server sent
+        char *buffer = client_recv();
+        if (!buffer) {
+            continue;
+        }
+        t = now();
+        char *key = buffer;
+        char *line = strtok_r(buffer, "\n", &key);
+        while (line) {
+            int bp, bq, bx, by, bz, bw, bot, seq;
+            lines++;
+            if (sscanf(line, "C,%d,%d", &bp, &bq) == 2) {
+                for (int i = 0; i < chunk_count; i++) {
+                    if (chunk_p[i] == bp && chunk_q[i] == bq) {
+                        emit(fd, 'C', 0, 0, 0, 0, t - chunk_sent[i]);
+                        chunk_count--;
+                        memmove(chunk_p + i, chunk_p + i + 1,
+                            sizeof(int) * (chunk_count - i));
+                        memmove(chunk_q + i, chunk_q + i + 1,
+                            sizeof(int) * (chunk_count - i));
+                        memmove(chunk_sent + i, chunk_sent + i + 1,
+                            sizeof(double) * (chunk_count - i));
+                        break;
+                    }
+                }
+            }
+            else if (sscanf(line, "B,%d,%d,%d,%d,%d,%d",
+                &bp, &bq, &bx, &by, &bz, &bw) == 6)
+            {
+                if (bp == chunked(bx) && bq == chunked(bz)) {
+                    emit(fd, 'B', bx, by, bz, bw, t);
+                }
+            }
+            else if (line[0] == 'T') {
+                char *message = strstr(line, "> bot");
+                if (message && sscanf(message, "> bot%d %d", &bot, &seq) == 2 &&
+                    bot == index && seq < chat_count)
+                {
+                    emit(fd, 'T', 0, 0, 0, 0, t - chat_sent[seq % MAX_PENDING]);
+                }
+            }
+            line = strtok_r(NULL, "\n", &key);
+        }
+        free(buffer);
+    }
+    int sent, received, writes, max_queued;
+    get_client_stats(&sent, &received, &writes, &max_queued);
+    emit(fd, 'S', sent, received, lines, 0, 0);
+    client_stop();
+    client_disable();
+}
+
+
+// Add a sample to a list
+static void samples_add(Samples *samples, double value) {
+    if (samples->size == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 1024;
+        samples->data = realloc(samples->data,
+            sizeof(double) * samples->capacity);
+    }
+    samples->data[samples->size++] = value;
+}
+
+
+// qsort comparison for doubles
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+// qsort comparison for edits: by position, then by time.
+// The block id is ignored because a rejected edit is echoed with the block
+// that is really there.
+static int compare_edits(const void *a, const void *b) {
+    const Edit *e1 = (const Edit *)a;
+    const Edit *e2 = (const Edit *)b;
+    if (e1->x != e2->x) return e1->x < e2->x ? -1 : 1;
+    if (e1->z != e2->z) return e1->z < e2->z ? -1 : 1;
+    if (e1->y != e2->y) return e1->y < e2->y ? -1 : 1;
+    return (e1->t > e2->t) - (e1->t < e2->t);
+}
+
+
+// Print the count, rate and latency percentiles of a list of samples
+// Arguments:
+// - name: what was measured
+// - samples: latencies in seconds (sorted in place)
+// - duration: length of the run in seconds
+// Returns: none
+static void report(const char *name, Samples *samples, double duration) {
+    int n = samples->size;
+    if (!n) {
+        printf("%-6s      0\n", name);
+        return;
+    }
+    qsort(samples->data, n, sizeof(double), compare_doubles);
+    double *d = samples->data;
+    printf("%-6s %6d %9.1f/s   p50 %7.2f   p99 %7.2f   p999 %7.2f   "
+        "max %7.2f ms\n", name, n, n / duration,
+        d[(int)(n * 0.5)] * 1000, d[(int)(n * 0.99)] * 1000,
+        d[(int)(n * 0.999)] * 1000, d[n - 1] * 1000);
+}
+
+
+// Print usage and exit
+static void usage(const char *program) {
+    fprintf(stderr,
+        "usage: %s [-n BOTS] [-d SECONDS] [-s SPEED] [-c CHUNKS/S] "
+        "[-e EDITS/S] [-t CHATS/S] [-p POSITIONS/S] [-r RADIUS] [-z] "
+        "[HOST [PORT]]\n",
+        program);
+    exit(1);
+}
+
+
+// Run the load test
+// Arguments:
+// - argc: number of arguments
+// - argv: options (see usage)
+// Returns:
+// - 0
+int main(int argc, char **argv) {
+    Options options = {
+        "127.0.0.1", DEFAULT_PORT, 10, 30, 4.3, 2, 1, 0.2, 10, 8, 0};
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:s:c:e:t:p:r:z")) != -1) {
+        switch (opt) {
+            case 'n': options.bots = atoi(optarg); break;
+            case 'd': options.duration = atof(optarg); break;
+            case 's': options.speed = atof(optarg); break;
+            case 'c': options.chunk_rate = atof(optarg); break;
+            case 'e': options.edit_rate = atof(optarg); break;
+            case 't': options.chat_rate = atof(optarg); break;
+            case 'p': options.position_rate = atof(optarg); break;
+            case 'r': options.radius = atoi(optarg); break;
+            case 'z': options.compress = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        options.host = argv[optind++];
+    }
+    if (optind < argc) {
+        options.port = atoi(argv[optind++]);
+    }
+    if (options.bots < 1 || options.radius < 0) {
+        usage(argv[0]);
+    }
+
+    // Start the bots
+    struct pollfd *fds = calloc(options.bots, sizeof(struct pollfd));
+    for (int i = 0; i < options.bots; i++) {
+        int pipefd[2];
+        if (pipe(pipefd) == -1) {
+            perror("pipe");
+            exit(1);
+        }
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0) {
+            close(pipefd[0]);
+            run_bot(&options, i, pipefd[1]);
+            close(pipefd[1]);
+            _exit(0);
+        }
+        close(pipefd[1]);
+        fds[i].fd = pipefd[0];
+        fds[i].events = POLLIN;
+    }
+
+    // Collect records until every bot has finished
+    Samples chunks = {0};
+    Samples chats = {0};
+    Samples edit_latency = {0};
+    Edit *sent = NULL;
+    Edit *received = NULL;
+    int sent_count = 0, sent_capacity = 0;
+    int received_count = 0, received_capacity = 0;
+    double bytes_sent = 0, bytes_received = 0, lines = 0;
+    int remaining = options.bots;
+    while (remaining) {
+        if (poll(fds, options.bots, -1) == -1) {
+            perror("poll");
+            exit(1);
+        }
+        for (int i = 0; i < options.bots; i++) {
+            if (fds[i].fd < 0 || !fds[i].revents) {
+                continue;
+            }
+            Record record;
+            if (read(fds[i].fd, &record, sizeof(record)) != sizeof(record)) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                remaining--;
+                continue;
+            }
+            Edit edit = {record.x, record.y, record.z, record.w, record.t};
+            switch (record.type) {
+                case 'C':
+                    samples_add(&chunks, record.t);
+                    break;
+                case 'T':
+                    samples_add(&chats, record.t);
+                    break;
+                case 'E':
+                    if (sent_count == sent_capacity) {
+                        sent_capacity = sent_capacity ? sent_capacity * 2 : 1024;
+                        sent = realloc(sent, sizeof(Edit) * sent_capacity);
+                    }
+                    sent[sent_count++] = edit;
+                    break;
+                case 'B':
+                    if (received_count == received_capacity) {
+                        received_capacity =
+                            received_capacity ? received_capacity * 2 : 1024;
+                        received = realloc(received,
+                            sizeof(Edit) * received_capacity);
+                    }
+                    received[received_count++] = edit;
+                    break;
+                case 'S':
+                    bytes_sent += record.x;
+                    bytes_received += record.y;
+                    lines += record.z;
+                    break;
+            }
+        }
+    }
+    double duration = options.duration;
+    while (wait(NULL) > 0);
+
+    // Match every received block with the latest edit there sent before it
+    qsort(sent, sent_count, sizeof(Edit), compare_edits);
+    for (int i = 0; i < received_count; i++) {
+        Edit *e = received + i;
+        int lo = 0, hi = sent_count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (compare_edits(sent + mid, e) <= 0) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        if (lo > 0) {
+            Edit *s = sent + lo - 1;
+            if (s->x == e->x && s->y == e->y && s->z == e->z) {
+                samples_add(&edit_latency, e->t - s->t);
+            }
+        }
+    }
+
+    printf("%d bots, %.1f s, %d edits sent\n",
+        options.bots, duration, sent_count);
+    report("chunk", &chunks, duration);
+    report("edit", &edit_latency, duration);
+    report("chat", &chats, duration);
+    printf("sent %.1f KB/s, received %.1f KB/s, %.0f lines/s\n",
+        bytes_sent / duration / 1024, bytes_received / duration / 1024,
+        lines / duration);
+    free(chunks.data);
+    free(chats.data);
+    free(edit_latency.data);
+    free(sent);
+    free(received);
+    free(fds);
+    return 0;
+}
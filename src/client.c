@@ -10,15 +10,23 @@
 
 
 #include "client.h"
+#include "lodepng.h"
 #include "tinycthread.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 
-// "QUEUE_SIZE" is the number of chars in the send queue
+// "QUEUE_SIZE" is the number of chars in the receive queue
 #define QUEUE_SIZE 1048576
 #define RECV_SIZE 4096
+// "SEND_QUEUE_SIZE" is the initial number of chars in the send queue (it can grow)
+#define SEND_QUEUE_SIZE 65536
+// Size of the header in front of each compressed frame (big-endian length)
+#define FRAME_HEADER_SIZE 4
+// Maximum number of chunks requested by a single "C" line
+#define CHUNK_BATCH_SIZE 64
+#define BLOCK_BATCH_SIZE 64
 
 // Client state (not available to outside code)
 
@@ -35,6 +43,31 @@ static int qsize = 0;
 static thrd_t recv_thread;
 static mtx_t mutex;
 
+// Outbound data is appended to the send queue by client_send() and written
+// to the socket by the send thread, so the main thread never blocks on send().
+static char *send_queue = 0;
+static int send_qsize = 0;
+static int send_qcapacity = 0;
+static int send_qmax = 0;
+static int send_writes = 0;
+static thrd_t send_thread;
+static mtx_t send_mutex;
+static cnd_t send_cnd;
+
+// Stream compression state (see client_compress()).
+// - compress_requested: "Z,1" was sent and the server's "Z,1" is awaited
+//   (guarded by mutex)
+// - compress_recv: data from the server is a sequence of compressed frames
+// - compress_send: data to the server is a sequence of compressed frames
+// - compress_from: offset in the send queue where compressed data starts,
+//   or -1 if the send side is not switching over
+static int compress_requested = 0;
+static int compress_recv = 0;
+static int compress_send = 0;
+static int compress_from = -1;
+static int sent_raw = 0;
+static int received_raw = 0;
+
 
 // Sets the client state to be enabled.
 // Arguments: none
@@ -65,25 +98,82 @@ int get_client_enabled() {
 // - data: string data to send
 // - length: length of the string data
 // Returns:
-// - 0 upon completion/success
+// - number of chars sent upon completion/success, or -1 on error
 int client_sendall(int sd, char *data, int length) {
     if (!client_enabled) {
         return 0;
     }
     int count = 0;
-    while (count < length) {
+    while (length > 0) {
         int n = send(sd, data + count, length, 0);
         if (n == -1) {
             return -1;
         }
         count += n;
         length -= n;
-        bytes_sent += n;
     }
-    return 0;
+    return count;
 }
 
-// Client send a data string
+// Compress data into one frame and send it.
+// A frame is a 4 byte big-endian length followed by that many bytes of zlib
+// data. Each frame is compressed on its own, so every frame ends on a message
+// boundary and can be decompressed as soon as it has arrived.
+// Arguments:
+// - sd: socket descriptor to send data through
+// - data: string data to compress and send
+// - length: length of the string data
+// Returns:
+// - number of bytes sent upon completion/success, or -1 on error
+int client_sendframe(int sd, char *data, int length) {
+    unsigned char *out = 0;
+    size_t outsize = 0;
+    unsigned error = lodepng_zlib_compress(
+        &out, &outsize, (const unsigned char *)data, length,
+        &lodepng_default_compress_settings);
+    if (error) {
+        fprintf(stderr, "deflate: %s\n", lodepng_error_text(error));
+        return -1;
+    }
+    char header[FRAME_HEADER_SIZE];
+    header[0] = (outsize >> 24) & 0xff;
+    header[1] = (outsize >> 16) & 0xff;
+    header[2] = (outsize >> 8) & 0xff;
+    header[3] = outsize & 0xff;
+    int result = -1;
+    if (client_sendall(sd, header, FRAME_HEADER_SIZE) != -1 &&
+        client_sendall(sd, (char *)out, outsize) != -1)
+    {
+        result = FRAME_HEADER_SIZE + outsize;
+    }
+    free(out);
+    return result;
+}
+
+// Append data to the send queue, growing it as needed.
+// Must be called with send_mutex held.
+// Arguments:
+// - data: chars to queue
+// - length: number of chars
+// Returns: none
+static void send_append(const char *data, int length) {
+    if (send_qsize + length > send_qcapacity) {
+        int capacity = send_qcapacity;
+        while (send_qsize + length > capacity) {
+            capacity *= 2;
+        }
+        send_queue = realloc(send_queue, sizeof(char) * capacity);
+        send_qcapacity = capacity;
+    }
+    memcpy(send_queue + send_qsize, data, sizeof(char) * length);
+    send_qsize += length;
+    send_qmax = send_qsize > send_qmax ? send_qsize : send_qmax;
+}
+
+// Client send a data string.
+// The data is only queued; it is written out by the send thread after the
+// next call to client_flush(), so several small messages produced within one
+// frame are coalesced into one write.
 // Arguments:
 // - data
 // Returns: none
@@ -91,10 +181,118 @@ void client_send(char *data) {
     if (!client_enabled) {
         return;
     }
-    if (client_sendall(sd, data, strlen(data)) == -1) {
-        perror("client_sendall");
-        exit(1);
+    mtx_lock(&send_mutex);
+    send_append(data, strlen(data));
+    mtx_unlock(&send_mutex);
+}
+
+// Wake up the send thread to write out everything queued so far.
+// Meant to be called once per frame.
+// Arguments: none
+// Returns: none
+void client_flush() {
+    if (!client_enabled) {
+        return;
     }
+    mtx_lock(&send_mutex);
+    if (send_qsize) {
+        cnd_signal(&send_cnd);
+    }
+    mtx_unlock(&send_mutex);
+}
+
+// Get the number of chars waiting in the send queue.
+// Arguments: none
+// Returns:
+// - send queue depth in chars
+int get_client_send_queue_size() {
+    if (!client_enabled) {
+        return 0;
+    }
+    mtx_lock(&send_mutex);
+    int result = send_qsize;
+    mtx_unlock(&send_mutex);
+    return result;
+}
+
+// Request stream compression for this connection.
+// "Z,1" is sent to the server, and a server that supports compression answers
+// with "Z,1" as the last line it sends uncompressed. The client then sends
+// "Z,1" as its own last uncompressed line. A server that does not support
+// compression ignores the request and the connection stays uncompressed.
+// Must be called after client_start().
+// Arguments: none
+// Returns: none
+void client_compress() {
+    if (!client_enabled) {
+        return;
+    }
+    mtx_lock(&mutex);
+    compress_requested = 1;
+    mtx_unlock(&mutex);
+    client_send("Z,1\n");
+}
+
+// Get whether the connection is compressed in both directions.
+// Arguments: none
+// Returns:
+// - non-zero if compression is active
+int get_client_compressed() {
+    if (!client_enabled) {
+        return 0;
+    }
+    mtx_lock(&send_mutex);
+    int result = compress_recv && compress_send;
+    mtx_unlock(&send_mutex);
+    return result;
+}
+
+// Get client compression statistics.
+// The raw counts are protocol chars before compression and after
+// decompression; the wire counts are bytes that went through the socket.
+// Arguments:
+// - raw_sent: pointer to output the number of protocol chars sent
+// - wire_sent: pointer to output the number of bytes sent
+// - raw_received: pointer to output the number of protocol chars received
+// - wire_received: pointer to output the number of bytes received
+// Returns: none
+void get_client_compression_stats(
+    int *raw_sent, int *wire_sent, int *raw_received, int *wire_received)
+{
+    *raw_sent = *wire_sent = *raw_received = *wire_received = 0;
+    if (!client_enabled) {
+        return;
+    }
+    mtx_lock(&send_mutex);
+    *raw_sent = sent_raw;
+    *wire_sent = bytes_sent;
+    mtx_unlock(&send_mutex);
+    mtx_lock(&mutex);
+    *raw_received = received_raw;
+    *wire_received = bytes_received;
+    mtx_unlock(&mutex);
+}
+
+// Get client network statistics.
+// Arguments:
+// - sent: pointer to output the number of bytes sent
+// - received: pointer to output the number of bytes received
+// - writes: pointer to output the number of coalesced socket writes
+// - max_queued: pointer to output the largest send queue depth seen
+// Returns: none
+void get_client_stats(int *sent, int *received, int *writes, int *max_queued) {
+    *sent = *received = *writes = *max_queued = 0;
+    if (!client_enabled) {
+        return;
+    }
+    mtx_lock(&send_mutex);
+    *sent = bytes_sent;
+    *writes = send_writes;
+    *max_queued = send_qmax;
+    mtx_unlock(&send_mutex);
+    mtx_lock(&mutex);
+    *received = bytes_received;
+    mtx_unlock(&mutex);
 }
 
 // Client send version
@@ -152,19 +350,55 @@ void client_position(float x, float y, float z, float rx, float ry) {
     client_send(buffer);
 }
 
-// Client send request for chunk
+// Client send request for a batch of chunks.
+// The chunks are requested in the given order, several per "C" line, and the
+// server answers them in that same order.
 // Arguments:
-// - p
-// - q
-// - key
+// - count: number of chunks to request
+// - p: array of chunk x positions
+// - q: array of chunk z positions
+// - key: array of cache keys for the chunks
 // Returns: none
-void client_chunk(int p, int q, int key) {
+void client_chunks(int count, const int *p, const int *q, const int *key) {
     if (!client_enabled) {
         return;
     }
-    char buffer[1024];
-    snprintf(buffer, 1024, "C,%d,%d,%d\n", p, q, key);
-    client_send(buffer);
+    char buffer[CHUNK_BATCH_SIZE * 36 + 4];
+    int i = 0;
+    while (i < count) {
+        int length = snprintf(buffer, sizeof(buffer), "C");
+        for (int n = 0; n < CHUNK_BATCH_SIZE && i < count; n++, i++) {
+            length += snprintf(buffer + length, sizeof(buffer) - length,
+                ",%d,%d,%d", p[i], q[i], key[i]);
+        }
+        snprintf(buffer + length, sizeof(buffer) - length, "\n");
+        client_send(buffer);
+    }
+}
+
+// Client send a batch of block updates.
+// The updates are sent in the given order, several per "M" line, and the
+// server applies them in that order, each like a "B" line.
+// Arguments:
+// - count: number of block updates
+// - blocks: block positions and ids
+// Returns: none
+void client_blocks(int count, const Block *blocks) {
+    if (!client_enabled) {
+        return;
+    }
+    char buffer[BLOCK_BATCH_SIZE * 48 + 4];
+    int i = 0;
+    while (i < count) {
+        int length = snprintf(buffer, sizeof(buffer), "M");
+        for (int n = 0; n < BLOCK_BATCH_SIZE && i < count; n++, i++) {
+            const Block *b = blocks + i;
+            length += snprintf(buffer + length, sizeof(buffer) - length,
+                ",%d,%d,%d,%d", b->x, b->y, b->z, b->w);
+        }
+        snprintf(buffer + length, sizeof(buffer) - length, "\n");
+        client_send(buffer);
+    }
 }
 
 // Client send block update
@@ -254,12 +488,85 @@ char *client_recv() {
         int remaining = qsize - length;
         memmove(queue, p + 1, remaining);
         qsize -= length;
-        bytes_received += length;
     }
     mtx_unlock(&mutex);
     return result;
 }
 
+// Append received protocol text to the receive queue, waiting for the main
+// thread to make room if necessary.
+// Arguments:
+// - data: protocol text
+// - length: number of chars in data
+// Returns: none
+static void recv_append(const char *data, int length) {
+    while (length > 0) {
+        int n = length < RECV_SIZE ? length : RECV_SIZE;
+        int done = 0;
+        mtx_lock(&mutex);
+        if (qsize + n < QUEUE_SIZE) {
+            memcpy(queue + qsize, data, sizeof(char) * n);
+            qsize += n;
+            queue[qsize] = '\0';
+            received_raw += n;
+            done = 1;
+        }
+        mtx_unlock(&mutex);
+        if (done) {
+            data += n;
+            length -= n;
+        }
+        else {
+            sleep(0);
+        }
+    }
+}
+
+// Switch the send side over to compression.
+// "Z,1" is queued as the last uncompressed line, and everything queued after
+// it is compressed by the send thread. Both happen under one lock, so no
+// line the main thread queues can fall between them.
+// Arguments: none
+// Returns: none
+static void compress_start_send() {
+    mtx_lock(&send_mutex);
+    compress_recv = 1;
+    send_append("Z,1\n", 4);
+    compress_from = send_qsize;
+    cnd_signal(&send_cnd);
+    mtx_unlock(&send_mutex);
+}
+
+// Decompress all complete frames at the start of a buffer.
+// Arguments:
+// - data: buffer of compressed frames
+// - length: number of bytes in data
+// Returns:
+// - number of bytes consumed from data
+static int recv_frames(const unsigned char *data, int length) {
+    int offset = 0;
+    while (length - offset >= FRAME_HEADER_SIZE) {
+        const unsigned char *h = data + offset;
+        int size = (h[0] << 24) | (h[1] << 16) | (h[2] << 8) | h[3];
+        if (length - offset - FRAME_HEADER_SIZE < size) {
+            break;
+        }
+        unsigned char *out = 0;
+        size_t outsize = 0;
+        unsigned error = lodepng_zlib_decompress(
+            &out, &outsize, h + FRAME_HEADER_SIZE, size,
+            &lodepng_default_decompress_settings);
+        if (error) {
+            fprintf(stderr, "inflate: %s\n", lodepng_error_text(error));
+            exit(1);
+        }
+        recv_append((const char *)out, outsize);
+        free(out);
+        offset += FRAME_HEADER_SIZE + size;
+    }
+    return offset;
+}
+
 // Receive worker
 // Arguments:
 // - arg
@@ -267,6 +574,13 @@ char *client_recv() {
 // - ?
 int recv_worker(void *) {
     char *data = malloc(sizeof(char) * RECV_SIZE);
+    // Compressed bytes that do not make up a complete frame yet
+    int pending_capacity = RECV_SIZE;
+    int pending_size = 0;
+    unsigned char *pending = malloc(pending_capacity);
+    // Chars of the current uncompressed line, used to spot the server's "Z,1"
+    char line[4] = {0};
+    int line_length = 0;
     while (1) {
         int length;
         if ((length = recv(sd, data, RECV_SIZE - 1, 0)) <= 0) {
@@ -278,21 +592,111 @@ int recv_worker(void *) {
                 break;
             }
         }
-        data[length] = '\0';
-        while (1) {
-            int done = 0;
-            mtx_lock(&mutex);
-            if (qsize + length < QUEUE_SIZE) {
-                memcpy(queue + qsize, data, sizeof(char) * (length + 1));
-                qsize += length;
-                done = 1;
+        mtx_lock(&mutex);
+        bytes_received += length;
+        int requested = compress_requested;
+        mtx_unlock(&mutex);
+        // Number of chars at the start of data that are not compressed
+        int plain = compress_recv ? 0 : length;
+        if (!compress_recv && requested) {
+            // Look for the server's "Z,1" line, which is the last
+            // uncompressed line it sends.
+            for (int i = 0; i < length; i++) {
+                if (data[i] != '\n') {
+                    if (line_length < 4) {
+                        line[line_length] = data[i];
+                    }
+                    line_length++;
+                    continue;
+                }
+                int ack = line_length == 3 && memcmp(line, "Z,1", 3) == 0;
+                line_length = 0;
+                if (ack) {
+                    plain = i + 1;
+                    mtx_lock(&mutex);
+                    compress_requested = 0;
+                    mtx_unlock(&mutex);
+                    compress_start_send();
+                    break;
+                }
             }
-            mtx_unlock(&mutex);
-            if (done) {
-                break;
+        }
+        if (plain > 0) {
+            recv_append(data, plain);
+        }
+        if (plain < length) {
+            int n = length - plain;
+            if (pending_size + n > pending_capacity) {
+                while (pending_size + n > pending_capacity) {
+                    pending_capacity *= 2;
+                }
+                pending = realloc(pending, pending_capacity);
             }
-            sleep(0);
+            memcpy(pending + pending_size, data + plain, n);
+            pending_size += n;
+            int used = recv_frames(pending, pending_size);
+            memmove(pending, pending + used, pending_size - used);
+            pending_size -= used;
+        }
+    }
+    free(pending);
+    free(data);
+    return 0;
+}
+
+// Send worker
+// Swaps out the whole send queue and writes it with a single
+// client_sendall(), so the main thread only ever blocks on the queue mutex.
+// Arguments:
+// - arg: unused in this function
+// Returns:
+// - 0
+int send_worker(void * /*arg*/) {
+    int capacity = SEND_QUEUE_SIZE;
+    char *data = malloc(sizeof(char) * capacity);
+    while (1) {
+        mtx_lock(&send_mutex);
+        while (running && send_qsize == 0) {
+            cnd_wait(&send_cnd, &send_mutex);
+        }
+        if (!running && send_qsize == 0) {
+            mtx_unlock(&send_mutex);
+            break;
+        }
+        // Swap buffers with the queue so the lock is not held while sending
+        char *swap = send_queue;
+        int swap_capacity = send_qcapacity;
+        int length = send_qsize;
+        send_queue = data;
+        send_qcapacity = capacity;
+        send_qsize = 0;
+        data = swap;
+        capacity = swap_capacity;
+        // Number of chars at the start of data to send uncompressed
+        int plain = compress_send ? 0 : length;
+        if (compress_from >= 0) {
+            plain = compress_from;
+            compress_from = -1;
+            compress_send = 1;
+        }
+        mtx_unlock(&send_mutex);
+        int wire = client_sendall(sd, data, plain);
+        if (wire != -1 && plain < length) {
+            int n = client_sendframe(sd, data + plain, length - plain);
+            wire = n == -1 ? -1 : wire + n;
+        }
+        if (wire == -1) {
+            if (running) {
+                perror("client_sendall");
+                exit(1);
+            }
+            break;
         }
+        mtx_lock(&send_mutex);
+        bytes_sent += wire;
+        sent_raw += length;
+        send_writes++;
+        mtx_unlock(&send_mutex);
     }
     free(data);
     return 0;
@@ -339,6 +743,27 @@ void client_start() {
         return;
     }
     running = 1;
+    bytes_sent = 0;
+    bytes_received = 0;
+    sent_raw = 0;
+    received_raw = 0;
+    compress_requested = 0;
+    compress_recv = 0;
+    compress_send = 0;
+    compress_from = -1;
+    // Create the send queue
+    // (before the receive thread, which may switch on send compression)
+    send_qcapacity = SEND_QUEUE_SIZE;
+    send_queue = (char *)calloc(send_qcapacity, sizeof(char));
+    send_qsize = 0;
+    send_qmax = 0;
+    send_writes = 0;
+    mtx_init(&send_mutex, mtx_plain);
+    cnd_init(&send_cnd);
+    if (thrd_create(&send_thread, send_worker, NULL) != thrd_success) {
+        perror("thrd_create");
+        exit(1);
+    }
     // Create the queue
     queue = (char *)calloc(QUEUE_SIZE, sizeof(char));
     qsize = 0;
@@ -356,7 +781,20 @@ void client_stop() {
     if (!client_enabled) {
         return;
     }
+    // Let the send thread write out whatever is still queued before closing
+    mtx_lock(&send_mutex);
     running = 0;
+    cnd_signal(&send_cnd);
+    mtx_unlock(&send_mutex);
+    if (thrd_join(send_thread, NULL) != thrd_success) {
+        perror("thrd_join");
+        exit(1);
+    }
+    cnd_destroy(&send_cnd);
+    mtx_destroy(&send_mutex);
+    free(send_queue);
+    send_queue = 0;
+    send_qsize = 0;
     close(sd);
     // if (thrd_join(recv_thread, NULL) != thrd_success) {
     //     perror("thrd_join");
@@ -2,6 +2,9 @@
 #define _client_h_
 
 
+#include "Block.h"
+
+
 #define DEFAULT_PORT 4080
 
 
@@ -11,10 +14,17 @@ void client_block(
         int z,
         int w);
 
-void client_chunk(
-        int p,
-        int q,
-        int key);
+void client_blocks(
+        int count,
+        const Block *blocks);
+
+void client_chunks(
+        int count,
+        const int *p,
+        const int *q,
+        const int *key);
+
+void client_compress();
 
 void client_connect(
         char *hostname,
@@ -24,6 +34,8 @@ void client_disable();
 
 void client_enable();
 
+void client_flush();
+
 void client_light(
         int x,
         int y,
@@ -65,5 +77,21 @@ void client_version(
 
 int get_client_enabled();
 
+int get_client_compressed();
+
+void get_client_compression_stats(
+        int *raw_sent,
+        int *wire_sent,
+        int *raw_received,
+        int *wire_received);
+
+int get_client_send_queue_size();
+
+void get_client_stats(
+        int *sent,
+        int *received,
+        int *writes,
+        int *max_queued);
+
 
 #endif
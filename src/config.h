@@ -15,6 +15,13 @@
 #define DAY_LENGTH 600
 #define INVERT_MOUSE 0
 #define WORKERS 4              // Number of worker threads
+#define USE_COMPRESSION 0      // Request a compressed stream from servers
+#define LOG_FRAME_TIMES 0      // Log per-frame network timings from startup
+#define FRAME_LOG_PATH "frames.csv"
+#define USE_CAVE_CULLING 1     // Skip chunk sections hidden behind terrain
+#define TICK_RATE 60           // Simulation ticks per second
+#define FALL_DELAY 3           // Ticks a falling block (sand) takes per block
+#define BLOCK_UPDATES_PER_TICK 256 // Scheduled block updates run per tick at most
 
 // rendering options
 #define SHOW_LIGHTS 1
@@ -50,8 +57,14 @@
 #define CREATE_CHUNK_RADIUS 10
 #define RENDER_CHUNK_RADIUS 10
 #define RENDER_SIGN_RADIUS 4
+#define LOD_CHUNK_RADIUS 32    // Simplified terrain is drawn out to this radius
+#define LOD_CHUNKS_PER_FRAME 4 // Simplified chunks queued for the workers per frame
 #define DELETE_CHUNK_RADIUS 14
 #define CHUNK_SIZE 32
+#define CHUNK_SECTIONS 16      // Sections (stacked along Y) per chunk
+#define SECTION_SIZE (256 / CHUNK_SECTIONS)
+#define FACE_GROUPS 7          // Face directions in a mesh section, and plants
+#define MESH_GROUPS (2 * CHUNK_SECTIONS * FACE_GROUPS)
 #define COMMIT_INTERVAL 5
 #define MAX_NAME_LENGTH 32
 
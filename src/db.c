@@ -3,6 +3,7 @@
 #include "sqlite3.h"
 #include "tinycthread.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // Database code to save and load worlds.
@@ -19,7 +20,9 @@ static sqlite3_stmt *delete_signs_stmt;
 static sqlite3_stmt *load_blocks_stmt;
 static sqlite3_stmt *load_lights_stmt;
 static sqlite3_stmt *load_signs_stmt;
-static sqlite3_stmt *get_key_stmt;
+static sqlite3_stmt *load_block_rows_stmt;
+static sqlite3_stmt *load_light_rows_stmt;
+static sqlite3_stmt *load_keys_stmt;
 static sqlite3_stmt *set_key_stmt;
 static sqlite3_stmt *load_block_damage_stmt;
 static sqlite3_stmt *insert_block_damage_stmt;
@@ -29,8 +32,25 @@ static Ring ring;
 static thrd_t thrd;
 static mtx_t mtx;
 static cnd_t cnd;
+static cnd_t flush_cnd;
+static int worker_busy;
 static mtx_t load_mtx;
 
+// In-memory copy of the key table, so that chunk requests never have to
+// wait on sqlite. Only used from the main thread.
+typedef struct {
+    int p;
+    int q;
+    int key;
+    int used;
+} KeyEntry;
+
+static KeyEntry *keys;
+static unsigned int keys_mask;
+static unsigned int keys_size;
+
+static void db_load_keys();
+
 
 // Enable the database
 // (Used because the variable db_enabled is private to this file).
@@ -149,8 +169,13 @@ int db_init(char *path) {
         "select x, y, z, w from light where p = ? and q = ?;";
     static const char *load_signs_query =
         "select x, y, z, face, text from sign where p = ? and q = ?;";
-    static const char *get_key_query =
-        "select key from key where p = ? and q = ?;";
+    static const char *load_block_rows_query =
+        "select rowid, x, y, z, w from block "
+        "where p = ? and q = ? and rowid > ?;";
+    static const char *load_light_rows_query =
+        "select x, y, z, w from light where p = ? and q = ?;";
+    static const char *load_keys_query =
+        "select p, q, key from key;";
     static const char *set_key_query =
         "insert or replace into key (p, q, key) "
         "values (?, ?, ?);";
@@ -194,7 +219,13 @@ int db_init(char *path) {
     rc = sqlite3_prepare_v2(db, load_signs_query, -1, &load_signs_stmt, NULL);
     if (rc) { return bail(rc); }
 
-    rc = sqlite3_prepare_v2(db, get_key_query, -1, &get_key_stmt, NULL);
+    rc = sqlite3_prepare_v2(db, load_block_rows_query, -1, &load_block_rows_stmt, NULL);
+    if (rc) { return bail(rc); }
+
+    rc = sqlite3_prepare_v2(db, load_light_rows_query, -1, &load_light_rows_stmt, NULL);
+    if (rc) { return bail(rc); }
+
+    rc = sqlite3_prepare_v2(db, load_keys_query, -1, &load_keys_stmt, NULL);
     if (rc) { return bail(rc); }
 
     rc = sqlite3_prepare_v2(db, set_key_query, -1, &set_key_stmt, NULL);
@@ -209,6 +240,7 @@ int db_init(char *path) {
     rc = sqlite3_prepare_v2(db, trim_block_damage_query, -1, &trim_block_damage_stmt, NULL);
     if (rc) { return bail(rc); }
 
+    db_load_keys();
     sqlite3_exec(db, "begin;", NULL, NULL, NULL);
     db_worker_start(NULL);
     return 0;
@@ -230,12 +262,16 @@ void db_close() {
     sqlite3_finalize(load_blocks_stmt);
     sqlite3_finalize(load_lights_stmt);
     sqlite3_finalize(load_signs_stmt);
-    sqlite3_finalize(get_key_stmt);
+    sqlite3_finalize(load_block_rows_stmt);
+    sqlite3_finalize(load_light_rows_stmt);
+    sqlite3_finalize(load_keys_stmt);
     sqlite3_finalize(set_key_stmt);
     sqlite3_finalize(insert_block_damage_stmt);
     sqlite3_finalize(load_block_damage_stmt);
     sqlite3_finalize(trim_block_damage_stmt);
     sqlite3_close(db);
+    free(keys);
+    keys = NULL;
 }
 
 
@@ -251,6 +287,21 @@ void db_commit() {
 }
 
 
+// Wait until the worker has done every database operation queued so far, so
+// that reads see the writes made before them.
+// Note: must not be called from the worker.
+// Arguments: none
+// Returns: none
+void db_flush() {
+    if (!db_enabled) { return; }
+    mtx_lock(&mtx);
+    while (!ring_empty(&ring) || worker_busy) {
+        cnd_wait(&flush_cnd, &mtx);
+    }
+    mtx_unlock(&mtx);
+}
+
+
 // Actually do a database commit.
 // Arguments: none
 // Returns: none
@@ -437,6 +488,24 @@ static void _db_insert_block(int p, int q, int x, int y, int z, int w) {
 }
 
 
+// Let one of the workers insert a batch of blocks of one chunk into the
+// database, queued all at once.
+// Arguments:
+// - p, q: chunk x, z position
+// - blocks: block positions and ids
+// - count: number of blocks
+void db_insert_blocks(int p, int q, const Block *blocks, int count) {
+    if (!db_enabled || !count) { return; }
+    mtx_lock(&mtx);
+    for (int i = 0; i < count; i++) {
+        const Block *b = blocks + i;
+        ring_put_block(&ring, p, q, b->x, b->y, b->z, b->w);
+    }
+    cnd_signal(&cnd);
+    mtx_unlock(&mtx);
+}
+
+
 void db_insert_block_damage(int p, int q, int x, int y, int z, int damage) {
     if (!db_enabled) { return; }
     mtx_lock(&mtx);
@@ -646,7 +715,9 @@ void db_load_lights(Map *map, int p, int q) {
 // Returns:
 // - adds sign entries to list
 void db_load_signs(SignList *list, int p, int q) {
-    if (!db_enabled) { return; } sqlite3_reset(load_signs_stmt);
+    if (!db_enabled) { return; }
+    mtx_lock(&load_mtx);
+    sqlite3_reset(load_signs_stmt);
     sqlite3_bind_int(load_signs_stmt, 1, p);
     sqlite3_bind_int(load_signs_stmt, 2, q);
     while (sqlite3_step(load_signs_stmt) == SQLITE_ROW) {
@@ -658,24 +729,150 @@ void db_load_signs(SignList *list, int p, int q) {
             load_signs_stmt, 4);
         sign_list_add(list, x, y, z, face, text);
     }
+    mtx_unlock(&load_mtx);
 }
 
 
-// Get the key value for the chunk at the given position
+// Load the block rows stored for a chunk after the given key.
+// Unlike db_load_blocks, rows that clear a block (w = 0) are reported too.
 // Arguments:
 // - p: chunk x position
 // - q: chunk z position
+// - key: only rows stored after this key are loaded
+// - func: callback for each row (see world.h)
+// - arg: last argument to pass to the callback
 // Returns:
-// - key value
-int db_get_key(int p, int q) {
+// - the key of the newest row loaded, or 0 if there were none
+int db_load_block_rows(int p, int q, int key, world_func func, void *arg) {
     if (!db_enabled) { return 0; }
-    sqlite3_reset(get_key_stmt);
-    sqlite3_bind_int(get_key_stmt, 1, p);
-    sqlite3_bind_int(get_key_stmt, 2, q);
-    if (sqlite3_step(get_key_stmt) == SQLITE_ROW) {
-        return sqlite3_column_int(get_key_stmt, 0);
+    int result = 0;
+    mtx_lock(&load_mtx);
+    sqlite3_reset(load_block_rows_stmt);
+    sqlite3_bind_int(load_block_rows_stmt, 1, p);
+    sqlite3_bind_int(load_block_rows_stmt, 2, q);
+    sqlite3_bind_int(load_block_rows_stmt, 3, key);
+    while (sqlite3_step(load_block_rows_stmt) == SQLITE_ROW) {
+        int rowid = sqlite3_column_int(load_block_rows_stmt, 0);
+        int x = sqlite3_column_int(load_block_rows_stmt, 1);
+        int y = sqlite3_column_int(load_block_rows_stmt, 2);
+        int z = sqlite3_column_int(load_block_rows_stmt, 3);
+        int w = sqlite3_column_int(load_block_rows_stmt, 4);
+        func(x, y, z, w, arg);
+        if (rowid > result) {
+            result = rowid;
+        }
     }
-    return 0;
+    mtx_unlock(&load_mtx);
+    return result;
+}
+
+
+// Load every light row stored for a chunk, including lights turned off.
+// Arguments:
+// - p: chunk x position
+// - q: chunk z position
+// - func: callback for each row (see world.h)
+// - arg: last argument to pass to the callback
+// Returns: none
+void db_load_light_rows(int p, int q, world_func func, void *arg) {
+    if (!db_enabled) { return; }
+    mtx_lock(&load_mtx);
+    sqlite3_reset(load_light_rows_stmt);
+    sqlite3_bind_int(load_light_rows_stmt, 1, p);
+    sqlite3_bind_int(load_light_rows_stmt, 2, q);
+    while (sqlite3_step(load_light_rows_stmt) == SQLITE_ROW) {
+        int x = sqlite3_column_int(load_light_rows_stmt, 0);
+        int y = sqlite3_column_int(load_light_rows_stmt, 1);
+        int z = sqlite3_column_int(load_light_rows_stmt, 2);
+        int w = sqlite3_column_int(load_light_rows_stmt, 3);
+        func(x, y, z, w, arg);
+    }
+    mtx_unlock(&load_mtx);
+}
+
+
+// Find the key cache slot for a chunk
+// Arguments:
+// - p: chunk x position
+// - q: chunk z position
+// Returns:
+// - the entry for the chunk, or the empty slot where it belongs
+static KeyEntry *find_key(int p, int q) {
+    unsigned int index = ((unsigned int)p * 73856093u) ^
+        ((unsigned int)q * 19349663u);
+    index &= keys_mask;
+    KeyEntry *entry = keys + index;
+    while (entry->used && (entry->p != p || entry->q != q)) {
+        index = (index + 1) & keys_mask;
+        entry = keys + index;
+    }
+    return entry;
+}
+
+
+// Set a key in the in-memory key cache, growing it as needed
+// Arguments:
+// - p: chunk x position
+// - q: chunk z position
+// - key: key to be set for the chunk
+// Returns: none
+static void cache_key(int p, int q, int key) {
+    if (!keys) {
+        keys_mask = 0xfff;
+        keys_size = 0;
+        keys = (KeyEntry *)calloc(keys_mask + 1, sizeof(KeyEntry));
+    }
+    KeyEntry *entry = find_key(p, q);
+    if (!entry->used) {
+        if ((keys_size + 1) * 2 > keys_mask) {
+            KeyEntry *old = keys;
+            unsigned int old_mask = keys_mask;
+            keys_mask = (keys_mask << 1) | 1;
+            keys = (KeyEntry *)calloc(keys_mask + 1, sizeof(KeyEntry));
+            for (unsigned int i = 0; i <= old_mask; i++) {
+                if (old[i].used) {
+                    *find_key(old[i].p, old[i].q) = old[i];
+                }
+            }
+            free(old);
+            entry = find_key(p, q);
+        }
+        entry->used = 1;
+        entry->p = p;
+        entry->q = q;
+        keys_size++;
+    }
+    entry->key = key;
+}
+
+
+// Load every chunk key from the database into the key cache
+// Arguments: none
+// Returns: none
+static void db_load_keys() {
+    free(keys);
+    keys = NULL;
+    while (sqlite3_step(load_keys_stmt) == SQLITE_ROW) {
+        int p = sqlite3_column_int(load_keys_stmt, 0);
+        int q = sqlite3_column_int(load_keys_stmt, 1);
+        int key = sqlite3_column_int(load_keys_stmt, 2);
+        cache_key(p, q, key);
+    }
+    sqlite3_reset(load_keys_stmt);
+}
+
+
+// Get the key value for the chunk at the given position.
+// Keys are served from memory; see db_load_keys.
+// Arguments:
+// - p: chunk x position
+// - q: chunk z position
+// Returns:
+// - key value
+int db_get_key(int p, int q) {
+    if (!db_enabled || !keys) { return 0; }
+    KeyEntry *entry = find_key(p, q);
+    return entry->used ? entry->key : 0;
 }
 
 
@@ -687,6 +884,7 @@ int db_get_key(int p, int q) {
 // Returns: none
 void db_set_key(int p, int q, int key) {
     if (!db_enabled) { return; }
+    cache_key(p, q, key);
     mtx_lock(&mtx);
     ring_put_key(&ring, p, q, key);
     cnd_signal(&cnd);
@@ -719,6 +917,7 @@ void db_worker_start(char *path) {
     mtx_init(&mtx, mtx_plain);
     mtx_init(&load_mtx, mtx_plain);
     cnd_init(&cnd);
+    cnd_init(&flush_cnd);
     thrd_create(&thrd, db_worker_run, path);
 }
 
@@ -734,6 +933,7 @@ void db_worker_stop() {
     mtx_unlock(&mtx);
     thrd_join(thrd, NULL);
     cnd_destroy(&cnd);
+    cnd_destroy(&flush_cnd);
     mtx_destroy(&load_mtx);
     mtx_destroy(&mtx);
     ring_free(&ring);
@@ -753,6 +953,7 @@ int db_worker_run(void * /*arg*/) {
         while (!ring_get(&ring, &e)) {
             cnd_wait(&cnd, &mtx);
         }
+        worker_busy = 1;
         mtx_unlock(&mtx);
         switch (e.type) {
             case BLOCK:
@@ -778,6 +979,10 @@ int db_worker_run(void * /*arg*/) {
                 _db_block_damage_trim(e.p, e.q);
                 break;
         }
+        mtx_lock(&mtx);
+        worker_busy = 0;
+        cnd_broadcast(&flush_cnd);
+        mtx_unlock(&mtx);
     }
     return 0;
 }
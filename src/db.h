@@ -2,8 +2,10 @@
 #define _db_h_
 
 
+#include "Block.h"
 #include "map.h"
 #include "sign.h"
+#include "world.h"
 
 
 int db_auth_get(
@@ -47,6 +49,8 @@ void db_disable();
 
 void db_enable();
 
+void db_flush();
+
 int db_get_key(
         int p,
         int q);
@@ -62,6 +66,12 @@ void db_insert_block(
         int z,
         int w);
 
+void db_insert_blocks(
+        int p,
+        int q,
+        const Block *blocks,
+        int count);
+
 void db_insert_block_damage(
         int p,
         int q,
@@ -87,6 +97,13 @@ void db_insert_sign(
         int face,
         const char *text);
 
+int db_load_block_rows(
+        int p,
+        int q,
+        int key,
+        world_func func,
+        void *arg);
+
 void db_load_blocks(
         Map *map,
         int p,
@@ -97,6 +114,12 @@ void db_load_damage(
         int p,
         int q);
 
+void db_load_light_rows(
+        int p,
+        int q,
+        world_func func,
+        void *arg);
+
 void db_load_lights(
         Map *map,
         int p,
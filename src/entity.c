@@ -0,0 +1,506 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "entity.h"
+#include "hitbox.h"
+#include "util.h"
+
+
+// Collision steps per move: an entity can slide along this many faces (a
+// floor, then a wall, then another wall) in one move
+#define MOVE_STEPS 3
+// Distance entities are kept from the faces they collide with
+#define MOVE_PAD 0.001
+
+
+// Allocate room within the given entity list for "capacity" entities
+// Allocates memory.
+// Arguments:
+// - list: the entity list to allocate data for
+// - capacity: the number of entities to allocate room for
+// Returns:
+// - modifies the structure pointed to by list
+void entity_list_alloc(EntityList *list, int capacity) {
+    memset(list, 0, sizeof(EntityList));
+    list->capacity = capacity;
+    list->x = (float *)calloc(capacity, sizeof(float));
+    list->y = (float *)calloc(capacity, sizeof(float));
+    list->z = (float *)calloc(capacity, sizeof(float));
+    list->vx = (float *)calloc(capacity, sizeof(float));
+    list->vy = (float *)calloc(capacity, sizeof(float));
+    list->vz = (float *)calloc(capacity, sizeof(float));
+    list->ex = (float *)calloc(capacity, sizeof(float));
+    list->ey = (float *)calloc(capacity, sizeof(float));
+    list->ez = (float *)calloc(capacity, sizeof(float));
+    list->grounded = (char *)calloc(capacity, sizeof(char));
+    list->bucket = (int *)calloc(capacity, sizeof(int));
+    list->sorted = (int *)calloc(capacity, sizeof(int));
+}
+
+// Free the entity list's data.
+// Arguments:
+// - list: list pointer whose data will be free'd
+// Returns: none
+void entity_list_free(EntityList *list) {
+    free(list->x);
+    free(list->y);
+    free(list->z);
+    free(list->vx);
+    free(list->vy);
+    free(list->vz);
+    free(list->ex);
+    free(list->ey);
+    free(list->ez);
+    free(list->grounded);
+    free(list->bucket);
+    free(list->sorted);
+    free(list->bucket_start);
+    memset(list, 0, sizeof(EntityList));
+}
+
+// Grow one array of an entity list to a new capacity
+// Arguments:
+// - data: the array
+// - size: size of an element
+// - count: number of elements in use
+// - capacity: new number of elements
+// Returns:
+// - the new array (the old one is free'd)
+static void *grow_array(void *data, size_t size, int count, int capacity) {
+    void *result = calloc(capacity, size);
+    memcpy(result, data, count * size);
+    free(data);
+    return result;
+}
+
+// Grow the entity list's arrays so there is more room for entities. The
+// spatial hash must be built again afterwards.
+// Allocates memory.
+// Arguments:
+// - list: entity list to grow
+// Returns:
+// - modifies the structure pointed to by list
+void entity_list_grow(EntityList *list) {
+    int n = list->size;
+    int capacity = list->capacity ? list->capacity * 2 : 16;
+    list->x = grow_array(list->x, sizeof(float), n, capacity);
+    list->y = grow_array(list->y, sizeof(float), n, capacity);
+    list->z = grow_array(list->z, sizeof(float), n, capacity);
+    list->vx = grow_array(list->vx, sizeof(float), n, capacity);
+    list->vy = grow_array(list->vy, sizeof(float), n, capacity);
+    list->vz = grow_array(list->vz, sizeof(float), n, capacity);
+    list->ex = grow_array(list->ex, sizeof(float), n, capacity);
+    list->ey = grow_array(list->ey, sizeof(float), n, capacity);
+    list->ez = grow_array(list->ez, sizeof(float), n, capacity);
+    list->grounded = grow_array(list->grounded, sizeof(char), n, capacity);
+    list->bucket = grow_array(list->bucket, sizeof(int), 0, capacity);
+    list->sorted = grow_array(list->sorted, sizeof(int), 0, capacity);
+    list->capacity = capacity;
+}
+
+// Add an entity to the end of the list.
+// Note: may grow the entity list, allocating memory.
+// Arguments:
+// - list: entity list to add to
+// - x, y, z: box center
+// - ex, ey, ez: box extent
+// - vx, vy, vz: velocity
+// Returns:
+// - index of the new entity
+int entity_list_add(
+    EntityList *list, float x, float y, float z, float ex, float ey, float ez,
+    float vx, float vy, float vz)
+{
+    if (list->size == list->capacity) {
+        entity_list_grow(list);
+    }
+    int i = list->size++;
+    list->x[i] = x;
+    list->y[i] = y;
+    list->z[i] = z;
+    list->ex[i] = ex;
+    list->ey[i] = ey;
+    list->ez[i] = ez;
+    list->vx[i] = vx;
+    list->vy[i] = vy;
+    list->vz[i] = vz;
+    list->grounded[i] = 0;
+    return i;
+}
+
+// Remove an entity by moving the last entity into its place. The index of
+// the last entity changes to the removed one's.
+// Arguments:
+// - list: entity list to remove from
+// - index: entity to remove
+// Returns:
+// - modifies the structure pointed to by list
+void entity_list_remove(EntityList *list, int index) {
+    int last = --list->size;
+    list->x[index] = list->x[last];
+    list->y[index] = list->y[last];
+    list->z[index] = list->z[last];
+    list->ex[index] = list->ex[last];
+    list->ey[index] = list->ey[last];
+    list->ez[index] = list->ez[last];
+    list->vx[index] = list->vx[last];
+    list->vy[index] = list->vy[last];
+    list->vz[index] = list->vz[last];
+    list->grounded[index] = list->grounded[last];
+}
+
+// Apply gravity and air and ground resistance to the velocity of all of the
+// entities, the same way as for a player that is not flying.
+// Arguments:
+// - list: entities to accelerate
+// - phc: physics settings
+// - dt: delta time
+// Returns:
+// - modifies the velocities in list
+void entity_list_accelerate(
+    EntityList *list, const PhysicsConfig *phc, float dt)
+{
+    const float vy_max = 150;
+    float fall = phc->grav * dt;
+    float air = phc->airhr * dt;
+    float ground = phc->groundr * dt;
+    float vertical = phc->airvr * dt;
+    float *vx = list->vx;
+    float *vy = list->vy;
+    float *vz = list->vz;
+    const char *grounded = list->grounded;
+    for (int i = 0; i < list->size; i++) {
+        float rh = grounded[i] ? ground : air;
+        float v = vy[i] - fall;
+        v -= v * vertical;
+        vx[i] -= vx[i] * rh;
+        vy[i] = MAX(-vy_max, MIN(vy_max, v));
+        vz[i] -= vz[i] * rh;
+    }
+}
+
+// Sweep a moving box against the obstacle blocks around it.
+// Arguments:
+// - x, y, z: box center
+// - ex, ey, ez: box extent
+// - vx, vy, vz: box movement
+// - func: block callback, says which blocks are obstacles
+// - arg: argument for func
+// - nx, ny, nz: output: normal of the face hit first
+// Returns:
+// - earliest collision time, between 0.0 and 1.0 (1.0 means no collision),
+//   or -1.0 if the movement passes a block that is not known
+static float sweep_blocks(
+    float x, float y, float z, float ex, float ey, float ez,
+    float vx, float vy, float vz, entity_block_func func, void *arg,
+    float *nx, float *ny, float *nz)
+{
+    *nx = *ny = *nz = 0;
+    float t = 1.0;
+    if (vx == 0 && vy == 0 && vz == 0) {
+        return t;
+    }
+    float bx, by, bz, bex, bey, bez;
+    box_broadphase(
+        x, y, z, ex, ey, ez, vx, vy, vz, &bx, &by, &bz, &bex, &bey, &bez);
+    int x0, y0, z0, x1, y1, z1;
+    box_nearest_blocks(
+        bx, by, bz, bex, bey, bez, &x0, &y0, &z0, &x1, &y1, &z1);
+    for (int px = x0; px <= x1; px++) {
+        for (int py = y0; py <= y1; py++) {
+            for (int pz = z0; pz <= z1; pz++) {
+                if (!box_intersect_block(
+                        bx, by, bz, bex, bey, bez, px, py, pz)) {
+                    continue;
+                }
+                int block = func(px, py, pz, arg);
+                if (block == ENTITY_BLOCK_FROZEN) {
+                    return -1.0;
+                }
+                if (block != ENTITY_BLOCK_SOLID) {
+                    continue;
+                }
+                float snx, sny, snz;
+                float st = box_sweep_block(
+                    x, y, z, ex, ey, ez, px, py, pz, vx, vy, vz,
+                    &snx, &sny, &snz);
+                if (st < 0.0 || st >= t) {
+                    continue;
+                }
+                // A face with another obstacle in front of it is inside of a
+                // floor or wall: sliding along the floor or wall must not
+                // catch on it. A block that is not known covers nothing.
+                if (func(px + snx, py + sny, pz + snz, arg) ==
+                        ENTITY_BLOCK_SOLID) {
+                    continue;
+                }
+                t = st;
+                *nx = snx;
+                *ny = sny;
+                *nz = snz;
+            }
+        }
+    }
+    return t;
+}
+
+// Move all of the entities by their velocity over dt, stopping them at the
+// obstacle blocks they run into and letting them slide along those blocks.
+// Entities whose movement passes a block that is not known do not move, and
+// lose their velocity, until the block is known.
+// Arguments:
+// - list: entities to move
+// - dt: delta time
+// - func: block callback, says which blocks are obstacles
+// - arg: argument for func
+// Returns:
+// - number of entities that hit a block
+// - modifies the positions, velocities and grounded flags in list
+int entity_list_move(
+    EntityList *list, float dt, entity_block_func func, void *arg)
+{
+    int result = 0;
+    for (int i = 0; i < list->size; i++) {
+        float x = list->x[i], y = list->y[i], z = list->z[i];
+        float vx = list->vx[i], vy = list->vy[i], vz = list->vz[i];
+        float ex = list->ex[i], ey = list->ey[i], ez = list->ez[i];
+        int grounded = 0;
+        int frozen = 0;
+        int hit = 0;
+        float left = dt;
+        for (int step = 0; step < MOVE_STEPS; step++) {
+            float nx, ny, nz;
+            float t = sweep_blocks(
+                x, y, z, ex, ey, ez, vx * left, vy * left, vz * left,
+                func, arg, &nx, &ny, &nz);
+            if (t < 0.0) {
+                frozen = 1;
+                break;
+            }
+            x += vx * left * t;
+            y += vy * left * t;
+            z += vz * left * t;
+            if (t >= 1.0) {
+                break;
+            }
+            // Stop the movement into the face and slide for the rest of dt
+            hit = 1;
+            if (nx != 0) {
+                x += nx * MOVE_PAD;
+                vx = 0;
+            }
+            else if (ny != 0) {
+                y += ny * MOVE_PAD;
+                vy = 0;
+                grounded |= ny > 0;
+            }
+            else {
+                z += nz * MOVE_PAD;
+                vz = 0;
+            }
+            left -= left * t;
+        }
+        if (frozen) {
+            list->vx[i] = list->vy[i] = list->vz[i] = 0;
+            continue;
+        }
+        list->x[i] = x;
+        list->y[i] = y;
+        list->z[i] = z;
+        list->vx[i] = vx;
+        list->vy[i] = vy;
+        list->vz[i] = vz;
+        list->grounded[i] = grounded;
+        result += hit;
+    }
+    return result;
+}
+
+// Get the spatial hash bucket of a cell
+// Arguments:
+// - list: entity list with a spatial hash
+// - x, y, z: cell position
+// Returns:
+// - bucket index
+static int cell_bucket(const EntityList *list, int x, int y, int z) {
+    unsigned int h = ((unsigned int)x * 73856093u)
+        ^ ((unsigned int)y * 19349663u)
+        ^ ((unsigned int)z * 83492791u);
+    return h & list->bucket_mask;
+}
+
+// Build the spatial hash of the entities for entity_list_query() and
+// entity_list_pairs(). Each entity goes in the cell of its center; the cells
+// are hashed to buckets, and the entities are sorted by bucket. The hash must
+// be built again after the entities move or the list changes.
+// Note: may allocate memory.
+// Arguments:
+// - list: entities to hash
+// - cell_size: width of the cells, best about the size of an entity
+// Returns:
+// - modifies the structure pointed to by list
+void entity_list_hash(EntityList *list, float cell_size) {
+    int buckets = 16;
+    while (buckets < list->size * 2) {
+        buckets *= 2;
+    }
+    if (buckets > list->bucket_capacity) {
+        free(list->bucket_start);
+        list->bucket_start = (int *)malloc((buckets + 1) * sizeof(int));
+        list->bucket_capacity = buckets;
+    }
+    int *start = list->bucket_start;
+    memset(start, 0, (buckets + 1) * sizeof(int));
+    list->bucket_mask = buckets - 1;
+    list->cell_size = cell_size;
+    float max_extent = 0;
+    float s = 1 / cell_size;
+    for (int i = 0; i < list->size; i++) {
+        int b = cell_bucket(list,
+            floorf(list->x[i] * s), floorf(list->y[i] * s),
+            floorf(list->z[i] * s));
+        list->bucket[i] = b;
+        start[b]++;
+        max_extent = MAX(max_extent, list->ex[i]);
+        max_extent = MAX(max_extent, list->ey[i]);
+        max_extent = MAX(max_extent, list->ez[i]);
+    }
+    list->max_extent = max_extent;
+    // Count sort: each start becomes the end of its bucket, then counts back
+    // down to the beginning as the bucket is filled
+    for (int b = 1; b < buckets; b++) {
+        start[b] += start[b - 1];
+    }
+    for (int i = list->size - 1; i >= 0; i--) {
+        list->sorted[--start[list->bucket[i]]] = i;
+    }
+    start[buckets] = list->size;
+}
+
+// Visit the entities in the hash cells that a box can touch entities in.
+// Meant to be called by entity_list_query() and entity_list_pairs().
+// Arguments:
+// - list: entity list with a spatial hash
+// - first: only entities with this index or higher are reported
+// - x, y, z: box center
+// - ex, ey, ez: box extent
+// - func: called with each entity whose box overlaps the given box, and -1
+//   as the other entity
+// - arg: argument for func
+// Returns:
+// - number of entities reported
+static int _entity_list_query(
+    const EntityList *list, int first, float x, float y, float z,
+    float ex, float ey, float ez, entity_pair_func func, void *arg)
+{
+    if (!list->bucket_start || list->cell_size <= 0) {
+        return 0;
+    }
+    int result = 0;
+    float s = 1 / list->cell_size;
+    float m = list->max_extent;
+    int x0 = floorf((x - ex - m) * s), x1 = floorf((x + ex + m) * s);
+    int y0 = floorf((y - ey - m) * s), y1 = floorf((y + ey + m) * s);
+    int z0 = floorf((z - ez - m) * s), z1 = floorf((z + ez + m) * s);
+    for (int cx = x0; cx <= x1; cx++) {
+        for (int cy = y0; cy <= y1; cy++) {
+            for (int cz = z0; cz <= z1; cz++) {
+                int b = cell_bucket(list, cx, cy, cz);
+                int end = list->bucket_start[b + 1];
+                for (int k = list->bucket_start[b]; k < end; k++) {
+                    int j = list->sorted[k];
+                    if (j < first) {
+                        continue;
+                    }
+                    // Other cells share the bucket; only this cell's
+                    // entities are reported here
+                    if ((int)floorf(list->x[j] * s) != cx ||
+                        (int)floorf(list->y[j] * s) != cy ||
+                        (int)floorf(list->z[j] * s) != cz)
+                    {
+                        continue;
+                    }
+                    if (!box_intersect_box(x, y, z, ex, ey, ez,
+                            list->x[j], list->y[j], list->z[j],
+                            list->ex[j], list->ey[j], list->ez[j]))
+                    {
+                        continue;
+                    }
+                    func(j, -1, arg);
+                    result++;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// Query results collected by entity_list_query()
+typedef struct {
+    int *result;
+    int max;
+    int count;
+} QueryResult;
+
+static void add_query_result(int a, int b, void *arg) {
+    (void)b;
+    QueryResult *q = (QueryResult *)arg;
+    if (q->count < q->max) {
+        q->result[q->count++] = a;
+    }
+}
+
+// Find the entities whose boxes overlap a box, with the spatial hash built by
+// entity_list_hash().
+// Arguments:
+// - list: entity list with a spatial hash
+// - x, y, z: box center
+// - ex, ey, ez: box extent
+// - result: output: indices of the entities found
+// - max: number of indices result has room for
+// Returns:
+// - number of indices written to result
+int entity_list_query(
+    const EntityList *list, float x, float y, float z,
+    float ex, float ey, float ez, int *result, int max)
+{
+    QueryResult q = {result, max, 0};
+    _entity_list_query(
+        list, 0, x, y, z, ex, ey, ez, add_query_result, &q);
+    return q.count;
+}
+
+// Pair visitor for entity_list_pairs()
+typedef struct {
+    int a;
+    entity_pair_func func;
+    void *arg;
+} PairVisit;
+
+static void visit_pair(int b, int unused, void *arg) {
+    (void)unused;
+    PairVisit *v = (PairVisit *)arg;
+    v->func(v->a, b, v->arg);
+}
+
+// Find every pair of entities whose boxes overlap (the broad phase of
+// entity-entity collision), with the spatial hash built by entity_list_hash().
+// Arguments:
+// - list: entity list with a spatial hash
+// - func: called once for each pair, with the lower index first
+// - arg: argument for func
+// Returns:
+// - number of pairs found
+int entity_list_pairs(
+    const EntityList *list, entity_pair_func func, void *arg)
+{
+    int result = 0;
+    PairVisit v = {0, func, arg};
+    for (int i = 0; i < list->size; i++) {
+        v.a = i;
+        result += _entity_list_query(
+            list, i + 1, list->x[i], list->y[i], list->z[i],
+            list->ex[i], list->ey[i], list->ez[i], visit_pair, &v);
+    }
+    return result;
+}
@@ -0,0 +1,120 @@
+#ifndef _entity_h_
+#define _entity_h_
+
+
+#include "Physics.h"
+
+
+// Block callback for entity collision: returns ENTITY_BLOCK_OPEN or
+// ENTITY_BLOCK_SOLID for the block at the given position, or
+// ENTITY_BLOCK_FROZEN if the block is not known (its chunk is not loaded),
+// which keeps the entities near it where they are
+typedef int (*entity_block_func)(int x, int y, int z, void *arg);
+
+#define ENTITY_BLOCK_OPEN 0
+#define ENTITY_BLOCK_SOLID 1
+#define ENTITY_BLOCK_FROZEN 2
+
+// Callback for each pair of overlapping entities (a < b)
+typedef void (*entity_pair_func)(int a, int b, void *arg);
+
+
+// Simulated boxes (dropped items, projectiles, mobs) that are not players.
+// Each field is its own array (structure of arrays), so that every batched
+// pass over the entities reads and writes only the fields it needs.
+// - capacity: number of entities allocated
+// - size: number of entities in use
+// - x, y, z: box centers
+// - vx, vy, vz: velocities
+// - ex, ey, ez: box extents
+// - grounded: flag: the entity was stopped by a floor in the last move
+// - bucket: spatial hash bucket of each entity
+// - sorted: entity indices ordered by bucket
+// - bucket_start: index into sorted of the first entity in each bucket (one
+//   more entry than there are buckets)
+// - bucket_mask: number of spatial hash buckets - 1
+// - bucket_capacity: number of buckets allocated
+// - cell_size: width of the spatial hash cells
+// - max_extent: largest entity extent when the spatial hash was built
+typedef struct {
+    int capacity;
+    int size;
+    float *x;
+    float *y;
+    float *z;
+    float *vx;
+    float *vy;
+    float *vz;
+    float *ex;
+    float *ey;
+    float *ez;
+    char *grounded;
+    int *bucket;
+    int *sorted;
+    int *bucket_start;
+    int bucket_mask;
+    int bucket_capacity;
+    float cell_size;
+    float max_extent;
+} EntityList;
+
+
+void entity_list_alloc(
+        EntityList *list,
+        int capacity);
+
+void entity_list_free(
+        EntityList *list);
+
+void entity_list_grow(
+        EntityList *list);
+
+int entity_list_add(
+        EntityList *list,
+        float x,
+        float y,
+        float z,
+        float ex,
+        float ey,
+        float ez,
+        float vx,
+        float vy,
+        float vz);
+
+void entity_list_remove(
+        EntityList *list,
+        int index);
+
+void entity_list_accelerate(
+        EntityList *list,
+        const PhysicsConfig *phc,
+        float dt);
+
+int entity_list_move(
+        EntityList *list,
+        float dt,
+        entity_block_func func,
+        void *arg);
+
+void entity_list_hash(
+        EntityList *list,
+        float cell_size);
+
+int entity_list_query(
+        const EntityList *list,
+        float x,
+        float y,
+        float z,
+        float ex,
+        float ey,
+        float ez,
+        int *result,
+        int max);
+
+int entity_list_pairs(
+        const EntityList *list,
+        entity_pair_func func,
+        void *arg);
+
+
+#endif
@@ -165,69 +165,6 @@ void get_motion_vector(
 }
 
 
-// Generate the position buffer for the crosshairs in the middle of the screen.
-// Arguments: none
-// Returns:
-// - OpenGL buffer handle
-GLuint gen_crosshair_buffer(
-        Model *g)
-{
-    int x = g->width / 2;
-    int y = g->height / 2;
-    int p = 10 * g->scale;
-    float data[] = {
-        x, y - p, x, y + p,
-        x - p, y, x + p, y
-    };
-    return gen_buffer(sizeof(data), data);
-}
-
-
-// Create a new cube wireframe buffer
-// Arguments:
-// - x: cube x position
-// - y: cube y position
-// - z: cube z position
-// - n: cube scale, distance from center to faces
-// Returns:
-// - OpenGL buffer handle
-GLuint gen_wireframe_buffer(
-        float x,
-        float y,
-        float z,
-        float n)
-{
-    // (6 faces)*(4 points)*(3 dimensions) = 72 floats
-    float data[72];
-    make_cube_wireframe(data, x, y, z, n);
-    return gen_buffer(sizeof(data), data);
-}
-
-
-// Arguments:
-// - x: box center x position
-// - y: box center y position
-// - z: box center z position
-// - ex: box x extent
-// - ey: box y extent
-// - ez: box z extent
-// Returns:
-// - OpenGL buffer handle
-GLuint gen_box_wireframe_buffer(
-        float x,
-        float y,
-        float z,
-        float ex,
-        float ey,
-        float ez)
-{
-    // (6 faces)*(4 points)*(3 dimensions) = 72 floats
-    float data[72];
-    make_box_wireframe(data, x, y, z, ex, ey, ez);
-    return gen_buffer(sizeof(data), data);
-}
-
-
 // Create the sky buffer (sphere shape)
 // Arguments: none
 // Returns: OpenGL buffer handle
@@ -240,25 +177,23 @@ GLuint gen_sky_buffer()
 }
 
 
-// Create a new cube buffer
+// Make the vertices of a cube block model
 // Arguments:
+// - data: filled with 6 faces of 10 component float properties
 // - x: cube x position
 // - y: cube y position
 // - z: cube z position
 // - n: cube scale, distance from center to faces
 // - w: block id for textures
-// Returns:
-// - OpenGL buffer handle
-GLuint gen_cube_buffer(
+// Returns: none
+void make_item_cube(
+        GLfloat *data,
         float x,
         float y,
         float z,
         float n,
         int w)
 {
-    // Each face has 10 component float properties.
-    // A cube model has 6 faces
-    GLfloat *data = malloc_faces(10, 6);
     float ao[6][4] = {0};
     float light[6][4] = {
         {0.5, 0.5, 0.5, 0.5},
@@ -269,68 +204,43 @@ GLuint gen_cube_buffer(
         {0.5, 0.5, 0.5, 0.5}
     };
     make_cube(data, ao, light, 1, 1, 1, 1, 1, 1, x, y, z, n, w);
-    return gen_faces(10, 6, data);
 }
 
 
-// Generate a buffer for a plant block model at a given location
+// Make the vertices of a plant block model at a given location
 // Arguments:
+// - data: filled with 4 faces of 10 component float properties (there are 2
+//   squares each with 2 sides)
 // - x: block x position
 // - y: block y position
 // - z: block z position
 // - n: scale, distance from center to rectangle edge
 // - w: plant block type
-// Returns:
-// - OpenGL buffer handle
-GLuint gen_plant_buffer(
+// Returns: none
+void make_item_plant(
+        GLfloat *data,
         float x,
         float y,
         float z,
         float n,
         int w)
 {
-    // Each face has 10 component float properties.
-    // A plant model has 4 faces because there are 2 squares each with 2 sides
-    GLfloat *data = malloc_faces(10, 4);
     float ao = 0;
     float light = 1;
     make_plant(data, ao, light, x, y, z, n, w, 45);
-    return gen_faces(10, 4, data);
-}
-
-// Create a 2D screen model for a text string
-// Arguments:
-// - x: screen x
-// - y: screen y
-// - n: scale
-// - text: text data to be displayed
-// Returns:
-// - OpenGL buffer handle
-GLuint gen_text_buffer(
-        float x,
-        float y,
-        float n,
-        char *text)
-{
-    int length = strlen(text);
-    GLfloat *data = malloc_faces(4, length);
-    for (int i = 0; i < length; i++) {
-        // Multiply by 24 because there are 24 properties per character
-        make_character(data + i * 24, x, y, n / 2, n, text[i]);
-        x += n;
-    }
-    return gen_faces(4, length, data);
 }
 
 // Draws 3D triangle models
 // Arguments:
 // - attrib: attributes to be used for rendering the triangles
 // - buffer: triangles data
+// - first: first vertex in the buffer
 // - count: number of triangles
 // Returns: none
 void draw_triangles_3d_ao(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int count)
 {
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
@@ -343,30 +253,7 @@ void draw_triangles_3d_ao(
             sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 3));
     glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
             sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 6));
-    glDrawArrays(GL_TRIANGLES, 0, count);
-    glDisableVertexAttribArray(attrib->position);
-    glDisableVertexAttribArray(attrib->normal);
-    glDisableVertexAttribArray(attrib->uv);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-}
-
-void draw_cube_offset(
-        Attrib *attrib,
-        GLuint buffer,
-        int offset)
-{
-    int count = 36;
-    glBindBuffer(GL_ARRAY_BUFFER, buffer);
-    glEnableVertexAttribArray(attrib->position);
-    glEnableVertexAttribArray(attrib->normal);
-    glEnableVertexAttribArray(attrib->uv);
-    glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
-            sizeof(GLfloat) * 10, 0);
-    glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
-            sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 3));
-    glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
-            sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 6));
-    glDrawArrays(GL_TRIANGLES, offset, count);
+    glDrawArrays(GL_TRIANGLES, first, count);
     glDisableVertexAttribArray(attrib->position);
     glDisableVertexAttribArray(attrib->normal);
     glDisableVertexAttribArray(attrib->uv);
@@ -377,11 +264,13 @@ void draw_cube_offset(
 // Arguments:
 // - attrib: attributes to be used for rendering
 // - buffer
+// - first: first vertex in the buffer
 // - count: number of triangles
 // Returns: none
 void draw_triangles_3d_text(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int count)
 {
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
@@ -391,7 +280,7 @@ void draw_triangles_3d_text(
             sizeof(GLfloat) * 5, 0);
     glVertexAttribPointer(attrib->uv, 2, GL_FLOAT, GL_FALSE,
             sizeof(GLfloat) * 5, (GLvoid *)(sizeof(GLfloat) * 3));
-    glDrawArrays(GL_TRIANGLES, 0, count);
+    glDrawArrays(GL_TRIANGLES, first, count);
     glDisableVertexAttribArray(attrib->position);
     glDisableVertexAttribArray(attrib->uv);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -429,11 +318,13 @@ void draw_triangles_3d(
 // Arguments:
 // - attrib: attributes to be used for rendering
 // - buffer
+// - first: first vertex in the buffer
 // - count: number of triangles
 // Returns: none
 void draw_triangles_2d(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int count)
 {
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
@@ -443,7 +334,7 @@ void draw_triangles_2d(
             sizeof(GLfloat) * 4, 0);
     glVertexAttribPointer(attrib->uv, 2, GL_FLOAT, GL_FALSE,
             sizeof(GLfloat) * 4, (GLvoid *)(sizeof(GLfloat) * 2));
-    glDrawArrays(GL_TRIANGLES, 0, count);
+    glDrawArrays(GL_TRIANGLES, first, count);
     glDisableVertexAttribArray(attrib->position);
     glDisableVertexAttribArray(attrib->uv);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -454,31 +345,158 @@ void draw_triangles_2d(
 // - attrib: attributes to be used for rendering
 // - buffer
 // - components
+// - first: first vertex in the buffer
 // - count
 // Returns: none
 void draw_lines(
         Attrib *attrib,
         GLuint buffer,
         int components,
+        int first,
         int count)
 {
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
     glEnableVertexAttribArray(attrib->position);
     glVertexAttribPointer(
             attrib->position, components, GL_FLOAT, GL_FALSE, 0, 0);
-    glDrawArrays(GL_LINES, 0, count);
+    glDrawArrays(GL_LINES, first, count);
     glDisableVertexAttribArray(attrib->position);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-// Draw a game chunk (of blocks)
+// Get the index of a group of faces in a chunk mesh (see Chunk.group_first)
+// Arguments:
+// - cutout: flag: faces of cutout blocks
+// - section: section index
+// - group: face direction in make_cube() order, or FACE_GROUPS - 1 for plants
+// Returns:
+// - group index
+static int mesh_group(
+        int cutout,
+        int section,
+        int group)
+{
+    return (cutout * CHUNK_SECTIONS + section) * FACE_GROUPS + group;
+}
+
+// Draw game chunks (of blocks) section by section, in the given order.
+// The opaque faces of all the sections are drawn first, then the faces of
+// cutout blocks. Within each of these the meshes are grouped by the arena
+// buffer they live in, and each buffer is bound once and drawn with a single
+// glMultiDrawArrays call. Face groups that follow each other both in the
+// order and in the buffer are drawn as one range.
 // Arguments:
+// - arena: arena the chunk meshes were allocated from
+// - chunks: chunk of each section to draw
+// - sections: section index of each section to draw
+// - groups: bit mask of the face groups to draw of each section
+// - count: number of sections
 // Returns: none
-void draw_chunk(
+void draw_chunks(
         Attrib *attrib,
-        Chunk *chunk)
+        Arena *arena,
+        Chunk **chunks,
+        int *sections,
+        int *groups,
+        int count)
+{
+    static GLint firsts[MAX_CHUNKS * CHUNK_SECTIONS * FACE_GROUPS];
+    static GLsizei counts[MAX_CHUNKS * CHUNK_SECTIONS * FACE_GROUPS];
+    glEnableVertexAttribArray(attrib->position);
+    glEnableVertexAttribArray(attrib->normal);
+    glEnableVertexAttribArray(attrib->uv);
+    for (int cutout = 0; cutout < 2; cutout++) {
+        for (int pool = 1; pool <= arena->pool_count; pool++) {
+            int n = 0;
+            for (int i = 0; i < count; i++) {
+                Chunk *chunk = chunks[i];
+                if (chunk->mesh.pool != pool) {
+                    continue;
+                }
+                for (int j = 0; j < FACE_GROUPS; j++) {
+                    if (!(groups[i] & (1 << j))) {
+                        continue;
+                    }
+                    int *group = chunk->group_first +
+                        mesh_group(cutout, sections[i], j);
+                    int first = chunk->mesh.offset + group[0] * 6;
+                    int length = (group[1] - group[0]) * 6;
+                    if (!length) {
+                        continue;
+                    }
+                    if (n && firsts[n - 1] + counts[n - 1] == first) {
+                        counts[n - 1] += length;
+                        continue;
+                    }
+                    firsts[n] = first;
+                    counts[n] = length;
+                    n++;
+                }
+            }
+            if (!n) {
+                continue;
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, arena->pools[pool - 1].buffer);
+            glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
+                    sizeof(GLfloat) * 10, 0);
+            glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
+                    sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 3));
+            glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
+                    sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 6));
+            glMultiDrawArrays(GL_TRIANGLES, firsts, counts, n);
+        }
+    }
+    glDisableVertexAttribArray(attrib->position);
+    glDisableVertexAttribArray(attrib->normal);
+    glDisableVertexAttribArray(attrib->uv);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Draw simplified chunks, binding each arena buffer once and drawing all of
+// the chunks in it with a single glMultiDrawArrays call.
+// Arguments:
+// - arena: arena the meshes were allocated from
+// - lods: simplified chunks to draw
+// - count: number of chunks
+// Returns: none
+void draw_lod_chunks(
+        Attrib *attrib,
+        Arena *arena,
+        LodChunk **lods,
+        int count)
 {
-    draw_triangles_3d_ao(attrib, chunk->buffer, chunk->faces * 6);
+    static GLint firsts[MAX_LOD_CHUNKS];
+    static GLsizei counts[MAX_LOD_CHUNKS];
+    glEnableVertexAttribArray(attrib->position);
+    glEnableVertexAttribArray(attrib->normal);
+    glEnableVertexAttribArray(attrib->uv);
+    for (int pool = 1; pool <= arena->pool_count; pool++) {
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            ArenaAlloc *mesh = &lods[i]->mesh;
+            if (mesh->pool != pool || !mesh->count) {
+                continue;
+            }
+            firsts[n] = mesh->offset;
+            counts[n] = mesh->count;
+            n++;
+        }
+        if (!n) {
+            continue;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, arena->pools[pool - 1].buffer);
+        glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
+                sizeof(GLfloat) * 10, 0);
+        glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
+                sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 3));
+        glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
+                sizeof(GLfloat) * 10, (GLvoid *)(sizeof(GLfloat) * 6));
+        glMultiDrawArrays(GL_TRIANGLES, firsts, counts, n);
+    }
+    glDisableVertexAttribArray(attrib->position);
+    glDisableVertexAttribArray(attrib->normal);
+    glDisableVertexAttribArray(attrib->uv);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 // Draw a block (item), which can be a plant shape or a cube shape
@@ -487,9 +505,10 @@ void draw_chunk(
 void draw_item(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int count)
 {
-    draw_triangles_3d_ao(attrib, buffer, count);
+    draw_triangles_3d_ao(attrib, buffer, first, count);
 }
 
 // Draw 2D text
@@ -498,11 +517,12 @@ void draw_item(
 void draw_text(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int length)
 {
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    draw_triangles_2d(attrib, buffer, length * 6);
+    draw_triangles_2d(attrib, buffer, first, length * 6);
     glDisable(GL_BLEND);
 }
 
@@ -515,7 +535,7 @@ void draw_signs(
 {
     glEnable(GL_POLYGON_OFFSET_FILL);
     glPolygonOffset(-8, -1024);
-    draw_triangles_3d_text(attrib, chunk->sign_buffer, chunk->sign_faces * 6);
+    draw_triangles_3d_text(attrib, chunk->sign_buffer, 0, chunk->sign_faces * 6);
     glDisable(GL_POLYGON_OFFSET_FILL);
 }
 
@@ -525,11 +545,12 @@ void draw_signs(
 void draw_sign(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int length)
 {
     glEnable(GL_POLYGON_OFFSET_FILL);
     glPolygonOffset(-8, -1024);
-    draw_triangles_3d_text(attrib, buffer, length * 6);
+    draw_triangles_3d_text(attrib, buffer, first, length * 6);
     glDisable(GL_POLYGON_OFFSET_FILL);
 }
 
@@ -538,9 +559,10 @@ void draw_sign(
 // Returns: none
 void draw_cube(
         Attrib *attrib,
-        GLuint buffer)
+        GLuint buffer,
+        int first)
 {
-    draw_item(attrib, buffer, 36);
+    draw_item(attrib, buffer, first, 36);
 }
 
 // Draw a plant block model
@@ -548,25 +570,74 @@ void draw_cube(
 // Returns: none
 void draw_plant(
         Attrib *attrib,
-        GLuint buffer)
+        GLuint buffer,
+        int first)
 {
-    draw_item(attrib, buffer, 24);
+    draw_item(attrib, buffer, first, 24);
 }
 
-// Draw a player model
+// Draw player models. Every player is drawn from the same model, moved and
+// turned by its own instance attributes, with one instanced draw call when
+// the driver supports it and one plain draw call per player otherwise.
 // Arguments:
-// - attrib: attributes to be used for rendering
-// - player
+// - attrib: attributes of the player shader
+// - buffer: player model buffer (see gen_player_model_buffer())
+// - transient: buffer the instance attributes are streamed through
+// - data: 6 floats per player: x, y, z, rx, ry, brx
+// - count: number of players
 // Returns: none
-void draw_player(
+void draw_players(
         Attrib *attrib,
-        Player *player)
+        GLuint buffer,
+        Transient *transient,
+        const GLfloat *data,
+        int count)
 {
-    const int offset = 36;
-    const int num_parts = 6;  // for player body
-    for (unsigned int i = 0; i < num_parts; i++) {
-        draw_cube_offset(attrib, player->buffer, i * offset);
+    const int vertices = 6 * 6 * 6;  // 6 limbs, 6 faces each
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray(attrib->position);
+    glEnableVertexAttribArray(attrib->normal);
+    glEnableVertexAttribArray(attrib->uv);
+    glEnableVertexAttribArray(attrib->head);
+    glVertexAttribPointer(attrib->position, 3, GL_FLOAT, GL_FALSE,
+            sizeof(GLfloat) * 11, 0);
+    glVertexAttribPointer(attrib->normal, 3, GL_FLOAT, GL_FALSE,
+            sizeof(GLfloat) * 11, (GLvoid *)(sizeof(GLfloat) * 3));
+    glVertexAttribPointer(attrib->uv, 4, GL_FLOAT, GL_FALSE,
+            sizeof(GLfloat) * 11, (GLvoid *)(sizeof(GLfloat) * 6));
+    glVertexAttribPointer(attrib->head, 1, GL_FLOAT, GL_FALSE,
+            sizeof(GLfloat) * 11, (GLvoid *)(sizeof(GLfloat) * 10));
+    if (GLEW_ARB_instanced_arrays) {
+        int first = transient_append(transient, 6, count, data);
+        GLvoid *start = (GLvoid *)(sizeof(GLfloat) * 6 * first);
+        glBindBuffer(GL_ARRAY_BUFFER, transient->buffer);
+        glEnableVertexAttribArray(attrib->offset);
+        glEnableVertexAttribArray(attrib->rotation);
+        glVertexAttribPointer(attrib->offset, 3, GL_FLOAT, GL_FALSE,
+                sizeof(GLfloat) * 6, start);
+        glVertexAttribPointer(attrib->rotation, 3, GL_FLOAT, GL_FALSE,
+                sizeof(GLfloat) * 6, (GLvoid *)((char *)start +
+                    sizeof(GLfloat) * 3));
+        glVertexAttribDivisorARB(attrib->offset, 1);
+        glVertexAttribDivisorARB(attrib->rotation, 1);
+        glDrawArraysInstancedARB(GL_TRIANGLES, 0, vertices, count);
+        glVertexAttribDivisorARB(attrib->offset, 0);
+        glVertexAttribDivisorARB(attrib->rotation, 0);
+        glDisableVertexAttribArray(attrib->offset);
+        glDisableVertexAttribArray(attrib->rotation);
     }
+    else {
+        for (int i = 0; i < count; i++) {
+            glVertexAttrib3fv(attrib->offset, data + i * 6);
+            glVertexAttrib3fv(attrib->rotation, data + i * 6 + 3);
+            glDrawArrays(GL_TRIANGLES, 0, vertices);
+        }
+    }
+    glDisableVertexAttribArray(attrib->position);
+    glDisableVertexAttribArray(attrib->normal);
+    glDisableVertexAttribArray(attrib->uv);
+    glDisableVertexAttribArray(attrib->head);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 // Find a player with a certain id
@@ -600,7 +671,6 @@ void delete_player(
         return;
     }
     int count = g->player_count;
-    del_buffer(player->buffer);
     Player *other = g->players + (--count);
     memcpy(player, other, sizeof(Player));
     g->player_count = count;
@@ -613,10 +683,6 @@ void
 delete_all_players(
         Model *g)
 {
-    for (int i = 0; i < g->player_count; i++) {
-        Player *player = g->players + i;
-        del_buffer(player->buffer);
-    }
     g->player_count = 0;
 }
 
@@ -729,6 +795,16 @@ int chunk_distance(
     return MAX(dp, dq);
 }
 
+// Get the radius out to which terrain is drawn, in full detail or simplified
+// Returns:
+// - radius in chunks
+static int
+view_radius(
+        Model *g)
+{
+    return MAX(g->render_radius, g->lod_radius);
+}
+
 // Predicate function to determine if a chunk is visible within the given
 // frustrum planes.
 // Arguments:
@@ -787,6 +863,222 @@ int chunk_visible(
     return 1;
 }
 
+// Get the cell of a chunk position in the visibility grids
+// Arguments:
+// - v: visibility of the current frame
+// - p, q: chunk position
+// Returns:
+// - grid index, or -1 if the position is outside the grids
+static int
+visibility_cell(
+        Visibility *v,
+        int p,
+        int q)
+{
+    int x = p - v->p + v->radius;
+    int z = q - v->q + v->radius;
+    if (x < 0 || z < 0 || x >= v->width || z >= v->width) {
+        return -1;
+    }
+    return x * v->width + z;
+}
+
+
+// Mark every position under a quadtree node as visible
+// Arguments:
+// - v: visibility being updated
+// - level: node level (0 for leaves)
+// - x, z: node position within its level
+// - full: flag: fill in_view (otherwise add loaded chunks to visible)
+// Returns: none
+static void
+mark_visibility_node(
+        Visibility *v,
+        int level,
+        int x,
+        int z,
+        int full)
+{
+    int x1 = MIN((x + 1) << level, v->width);
+    int z1 = MIN((z + 1) << level, v->width);
+    for (int cx = x << level; cx < x1; cx++) {
+        for (int cz = z << level; cz < z1; cz++) {
+            int cell = cx * v->width + cz;
+            int *leaf = v->bounds + (cx * v->size + cz) * 2;
+            if (full) {
+                v->in_view[cell] = 1;
+            }
+            else if (v->chunks[cell] && leaf[0] <= leaf[1]) {
+                v->visible[v->visible_count++] = v->chunks[cell];
+            }
+        }
+    }
+}
+
+
+// Test a quadtree node against the view frustum and go down into the
+// children of nodes that cross it. Planes that a node is entirely inside of
+// are left out of the tests of its children.
+// Arguments:
+// - v: visibility being updated
+// - level: node level (0 for leaves)
+// - offset: index of the first node of this level in v->bounds / 2
+// - x, z: node position within its level
+// - mask: bits of the planes still to test
+// - full: flag: test the full height (0 to 256) of the positions and fill
+//   in_view; otherwise test the blocks of the loaded chunks and fill visible
+// Returns: none
+static void
+visit_visibility_node(
+        Visibility *v,
+        int level,
+        int offset,
+        int x,
+        int z,
+        int mask,
+        int full)
+{
+    int n = v->size >> level;
+    if ((x << level) >= v->width || (z << level) >= v->width) {
+        return;
+    }
+    int *bounds = v->bounds + (offset + x * n + z) * 2;
+    if (!full && bounds[0] > bounds[1]) {
+        return;
+    }
+    float min[3] = {
+        (v->p - v->radius + (x << level)) * CHUNK_SIZE - 1,
+        full ? 0 : bounds[0],
+        (v->q - v->radius + (z << level)) * CHUNK_SIZE - 1
+    };
+    float max[3] = {
+        (v->p - v->radius + MIN((x + 1) << level, v->width)) * CHUNK_SIZE,
+        full ? 256 : bounds[1],
+        (v->q - v->radius + MIN((z + 1) << level, v->width)) * CHUNK_SIZE
+    };
+    for (int i = 0; i < 6; i++) {
+        if (!(mask & (1 << i))) {
+            continue;
+        }
+        float *plane = v->planes[i];
+        // Corners of the box furthest along and against the plane normal
+        float far = plane[3];
+        float near = plane[3];
+        for (int j = 0; j < 3; j++) {
+            far += plane[j] * (plane[j] > 0 ? max[j] : min[j]);
+            near += plane[j] * (plane[j] > 0 ? min[j] : max[j]);
+        }
+        if (far < 0) {
+            return;
+        }
+        if (near >= 0) {
+            mask &= ~(1 << i);
+        }
+    }
+    if (level == 0 || mask == 0) {
+        mark_visibility_node(v, level, x, z, full);
+        return;
+    }
+    int child_offset = offset - (n * 2) * (n * 2);
+    for (int dx = 0; dx < 2; dx++) {
+        for (int dz = 0; dz < 2; dz++) {
+            visit_visibility_node(v, level - 1, child_offset,
+                    x * 2 + dx, z * 2 + dz, mask, full);
+        }
+    }
+}
+
+
+// Set up a view for the frame: its camera matrix and frustum, and the chunks
+// around the player that are in the frustum. Everything that draws the view
+// uses these results for the rest of the frame.
+// Arguments:
+// - v: view to set up
+// - player: player whose view is used
+// Returns: none
+void
+update_visibility(
+        Model *g,
+        Visibility *v,
+        Player *player)
+{
+    State *s = &player->state;
+    v->player = player;
+    v->p = chunked(s->x);
+    v->q = chunked(s->z);
+    v->radius = MAX(g->create_radius, MAX(g->render_radius, g->sign_radius));
+    v->width = v->radius * 2 + 1;
+    v->size = 1;
+    int levels = 1;
+    int nodes = 1;
+    while (v->size < v->width) {
+        v->size *= 2;
+        levels++;
+        nodes += v->size * v->size;
+    }
+    int cells = v->width * v->width;
+    if (cells > v->capacity) {
+        v->capacity = cells;
+        v->chunks = realloc(v->chunks, sizeof(Chunk *) * cells);
+        v->in_view = realloc(v->in_view, cells);
+        v->visible = realloc(v->visible, sizeof(Chunk *) * cells);
+    }
+    if (nodes > v->node_capacity) {
+        v->node_capacity = nodes;
+        v->bounds = realloc(v->bounds, sizeof(int) * 2 * nodes);
+    }
+    set_matrix_3d_player_camera(g, v->matrix, player);
+    frustum_planes(v->planes, view_radius(g), v->matrix);
+
+    // Leaves: the blocks of the loaded chunks
+    memset(v->chunks, 0, sizeof(Chunk *) * cells);
+    for (int i = 0; i < v->size * v->size; i++) {
+        v->bounds[i * 2] = 256;
+        v->bounds[i * 2 + 1] = -1;
+    }
+    for (int i = 0; i < g->chunk_count; i++) {
+        Chunk *chunk = g->chunks + i;
+        int cell = visibility_cell(v, chunk->p, chunk->q);
+        if (cell < 0) {
+            continue;
+        }
+        v->chunks[cell] = chunk;
+        int *leaf = v->bounds + (cell / v->width * v->size +
+                cell % v->width) * 2;
+        leaf[0] = chunk->miny;
+        leaf[1] = chunk->maxy;
+    }
+
+    // Each level up covers the blocks of its four children
+    int offset = 0;
+    for (int n = v->size; n > 1; n /= 2) {
+        int next = offset + n * n;
+        for (int x = 0; x < n / 2; x++) {
+            for (int z = 0; z < n / 2; z++) {
+                int *node = v->bounds + (next + x * (n / 2) + z) * 2;
+                node[0] = 256;
+                node[1] = -1;
+                for (int dx = 0; dx < 2; dx++) {
+                    for (int dz = 0; dz < 2; dz++) {
+                        int *child = v->bounds +
+                            (offset + (x * 2 + dx) * n + z * 2 + dz) * 2;
+                        node[0] = MIN(node[0], child[0]);
+                        node[1] = MAX(node[1], child[1]);
+                    }
+                }
+            }
+        }
+        offset = next;
+    }
+
+    int mask = g->ortho ? 0x0f : 0x3f;
+    memset(v->in_view, 0, cells);
+    v->visible_count = 0;
+    visit_visibility_node(v, levels - 1, offset, 0, 0, mask, 1);
+    visit_visibility_node(v, levels - 1, offset, 0, 0, mask, 0);
+}
+
+
 // Find the highest y position of a block at a given (x,z) position.
 // Arguments:
 // - x
@@ -815,28 +1107,24 @@ int highest_block(
     return result;
 }
 
-// Finds the closest block in a map found by casting a hit ray.
-// Meant to be called by hit_test().
+// Walk a ray through the blocks it passes, in order (the voxel traversal of
+// Amanatides and Woo), and stop at the first block that is not empty. Each
+// block on the way is looked up once, and the chunk holding it only when the
+// ray crosses into another chunk.
 // Arguments:
-// - map: map to search for hitting blocks in
-// - max_distance
-// - previous: boolean
-// - x: ray start x
-// - y: ray start y
-// - z: ray start z
-// - vx: ray x direction
-// - vy: ray y direction
-// - vz: ray z direction
-// - hx: pointer to output hit x position
-// - hy: pointer to output hit y position
-// - hz: pointer to output hit z position
+// - max_distance: length of the ray
+// - x, y, z: ray start
+// - vx, vy, vz: ray direction (unit length)
+// - hx, hy, hz: output: position of the block hit
+// - px, py, pz: output: position of the block passed just before it (the hit
+//   block itself if the ray starts inside of it); its offset from the hit
+//   block is the normal of the face the ray entered through
 // Returns:
-// - the block type that was hit, returns 0 if there was no block found
-// - writes hit output to hx, hy, and hz
-int _hit_test(
-        Map *map,
+// - the block type that was hit, or 0 if no block was found
+int
+hit_test_ray(
+        Model *g,
         float max_distance,
-        int previous,
         float x,
         float y,
         float z,
@@ -845,37 +1133,70 @@ int _hit_test(
         float vz,
         int *hx,
         int *hy,
-        int *hz)
-{
-    int m = 32;
-    int px = 0;
-    int py = 0;
-    int pz = 0;
-    for (int i = 0; i < max_distance * m; i++) {
-        int nx = roundf(x);
-        int ny = roundf(y);
-        int nz = roundf(z);
-        if (nx != px || ny != py || nz != pz) {
-            int hw = map_get(map, nx, ny, nz);
-            if (hw > 0) {
-                if (previous) {
-                    *hx = px; *hy = py; *hz = pz;
-                }
-                else {
-                    *hx = nx; *hy = ny; *hz = nz;
-                }
-                return hw;
-            }
-            px = nx; py = ny; pz = nz;
+        int *hz,
+        int *px,
+        int *py,
+        int *pz)
+{
+    // Blocks are centered on integer positions
+    float origin[3] = {x, y, z};
+    float direction[3] = {vx, vy, vz};
+    int cell[3] = {roundf(x), roundf(y), roundf(z)};
+    int previous[3] = {cell[0], cell[1], cell[2]};
+    int step[3];
+    float next[3];  // ray distance to the next block boundary on each axis
+    float delta[3]; // ray distance between block boundaries on each axis
+    for (int i = 0; i < 3; i++) {
+        if (direction[i] > 0) {
+            step[i] = 1;
+            next[i] = (cell[i] + 0.5 - origin[i]) / direction[i];
+            delta[i] = 1 / direction[i];
+        }
+        else if (direction[i] < 0) {
+            step[i] = -1;
+            next[i] = (cell[i] - 0.5 - origin[i]) / direction[i];
+            delta[i] = -1 / direction[i];
+        }
+        else {
+            step[i] = 0;
+            next[i] = INFINITY;
+            delta[i] = INFINITY;
         }
-        x += vx / m; y += vy / m; z += vz / m;
+    }
+    Chunk *chunk = NULL;
+    int p = chunked(cell[0]);
+    int q = chunked(cell[2]);
+    int found = 0;
+    float t = 0;
+    while (t <= max_distance) {
+        if (!found || chunked(cell[0]) != p || chunked(cell[2]) != q) {
+            p = chunked(cell[0]);
+            q = chunked(cell[2]);
+            chunk = find_chunk(g, p, q);
+            found = 1;
+        }
+        int hw = chunk ? map_get(&chunk->map, cell[0], cell[1], cell[2]) : 0;
+        if (hw > 0) {
+            *hx = cell[0]; *hy = cell[1]; *hz = cell[2];
+            *px = previous[0]; *py = previous[1]; *pz = previous[2];
+            return hw;
+        }
+        previous[0] = cell[0];
+        previous[1] = cell[1];
+        previous[2] = cell[2];
+        int axis = next[0] < next[1] ?
+            (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        t = next[axis];
+        cell[axis] += step[axis];
+        next[axis] += delta[axis];
     }
     return 0;
 }
 
 // Finds the closest block found by casting a hit ray.
 // Arguments:
-// - previous: boolean
+// - previous: boolean: return the empty position in front of the block hit
+//   instead of the block
 // - x: ray start x
 // - y: ray start y
 // - z: ray start z
@@ -899,33 +1220,21 @@ hit_test(
         int *by,
         int *bz)
 {
-    //const int r = 8; // radius (blocks) (max length)
     const float r = g->players[0].attrs.reach; // radius (blocks) (max length)
-    int result = 0;
-    float best = 0;
-    int p = chunked(x);
-    int q = chunked(z);
     float vx, vy, vz;
     get_sight_vector(rx, ry, &vx, &vy, &vz);
-    for (int i = 0; i < g->chunk_count; i++) {
-        Chunk *chunk = g->chunks + i;
-        if (chunk_distance(chunk, p, q) > 1+chunked(r)) {
-            continue;
+    int hx, hy, hz, px, py, pz;
+    int hw = hit_test_ray(g, r, x, y, z, vx, vy, vz,
+            &hx, &hy, &hz, &px, &py, &pz);
+    if (hw > 0) {
+        if (previous) {
+            *bx = px; *by = py; *bz = pz;
         }
-        int hx, hy, hz;
-        int hw = _hit_test(&chunk->map, r, previous,
-                x, y, z, vx, vy, vz, &hx, &hy, &hz);
-        if (hw > 0) {
-            float d = sqrtf(
-                    powf(hx - x, 2) + powf(hy - y, 2) + powf(hz - z, 2));
-            if (best == 0 || d < best) {
-                best = d;
-                *bx = hx; *by = hy; *bz = hz;
-                result = hw;
-            }
+        else {
+            *bx = hx; *by = hy; *bz = hz;
         }
     }
-    return result;
+    return hw;
 }
 
 // See which block face a player is looking at
@@ -947,10 +1256,12 @@ int hit_test_face(
 {
     State *s = &player->state;
     float eye_y = player_eye_y(s->y);
-    int w = hit_test(g, 0, s->x, eye_y, s->z, s->rx, s->ry, x, y, z);
+    float vx, vy, vz;
+    get_sight_vector(s->rx, s->ry, &vx, &vy, &vz);
+    int hx, hy, hz;
+    int w = hit_test_ray(g, g->players[0].attrs.reach, s->x, eye_y, s->z,
+            vx, vy, vz, x, y, z, &hx, &hy, &hz);
     if (is_obstacle(w)) {
-        int hx, hy, hz;
-        hit_test(g, 1, s->x, eye_y, s->z, s->rx, s->ry, &hx, &hy, &hz);
         int dx = hx - *x;
         int dy = hy - *y;
         int dz = hz - *z;
@@ -1266,6 +1577,106 @@ void light_fill(
 }
 
 
+// Find which faces of each section of a chunk can see each other, by flood
+// filling the blocks of the section that are not opaque. Every region that is
+// found connects all the section faces it touches.
+// Arguments:
+// - opaque: opaque array made by compute_chunk()
+// - connections: for each section and face, the faces it connects to
+// Returns: none
+static void compute_connections(
+        char *opaque,
+        unsigned char connections[CHUNK_SECTIONS][6])
+{
+    int size = CHUNK_SIZE * SECTION_SIZE * CHUNK_SIZE;
+    char *visited = malloc(size);
+    int *stack = malloc(sizeof(int) * size);
+    // The chunk's own blocks in the opaque array start here
+    int x0 = CHUNK_SIZE + 1;
+    int z0 = CHUNK_SIZE + 1;
+    for (int s = 0; s < CHUNK_SECTIONS; s++) {
+        int y0 = s * SECTION_SIZE + 1;
+        // Sections with no opaque blocks (most of the sky) connect everything
+        int solid = 0;
+        for (int y = 0; y < SECTION_SIZE; y++) {
+            for (int x = 0; x < CHUNK_SIZE; x++) {
+                for (int z = 0; z < CHUNK_SIZE; z++) {
+                    solid += opaque[XYZ(x0 + x, y0 + y, z0 + z)];
+                }
+            }
+        }
+        memset(connections[s], solid ? 0 : 0x3f, 6);
+        if (!solid || solid == size) {
+            continue;
+        }
+        memset(visited, 0, size);
+        for (int start = 0; start < size; start++) {
+            if (visited[start]) {
+                continue;
+            }
+            int sx = start / (SECTION_SIZE * CHUNK_SIZE);
+            int sy = start / CHUNK_SIZE % SECTION_SIZE;
+            int sz = start % CHUNK_SIZE;
+            if (opaque[XYZ(x0 + sx, y0 + sy, z0 + sz)]) {
+                continue;
+            }
+            int faces = 0;
+            int count = 0;
+            visited[start] = 1;
+            stack[count++] = start;
+            while (count) {
+                int i = stack[--count];
+                int x = i / (SECTION_SIZE * CHUNK_SIZE);
+                int y = i / CHUNK_SIZE % SECTION_SIZE;
+                int z = i % CHUNK_SIZE;
+                faces |= (x == 0) << 0;
+                faces |= (x == CHUNK_SIZE - 1) << 1;
+                faces |= (y == 0) << 2;
+                faces |= (y == SECTION_SIZE - 1) << 3;
+                faces |= (z == 0) << 4;
+                faces |= (z == CHUNK_SIZE - 1) << 5;
+                int neighbors[6][3] = {
+                    {x - 1, y, z}, {x + 1, y, z},
+                    {x, y - 1, z}, {x, y + 1, z},
+                    {x, y, z - 1}, {x, y, z + 1}
+                };
+                for (int n = 0; n < 6; n++) {
+                    int nx = neighbors[n][0];
+                    int ny = neighbors[n][1];
+                    int nz = neighbors[n][2];
+                    if (nx < 0 || nx >= CHUNK_SIZE || ny < 0 ||
+                            ny >= SECTION_SIZE || nz < 0 || nz >= CHUNK_SIZE)
+                    {
+                        continue;
+                    }
+                    int j = (nx * SECTION_SIZE + ny) * CHUNK_SIZE + nz;
+                    if (visited[j] || opaque[XYZ(x0 + nx, y0 + ny, z0 + nz)]) {
+                        continue;
+                    }
+                    visited[j] = 1;
+                    stack[count++] = j;
+                }
+            }
+            for (int f = 0; f < 6; f++) {
+                if (faces & (1 << f)) {
+                    connections[s][f] |= faces;
+                }
+            }
+        }
+    }
+    free(visited);
+    free(stack);
+}
+
+
+// Get the section of a chunk that a block height is in
+static int section_of(
+        int y)
+{
+    return MAX(0, MIN(CHUNK_SECTIONS - 1, y / SECTION_SIZE));
+}
+
+
 // Arguments:
 // - item
 // Returns: none
@@ -1341,10 +1752,15 @@ void compute_chunk(
 
     Map *map = item->block_maps[1][1];
 
+    compute_connections(opaque, item->connections);
+
     // count exposed faces
     int miny = 256;
     int maxy = 0;
     int faces = 0;
+    int *group_first = item->group_first;
+    memset(item->section_faces, 0, sizeof(item->section_faces));
+    memset(group_first, 0, sizeof(item->group_first));
     MAP_FOR_EACH(map, ex, ey, ez, ew) {
         if (ew <= 0) {
             continue;
@@ -1362,17 +1778,34 @@ void compute_chunk(
         if (total == 0) {
             continue;
         }
+        int section = section_of(ey);
+        int cutout = is_transparent(ew);
         if (is_plant(ew)) {
             total = 4;
+            group_first[mesh_group(cutout, section, FACE_GROUPS - 1)] += 4;
+        }
+        else {
+            int exposed[6] = {f1, f2, f3, f4, f5, f6};
+            for (int d = 0; d < 6; d++) {
+                group_first[mesh_group(cutout, section, d)] += exposed[d];
+            }
         }
         miny = MIN(miny, ey);
         maxy = MAX(maxy, ey);
         faces += total;
+        item->section_faces[section] += total;
     } END_MAP_FOR_EACH;
 
-    // generate geometry
+    // generate geometry in the order of the mesh groups (see Chunk.h)
     GLfloat *data = malloc_faces(10, faces);
+    int offsets[MESH_GROUPS];
     int offset = 0;
+    for (int i = 0; i <= MESH_GROUPS; i++) {
+        int count = i < MESH_GROUPS ? group_first[i] : 0;
+        group_first[i] = offset;
+        offset += count;
+    }
+    memcpy(offsets, group_first, sizeof(offsets));
     MAP_FOR_EACH(map, ex, ey, ez, ew) {
         if (ew <= 0) {
             continue;
@@ -1415,8 +1848,9 @@ void compute_chunk(
         float ao[6][4];
         float light[6][4];
         occlusion(neighbors, lights, shades, ao, light);
+        int section = section_of(ey);
+        int cutout = is_transparent(ew);
         if (is_plant(ew)) {
-            total = 4;
             float min_ao = 1;
             float max_light = 0;
             for (int a = 0; a < 6; a++) {
@@ -1426,17 +1860,31 @@ void compute_chunk(
                 }
             }
             float rotation = simplex2(ex, ez, 4, 0.5, 2) * 360;
+            int *target = offsets + mesh_group(cutout, section, FACE_GROUPS - 1);
             make_plant(
-                    data + offset, min_ao, max_light,
+                    data + *target * 60, min_ao, max_light,
                     ex, ey, ez, 0.5, ew, rotation);
+            *target += 4;
         }
         else {
+            // Each face goes to the group of its direction
+            GLfloat cube[6 * 60];
             make_cube(
-                    data + offset, ao, light,
+                    cube, ao, light,
                     f1, f2, f3, f4, f5, f6,
                     ex, ey, ez, 0.5, ew);
+            int exposed[6] = {f1, f2, f3, f4, f5, f6};
+            GLfloat *face = cube;
+            for (int d = 0; d < 6; d++) {
+                if (!exposed[d]) {
+                    continue;
+                }
+                int *target = offsets + mesh_group(cutout, section, d);
+                memcpy(data + *target * 60, face, sizeof(GLfloat) * 60);
+                *target += 1;
+                face += 60;
+            }
         }
-        offset += total * 60;
     } END_MAP_FOR_EACH;
 
     free(opaque);
@@ -1455,14 +1903,21 @@ void compute_chunk(
 // - item
 // Returns: none
 void generate_chunk(
+        Model *g,
         Chunk *chunk,
         WorkerItem *item)
 {
     chunk->miny = item->miny;
     chunk->maxy = item->maxy;
     chunk->faces = item->faces;
-    del_buffer(chunk->buffer);
-    chunk->buffer = gen_faces(10, item->faces, item->data);
+    memcpy(chunk->section_faces, item->section_faces,
+            sizeof(chunk->section_faces));
+    memcpy(chunk->group_first, item->group_first,
+            sizeof(chunk->group_first));
+    memcpy(chunk->connections, item->connections,
+            sizeof(chunk->connections));
+    arena_store(&g->chunk_arena, &chunk->mesh, item->faces * 6, item->data);
+    free(item->data);
     gen_sign_buffer(chunk);
 }
 
@@ -1495,7 +1950,7 @@ void gen_chunk_buffer(
         }
     }
     compute_chunk(item);
-    generate_chunk(chunk, item);
+    generate_chunk(g, chunk, item);
     chunk->dirty = 0;
 }
 
@@ -1544,16 +1999,84 @@ void load_chunk(
 }
 
 
+// Mark a chunk to be requested from the server.
+// Requests are batched and sent by send_chunk_requests.
 // Arguments:
-// - p
-// - q
+// - chunk
 // Returns: none
 void request_chunk(
-        int p,
-        int q)
+        Model *g,
+        Chunk *chunk)
+{
+    if (!chunk->requested) {
+        chunk->requested = 1;
+        g->chunk_requests++;
+    }
+}
+
+
+// Used to sort pending chunk requests, nearest first
+typedef struct {
+    int score;
+    int p;
+    int q;
+} ChunkRequest;
+
+
+static int
+compare_chunk_requests(
+        const void *a,
+        const void *b)
+{
+    const ChunkRequest *r1 = (const ChunkRequest *)a;
+    const ChunkRequest *r2 = (const ChunkRequest *)b;
+    return r1->score - r2->score;
+}
+
+
+// Send all pending chunk requests to the server in as few lines as possible.
+// Chunks are ordered by distance from the player so that the server answers
+// the nearest chunks first.
+// Arguments:
+// - player
+// Returns: none
+void send_chunk_requests(
+        Model *g,
+        Player *player)
 {
-    int key = db_get_key(p, q);
-    client_chunk(p, q, key);
+    if (!g->chunk_requests) {
+        return;
+    }
+    State *s = &player->state;
+    int p = chunked(s->x);
+    int q = chunked(s->z);
+    int count = 0;
+    ChunkRequest *requests = malloc(sizeof(ChunkRequest) * g->chunk_requests);
+    for (int i = 0; i < g->chunk_count && count < g->chunk_requests; i++) {
+        Chunk *chunk = g->chunks + i;
+        if (!chunk->requested) {
+            continue;
+        }
+        chunk->requested = 0;
+        ChunkRequest *request = requests + count++;
+        request->score = chunk_distance(chunk, p, q);
+        request->p = chunk->p;
+        request->q = chunk->q;
+    }
+    qsort(requests, count, sizeof(ChunkRequest), compare_chunk_requests);
+    int *data = malloc(sizeof(int) * 3 * count);
+    int *ps = data;
+    int *qs = data + count;
+    int *keys = data + count * 2;
+    for (int i = 0; i < count; i++) {
+        ps[i] = requests[i].p;
+        qs[i] = requests[i].q;
+        keys[i] = db_get_key(ps[i], qs[i]);
+    }
+    client_chunks(count, ps, qs, keys);
+    free(data);
+    free(requests);
+    g->chunk_requests = 0;
 }
 
 
@@ -1572,8 +2095,13 @@ void init_chunk(
     chunk->q = q;
     chunk->faces = 0;
     chunk->sign_faces = 0;
-    chunk->buffer = 0;
+    memset(&chunk->mesh, 0, sizeof(ArenaAlloc));
+    // Until the chunk is meshed, treat every section as open
+    memset(chunk->section_faces, 0, sizeof(chunk->section_faces));
+    memset(chunk->group_first, 0, sizeof(chunk->group_first));
+    memset(chunk->connections, 0x3f, sizeof(chunk->connections));
     chunk->sign_buffer = 0;
+    chunk->requested = 0;
     dirty_chunk(g, chunk);
     SignList *signs = &chunk->signs;
     sign_list_alloc(signs, 16);
@@ -1587,6 +2115,8 @@ void init_chunk(
     map_alloc(block_map, dx, dy, dz, 0x7fff);
     map_alloc(dam_map, dx, dy, dz, 0x7fff);
     map_alloc(light_map, dx, dy, dz, 0xf);
+    map_alloc(&chunk->active, dx, dy, dz, 0xf);
+    chunk->active_count = 0;
 }
 
 
@@ -1612,7 +2142,7 @@ void create_chunk(
     item->damage_maps[1][1] = &chunk->damage;
     load_chunk(item);
 
-    request_chunk(p, q);
+    request_chunk(g, chunk);
 }
 
 
@@ -1645,8 +2175,9 @@ void delete_chunks(
             map_free(&chunk->map);
             map_free(&chunk->lights);
             map_free(&chunk->damage);
+            map_free(&chunk->active);
             sign_list_free(&chunk->signs);
-            del_buffer(chunk->buffer);
+            arena_release(&g->chunk_arena, &chunk->mesh);
             del_buffer(chunk->sign_buffer);
             Chunk *other = g->chunks + (--count);
             memcpy(chunk, other, sizeof(Chunk));
@@ -1667,11 +2198,18 @@ void delete_all_chunks(
         map_free(&chunk->map);
         map_free(&chunk->lights);
         map_free(&chunk->damage);
+        map_free(&chunk->active);
         sign_list_free(&chunk->signs);
-        del_buffer(chunk->buffer);
+        arena_release(&g->chunk_arena, &chunk->mesh);
         del_buffer(chunk->sign_buffer);
     }
     g->chunk_count = 0;
+    g->block_update_count = 0;
+    for (int i = 0; i < g->lod_count; i++) {
+        arena_release(&g->chunk_arena, &g->lod_chunks[i].mesh);
+    }
+    g->lod_count = 0;
+    g->chunk_requests = 0;
 }
 
 // Arguments: none
@@ -1682,7 +2220,12 @@ void check_workers(
     for (int i = 0; i < WORKERS; i++) {
         Worker *worker = g->workers + i;
         mtx_lock(&worker->mtx);
-        if (worker->state == WORKER_DONE) {
+        if (worker->state == WORKER_DONE && worker->item.lod) {
+            generate_lod_chunk(g, &worker->item);
+            worker->item.lod = 0;
+            worker->state = WORKER_IDLE;
+        }
+        else if (worker->state == WORKER_DONE) {
             WorkerItem *item = &worker->item;
             Chunk *chunk = find_chunk(g, item->p, item->q);
             if (chunk) {
@@ -1699,9 +2242,9 @@ void check_workers(
                     map_free(&chunk->damage);
                     map_copy(&chunk->damage, dam_map);
 
-                    request_chunk(item->p, item->q);
+                    request_chunk(g, chunk);
                 }
-                generate_chunk(chunk, item);
+                generate_chunk(g, chunk, item);
             }
             for (int a = 0; a < 3; a++) {
                 for (int b = 0; b < 3; b++) {
@@ -1763,21 +2306,16 @@ void force_chunks(
 
 
 // Arguments:
-// - player
 // - worker
-// Returns: none
-void ensure_chunks_worker(
+// Returns:
+// - non-zero if the worker was started on a chunk
+int ensure_chunks_worker(
         Model *g,
-        Player *player,
         Worker *worker)
 {
-    State *s = &player->state;
-    float matrix[16];
-    set_matrix_3d_player_camera(g, matrix, player);
-    float planes[6][4];
-    frustum_planes(planes, g->render_radius, matrix);
-    int p = chunked(s->x);
-    int q = chunked(s->z);
+    Visibility *v = &g->visibility;
+    int p = v->p;
+    int q = v->q;
     int r = g->create_radius;
     int start = 0x0fffffff;
     int best_score = start;
@@ -1791,15 +2329,16 @@ void ensure_chunks_worker(
             if (index != worker->index) {
                 continue;
             }
-            Chunk *chunk = find_chunk(g, a, b);
+            int cell = visibility_cell(v, a, b);
+            Chunk *chunk = v->chunks[cell];
             if (chunk && !chunk->dirty) {
                 continue;
             }
             int distance = MAX(ABS(dp), ABS(dq));
-            int invisible = !chunk_visible(g, planes, a, b, 0, 256);
+            int invisible = !v->in_view[cell];
             int priority = 0;
             if (chunk) {
-                priority = chunk->buffer && chunk->dirty;
+                priority = chunk->mesh.pool && chunk->dirty;
             }
             int score = (invisible << 24) | (priority << 16) | distance;
             if (score < best_score) {
@@ -1810,20 +2349,22 @@ void ensure_chunks_worker(
         }
     }
     if (best_score == start) {
-        return;
+        return 0;
     }
     int a = best_a;
     int b = best_b;
     int load = 0;
-    Chunk *chunk = find_chunk(g, a, b);
+    int cell = visibility_cell(v, a, b);
+    Chunk *chunk = v->chunks[cell];
     if (!chunk) {
         load = 1;
         if (g->chunk_count < MAX_CHUNKS) {
             chunk = g->chunks + g->chunk_count++;
             init_chunk(g, chunk, a, b);
+            v->chunks[cell] = chunk;
         }
         else {
-            return;
+            return 0;
         }
     }
     WorkerItem *item = &worker->item;
@@ -1859,27 +2400,431 @@ void ensure_chunks_worker(
     chunk->dirty = 0;
     worker->state = WORKER_BUSY;
     cnd_signal(&worker->cnd);
+    return 1;
 }
 
+// Schedule the chunk work of a frame: take the meshes the workers finished,
+// set up the main view (g->visibility) and start the workers on the chunks it
+// needs most. Called once per frame, before anything is drawn.
 // Arguments:
-// - player
+// - player: player whose view is the main view
 // Returns: none
 void ensure_chunks(
         Model *g,
         Player *player)
 {
+    double start = perf_time();
     check_workers(g);
+    g->workers_time += perf_time() - start;
     force_chunks(g, player);
+    if (g->observe2) {
+        force_chunks(g, g->players + g->observe2);
+    }
+    update_visibility(g, &g->visibility, player);
+    ensure_lod_chunks(g);
+    send_chunk_requests(g, player);
     for (int i = 0; i < WORKERS; i++) {
         Worker *worker = g->workers + i;
         mtx_lock(&worker->mtx);
-        if (worker->state == WORKER_IDLE) {
-            ensure_chunks_worker(g, player, worker);
+        if (worker->state == WORKER_IDLE &&
+            !ensure_chunks_worker(g, worker))
+        {
+            ensure_lod_worker(worker);
         }
         mtx_unlock(&worker->mtx);
     }
 }
 
+// Column heights of a simplified chunk being built
+// - p, q: chunk position
+// - step: width of each column in blocks
+// - width: number of columns along each side of the chunk
+// - heights: blocks in each column
+// - blocks: block id of the top of each column
+// - raised: height of the highest block placed in each column, or 0
+// - raised_blocks: block id of that block
+// - removed: bits of the Y positions whose block was removed at each column's
+//   sample position (its middle)
+typedef struct {
+    int p;
+    int q;
+    int step;
+    int width;
+    int heights[CHUNK_SIZE / 2][CHUNK_SIZE / 2];
+    int blocks[CHUNK_SIZE / 2][CHUNK_SIZE / 2];
+    int raised[CHUNK_SIZE / 2][CHUNK_SIZE / 2];
+    int raised_blocks[CHUNK_SIZE / 2][CHUNK_SIZE / 2];
+    unsigned int removed[CHUNK_SIZE / 2][CHUNK_SIZE / 2][8];
+} LodColumns;
+
+
+// World callback recording a block change stored in the database into the
+// columns of a simplified chunk. Plants and cutout blocks are left out.
+static void lod_block_func(int x, int y, int z, int w, void *arg) {
+    LodColumns *c = (LodColumns *)arg;
+    int dx = x - c->p * CHUNK_SIZE;
+    int dz = z - c->q * CHUNK_SIZE;
+    if (dx < 0 || dz < 0 || dx >= CHUNK_SIZE || dz >= CHUNK_SIZE ||
+        y < 0 || y >= 256 || w < 0)
+    {
+        return;
+    }
+    int i = dx / c->step;
+    int j = dz / c->step;
+    if (w == 0) {
+        if (dx % c->step == c->step / 2 && dz % c->step == c->step / 2) {
+            c->removed[i][j][y / 32] |= 1u << (y % 32);
+        }
+    }
+    else if (!is_transparent(w) && y + 1 > c->raised[i][j]) {
+        c->raised[i][j] = y + 1;
+        c->raised_blocks[i][j] = w;
+    }
+}
+
+
+// Make one face of a simplified chunk's column
+// Arguments:
+// - data: destination (60 floats)
+// - face: face in make_cube() order (-x, +x, +y, -y, -z, +z)
+// - x, z: center of the column
+// - step: width of the column in blocks
+// - y0, y1: the face covers the blocks from y0 up to (but not including) y1
+// - w: block id the face is textured with
+// Returns: none
+static void make_lod_face(
+        float *data,
+        int face,
+        float x,
+        float z,
+        int step,
+        int y0,
+        int y1,
+        int w)
+{
+    static const float ao[6][4] = {{0}};
+    static const float light[6][4] = {{0}};
+    make_cube(data, ao, light, face == 0, face == 1, face == 2, face == 3,
+            face == 4, face == 5, x, 0, z, 0.5, w);
+    for (int i = 0; i < 6; i++) {
+        float *d = data + i * 10;
+        d[0] = x + (d[0] - x) * step;
+        d[1] = y0 - 0.5 + (d[1] + 0.5) * (y1 - y0);
+        d[2] = z + (d[2] - z) * step;
+    }
+}
+
+
+// Build the mesh of a simplified chunk. Each column samples the terrain
+// generator at its middle and is raised to the highest block placed in it
+// (or lowered where its top blocks were removed), as stored in the database.
+// Walls are made down to the neighboring columns; walls on the chunk's edges
+// go down to the bottom of the world so that no gaps show next to chunks made
+// with a different column width.
+// Runs on a worker thread.
+// Arguments:
+// - item: p, q and step of the chunk to build; gets the mesh
+// Returns: none
+void compute_lod_chunk(
+        WorkerItem *item)
+{
+    int p = item->p;
+    int q = item->q;
+    int step = item->step;
+    LodColumns *c = calloc(1, sizeof(LodColumns));
+    c->p = p;
+    c->q = q;
+    c->step = step;
+    c->width = CHUNK_SIZE / step;
+    int ox = p * CHUNK_SIZE + step / 2;
+    int oz = q * CHUNK_SIZE + step / 2;
+    for (int i = 0; i < c->width; i++) {
+        for (int j = 0; j < c->width; j++) {
+            c->heights[i][j] = world_height(
+                ox + i * step, oz + j * step, &c->blocks[i][j]);
+        }
+    }
+    db_load_block_rows(p, q, 0, lod_block_func, c);
+    for (int i = 0; i < c->width; i++) {
+        for (int j = 0; j < c->width; j++) {
+            int *h = &c->heights[i][j];
+            while (*h > 0 && (c->removed[i][j][(*h - 1) / 32] &
+                (1u << ((*h - 1) % 32))))
+            {
+                (*h)--;
+            }
+            if (c->raised[i][j] > *h) {
+                *h = c->raised[i][j];
+                c->blocks[i][j] = c->raised_blocks[i][j];
+            }
+        }
+    }
+
+    static const int sides[4][3] = {
+        {0, -1, 0}, {1, 1, 0}, {4, 0, -1}, {5, 0, 1}
+    };
+    GLfloat *data = malloc_faces(10, c->width * c->width * 5);
+    int faces = 0;
+    int miny = 256;
+    int maxy = 0;
+    for (int i = 0; i < c->width; i++) {
+        for (int j = 0; j < c->width; j++) {
+            int h = c->heights[i][j];
+            int w = c->blocks[i][j];
+            float x = p * CHUNK_SIZE + i * step + (step - 1) / 2.0;
+            float z = q * CHUNK_SIZE + j * step + (step - 1) / 2.0;
+            if (h <= 0) {
+                continue;
+            }
+            make_lod_face(data + faces++ * 60, 2, x, z, step, h - 1, h, w);
+            miny = MIN(miny, h - 1);
+            maxy = MAX(maxy, h);
+            for (int k = 0; k < 4; k++) {
+                int ni = i + sides[k][1];
+                int nj = j + sides[k][2];
+                int bottom = 0;
+                if (ni >= 0 && nj >= 0 && ni < c->width && nj < c->width) {
+                    bottom = c->heights[ni][nj];
+                }
+                if (bottom >= h) {
+                    continue;
+                }
+                make_lod_face(data + faces++ * 60, sides[k][0], x, z, step,
+                        bottom, h, w);
+                miny = MIN(miny, bottom);
+            }
+        }
+    }
+    free(c);
+    item->miny = miny - 1;
+    item->maxy = maxy;
+    item->faces = faces;
+    item->data = data;
+}
+
+
+// Store a simplified chunk built by a worker, replacing the one at its
+// position, if any
+// Arguments:
+// - item: finished work item of compute_lod_chunk()
+// Returns: none
+void generate_lod_chunk(
+        Model *g,
+        WorkerItem *item)
+{
+    LodChunk *lod = NULL;
+    for (int i = 0; i < g->lod_count; i++) {
+        LodChunk *other = g->lod_chunks + i;
+        if (other->p == item->p && other->q == item->q) {
+            lod = other;
+            break;
+        }
+    }
+    if (!lod && g->lod_count < MAX_LOD_CHUNKS) {
+        lod = g->lod_chunks + g->lod_count++;
+        memset(&lod->mesh, 0, sizeof(ArenaAlloc));
+    }
+    if (lod) {
+        lod->p = item->p;
+        lod->q = item->q;
+        lod->step = item->step;
+        lod->miny = item->miny;
+        lod->maxy = item->maxy;
+        arena_store(&g->chunk_arena, &lod->mesh, item->faces * 6, item->data);
+    }
+    free(item->data);
+}
+
+
+// Check whether a chunk position is drawn in full detail, so that no
+// simplified chunk is needed there
+// Arguments:
+// - p, q: chunk position
+// - distance: chunk distance of the position from the camera
+// Returns:
+// - non-zero if a meshed chunk is drawn at the position
+static int
+lod_covered(
+        Model *g,
+        int p,
+        int q,
+        int distance)
+{
+    if (distance > g->render_radius) {
+        return 0;
+    }
+    Visibility *v = &g->visibility;
+    int cell = visibility_cell(v, p, q);
+    return cell >= 0 && v->chunks[cell] && v->chunks[cell]->mesh.pool;
+}
+
+
+// Get the column width of the simplified chunk at a distance from the camera.
+// The columns get wider over three bands between the render radius and the
+// LOD radius, so that chunks get more detailed a step at a time as the camera
+// nears them. Chunks inside the render radius get the narrowest columns.
+// Arguments:
+// - distance: chunk distance from the camera
+// Returns:
+// - column width in blocks
+static int
+lod_step(
+        Model *g,
+        int distance)
+{
+    int band = MAX(1, (g->lod_radius - g->render_radius + 2) / 3);
+    int level = MAX(0, distance - g->render_radius - 1) / band;
+    return 2 << MIN(level, 2);
+}
+
+
+// Simplified chunks waiting for a worker, best first, from the last
+// ensure_lod_chunks()
+// - lod_queue: p, q and column width of each
+// - lod_queue_size: number waiting
+// - lod_queue_next: index of the next one to hand to a worker
+static int lod_queue[LOD_CHUNKS_PER_FRAME][3];
+static int lod_queue_size = 0;
+static int lod_queue_next = 0;
+
+
+// Keep the simplified chunks around the camera up to date: drop the ones out
+// of range or drawn in full detail, then queue the missing ones and the ones
+// whose column width changed with the distance for the workers, nearest first
+// and those in the view frustum before the others, a few per frame. Nothing
+// is drawn or queued when the LOD radius is 0.
+// Must be called after update_visibility().
+// Arguments: none
+// Returns: none
+void ensure_lod_chunks(
+        Model *g)
+{
+    static int *grid = NULL;
+    static int grid_size = 0;
+    Visibility *v = &g->visibility;
+    int p = v->p;
+    int q = v->q;
+    int r = g->lod_radius;
+    lod_queue_size = 0;
+    lod_queue_next = 0;
+    int width = r * 2 + 1;
+    if (width * width > grid_size) {
+        grid_size = width * width;
+        grid = realloc(grid, sizeof(int) * grid_size);
+    }
+    memset(grid, 0, sizeof(int) * width * width);
+    int count = g->lod_count;
+    for (int i = 0; i < count; i++) {
+        LodChunk *lod = g->lod_chunks + i;
+        int dp = lod->p - p;
+        int dq = lod->q - q;
+        int distance = MAX(ABS(dp), ABS(dq));
+        if (!r || distance > r ||
+            lod_covered(g, lod->p, lod->q, distance))
+        {
+            arena_release(&g->chunk_arena, &lod->mesh);
+            memcpy(lod, g->lod_chunks + (--count), sizeof(LodChunk));
+            i--;
+            continue;
+        }
+        grid[(dp + r) * width + dq + r] = i + 1;
+    }
+    g->lod_count = count;
+    if (!r) {
+        return;
+    }
+
+    // Chunks already being built by a worker are not queued again
+    int pending[WORKERS][2];
+    int pending_count = 0;
+    for (int i = 0; i < WORKERS; i++) {
+        WorkerItem *item = &g->workers[i].item;
+        if (item->lod) {
+            pending[pending_count][0] = item->p;
+            pending[pending_count][1] = item->q;
+            pending_count++;
+        }
+    }
+
+    int scores[LOD_CHUNKS_PER_FRAME];
+    int positions[LOD_CHUNKS_PER_FRAME][2];
+    int found = 0;
+    for (int dp = -r; dp <= r; dp++) {
+        for (int dq = -r; dq <= r; dq++) {
+            int a = p + dp;
+            int b = q + dq;
+            int distance = MAX(ABS(dp), ABS(dq));
+            if (lod_covered(g, a, b, distance)) {
+                continue;
+            }
+            int index = grid[(dp + r) * width + dq + r];
+            if (index &&
+                g->lod_chunks[index - 1].step == lod_step(g, distance))
+            {
+                continue;
+            }
+            int busy = 0;
+            for (int i = 0; i < pending_count; i++) {
+                busy |= pending[i][0] == a && pending[i][1] == b;
+            }
+            if (busy) {
+                continue;
+            }
+            int invisible = !chunk_visible(g, v->planes, a, b, 0, 256);
+            int score = (invisible << 24) | distance;
+            if (found == LOD_CHUNKS_PER_FRAME && score >= scores[found - 1]) {
+                continue;
+            }
+            int k = found < LOD_CHUNKS_PER_FRAME ? found++ : found - 1;
+            for (; k > 0 && scores[k - 1] > score; k--) {
+                scores[k] = scores[k - 1];
+                positions[k][0] = positions[k - 1][0];
+                positions[k][1] = positions[k - 1][1];
+            }
+            scores[k] = score;
+            positions[k][0] = a;
+            positions[k][1] = b;
+        }
+    }
+    for (int i = 0; i < found; i++) {
+        lod_queue[i][0] = positions[i][0];
+        lod_queue[i][1] = positions[i][1];
+        lod_queue[i][2] = lod_step(g, scores[i] & 0xffffff);
+    }
+    lod_queue_size = found;
+}
+
+
+// Start an idle worker on the next simplified chunk queued by
+// ensure_lod_chunks(), if any.
+// Must be called with the worker's mutex held.
+// Arguments:
+// - worker: idle worker
+// Returns: none
+void ensure_lod_worker(
+        Worker *worker)
+{
+    if (lod_queue_next == lod_queue_size) {
+        return;
+    }
+    int *entry = lod_queue[lod_queue_next++];
+    WorkerItem *item = &worker->item;
+    item->p = entry[0];
+    item->q = entry[1];
+    item->step = entry[2];
+    item->lod = 1;
+    item->load = 0;
+    for (int a = 0; a < 3; a++) {
+        for (int b = 0; b < 3; b++) {
+            item->block_maps[a][b] = NULL;
+            item->light_maps[a][b] = NULL;
+            item->damage_maps[a][b] = NULL;
+        }
+    }
+    worker->state = WORKER_BUSY;
+    cnd_signal(&worker->cnd);
+}
+
 // Arguments:
 // - arg
 // Returns:
@@ -1896,10 +2841,15 @@ int worker_run(
         }
         mtx_unlock(&worker->mtx);
         WorkerItem *item = &worker->item;
-        if (item->load) {
-            load_chunk(item);
+        if (item->lod) {
+            compute_lod_chunk(item);
+        }
+        else {
+            if (item->load) {
+                load_chunk(item);
+            }
+            compute_chunk(item);
         }
-        compute_chunk(item);
         mtx_lock(&worker->mtx);
         worker->state = WORKER_DONE;
         mtx_unlock(&worker->mtx);
@@ -2069,6 +3019,111 @@ set_light(
 }
 
 
+// Schedule a block update: after the given number of block ticks, the block
+// at the position gets to act (a falling block falls). A position is in the
+// queue at most once; scheduling it again while it is waiting does nothing.
+// Arguments:
+// - x, y, z: block position
+// - delay: number of block ticks from now (at least 1)
+// Returns: none
+void
+schedule_block_update(
+        Model *g,
+        int x,
+        int y,
+        int z,
+        int delay)
+{
+    Chunk *chunk = find_chunk(g, chunked(x), chunked(z));
+    if (!chunk || map_get(&chunk->active, x, y, z)) {
+        return;
+    }
+    map_set(&chunk->active, x, y, z, 1);
+    chunk->active_count++;
+    if (g->block_update_count == g->block_update_capacity) {
+        g->block_update_capacity = MAX(256, g->block_update_capacity * 2);
+        g->block_updates = realloc(g->block_updates,
+                sizeof(BlockUpdate) * g->block_update_capacity);
+    }
+    // Sift the new update up the heap
+    BlockUpdate *heap = g->block_updates;
+    int i = g->block_update_count++;
+    int tick = g->block_tick + MAX(1, delay);
+    while (i > 0 && heap[(i - 1) / 2].tick > tick) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i].tick = tick;
+    heap[i].x = x;
+    heap[i].y = y;
+    heap[i].z = z;
+}
+
+
+// Remove the earliest block update from the queue
+// Arguments:
+// - out: output: the update removed
+// Returns: none
+static void
+pop_block_update(
+        Model *g,
+        BlockUpdate *out)
+{
+    BlockUpdate *heap = g->block_updates;
+    *out = heap[0];
+    int n = --g->block_update_count;
+    BlockUpdate last = heap[n];
+    // Sift the last update down from the top
+    int i = 0;
+    while (2 * i + 1 < n) {
+        int child = 2 * i + 1;
+        if (child + 1 < n && heap[child + 1].tick < heap[child].tick) {
+            child++;
+        }
+        if (heap[child].tick >= last.tick) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+}
+
+
+// Schedule updates for a changed block and its six neighbors, for those of
+// them that act on their own (falling blocks). Only offline: in multiplayer
+// the server owns the world.
+// Arguments:
+// - chunk: chunk of the changed block
+// - x, y, z: changed block position
+// Returns: none
+static void
+schedule_block_neighbors(
+        Model *g,
+        Chunk *chunk,
+        int x,
+        int y,
+        int z)
+{
+    static const int offsets[7][3] = {
+        {0, 0, 0}, {0, 1, 0}, {0, -1, 0},
+        {1, 0, 0}, {-1, 0, 0}, {0, 0, 1}, {0, 0, -1}};
+    if (g->mode != MODE_OFFLINE) {
+        return;
+    }
+    for (int i = 0; i < 7; i++) {
+        int nx = x + offsets[i][0];
+        int ny = y + offsets[i][1];
+        int nz = z + offsets[i][2];
+        // The chunk map also holds the blocks just around the chunk
+        int w = map_get(&chunk->map, nx, ny, nz);
+        if (is_falling(ABS(w))) {
+            schedule_block_update(g, nx, ny, nz, FALL_DELAY);
+        }
+    }
+}
+
+
 // Arguments:
 // - p, q
 // - x, y, z
@@ -2093,6 +3148,9 @@ void _set_block(
                 dirty_chunk(g, chunk);
             }
             db_insert_block(p, q, x, y, z, w);
+            if (chunked(x) == p && chunked(z) == q) {
+                schedule_block_neighbors(g, chunk, x, y, z);
+            }
         }
     }
     else {
@@ -2136,6 +3194,115 @@ void set_block(
 }
 
 
+// Chunks changed by the block updates of one tick, to be marked dirty once
+// at the end of the tick
+typedef struct {
+    int count;
+    int p[64];
+    int q[64];
+} ChangedChunks;
+
+
+// Change a block from a block update. Like set_block(), except that the
+// chunks are marked dirty by the caller, once for the whole tick.
+// Arguments:
+// - x, y, z: block position
+// - w: new block id
+// - changed: chunks changed this tick (added to)
+// Returns: none
+static void
+set_updated_block(
+        Model *g,
+        int x,
+        int y,
+        int z,
+        int w,
+        ChangedChunks *changed)
+{
+    int p = chunked(x);
+    int q = chunked(z);
+    for (int dx = -1; dx <= 1; dx++) {
+        for (int dz = -1; dz <= 1; dz++) {
+            if (dx && chunked(x + dx) == p) { continue; }
+            if (dz && chunked(z + dz) == q) { continue; }
+            int bp = p + dx;
+            int bq = q + dz;
+            _set_block(g, bp, bq, x, y, z, (dx || dz) ? -w : w, 0);
+            int found = 0;
+            for (int i = 0; i < changed->count && !found; i++) {
+                found = changed->p[i] == bp && changed->q[i] == bq;
+            }
+            if (found) {
+                continue;
+            }
+            if (changed->count < 64) {
+                changed->p[changed->count] = bp;
+                changed->q[changed->count] = bq;
+                changed->count++;
+            }
+            else {
+                Chunk *chunk = find_chunk(g, bp, bq);
+                if (chunk) {
+                    dirty_chunk(g, chunk);
+                }
+            }
+        }
+    }
+    client_block(x, y, z, w);
+}
+
+
+// Run the block updates that are due: one block tick. A falling block with
+// empty space or a plant under it moves down by one block (and is scheduled
+// again by the change). Nothing scans the chunks: only positions next to
+// changed blocks are ever scheduled. The chunks changed by the tick's updates
+// are marked dirty together at the end, so they are remeshed once.
+// Arguments: none
+// Returns: none
+void
+update_blocks(
+        Model *g)
+{
+    g->block_tick++;
+    ChangedChunks changed = {0};
+    int budget = BLOCK_UPDATES_PER_TICK;
+    while (g->block_update_count && budget > 0 &&
+            g->block_updates[0].tick <= g->block_tick)
+    {
+        BlockUpdate u;
+        pop_block_update(g, &u);
+        budget--;
+        Chunk *chunk = find_chunk(g, chunked(u.x), chunked(u.z));
+        if (!chunk || !map_get(&chunk->active, u.x, u.y, u.z)) {
+            // The chunk was unloaded (and maybe loaded again) since
+            continue;
+        }
+        map_set(&chunk->active, u.x, u.y, u.z, 0);
+        if (--chunk->active_count == 0) {
+            // Removed positions stay in the map as zeros: drop them all
+            memset(chunk->active.data, 0,
+                    sizeof(MapEntry) * (chunk->active.mask + 1));
+            chunk->active.size = 0;
+        }
+        int w = map_get(&chunk->map, u.x, u.y, u.z);
+        if (!is_falling(w) || u.y <= 0) {
+            continue;
+        }
+        int below = map_get(&chunk->map, u.x, u.y - 1, u.z);
+        if (below == EMPTY || is_plant(below)) {
+            set_updated_block(g, u.x, u.y, u.z, 0, &changed);
+            set_updated_block(g, u.x, u.y - 1, u.z, w, &changed);
+        }
+    }
+    for (int i = 0; i < changed.count; i++) {
+        Chunk *chunk = find_chunk(g, changed.p[i], changed.q[i]);
+        if (chunk) {
+            dirty_chunk(g, chunk);
+        }
+    }
+}
+
+
 // Add the block to the (short) player's block history record
 // Arguments:
 // - x, y, z
@@ -2184,6 +3351,81 @@ int get_block(
 }
 
 
+// Copy the blocks in a box of the world into a block cache. Each chunk that
+// the box overlaps is looked up once per column of blocks at most, instead of
+// once per block as get_block() does.
+// Arguments:
+// - cache: cache to fill (its storage grows as needed)
+// - x0, y0, z0: lowest corner of the box
+// - x1, y1, z1: highest corner of the box (included)
+// Returns: none
+void block_cache_fill(
+        Model *g,
+        BlockCache *cache,
+        int x0,
+        int y0,
+        int z0,
+        int x1,
+        int y1,
+        int z1)
+{
+    cache->x = x0;
+    cache->y = y0;
+    cache->z = z0;
+    cache->width = x1 - x0 + 1;
+    cache->height = y1 - y0 + 1;
+    cache->depth = z1 - z0 + 1;
+    int size = cache->width * cache->height * cache->depth;
+    if (size > cache->capacity) {
+        cache->capacity = size;
+        cache->data = realloc(cache->data, size);
+    }
+    Chunk *chunk = NULL;
+    int p = chunked(x0) - 1;
+    int q = 0;
+    for (int dx = 0; dx < cache->width; dx++) {
+        for (int dz = 0; dz < cache->depth; dz++) {
+            int x = x0 + dx;
+            int z = z0 + dz;
+            if (chunked(x) != p || chunked(z) != q) {
+                p = chunked(x);
+                q = chunked(z);
+                chunk = find_chunk(g, p, q);
+            }
+            char *column = cache->data + dx * cache->height * cache->depth + dz;
+            for (int dy = 0; dy < cache->height; dy++) {
+                column[dy * cache->depth] =
+                    chunk ? map_get(&chunk->map, x, y0 + dy, z) : 0;
+            }
+        }
+    }
+}
+
+
+// Get a block from a block cache
+// Arguments:
+// - cache: cache filled by block_cache_fill()
+// - x, y, z: block position
+// Returns:
+// - block id, or 0 if the position is outside of the cache
+int block_cache_get(
+        const BlockCache *cache,
+        int x,
+        int y,
+        int z)
+{
+    int dx = x - cache->x;
+    int dy = y - cache->y;
+    int dz = z - cache->z;
+    if (dx < 0 || dy < 0 || dz < 0 || dx >= cache->width ||
+        dy >= cache->height || dz >= cache->depth)
+    {
+        return 0;
+    }
+    return cache->data[(dx * cache->height + dy) * cache->depth + dz];
+}
+
+
 int
 get_block_damage(
         Model *g,
@@ -2250,6 +3492,292 @@ add_block_damage(
 }
 
 
+// Open an edit transaction: the edits made until the matching edit_commit()
+// are gathered and applied together. Transactions nest; the edits are applied
+// when the outermost one is committed.
+// Arguments: none
+// Returns: none
+void
+edit_begin(
+        Model *g)
+{
+    g->edit.depth++;
+}
+
+
+// Find the edits of a chunk in the open edit transaction
+// Arguments:
+// - p, q: chunk position
+// - create: flag: add the chunk if it has no edits yet
+// Returns:
+// - the chunk's edits, or NULL if it has none and create is not set
+static EditChunk *
+find_edit_chunk(
+        Model *g,
+        int p,
+        int q,
+        int create)
+{
+    EditTransaction *t = &g->edit;
+    if (t->last < t->count) {
+        EditChunk *e = t->chunks + t->last;
+        if (e->p == p && e->q == q) {
+            return e;
+        }
+    }
+    for (int i = 0; i < t->count; i++) {
+        EditChunk *e = t->chunks + i;
+        if (e->p == p && e->q == q) {
+            t->last = i;
+            return e;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    if (t->count == t->capacity) {
+        t->capacity = MAX(16, t->capacity * 2);
+        t->chunks = realloc(t->chunks, sizeof(EditChunk) * t->capacity);
+    }
+    t->last = t->count++;
+    EditChunk *e = t->chunks + t->last;
+    e->p = p;
+    e->q = q;
+    e->chunk = find_chunk(g, p, q);
+    map_alloc(&e->edits, p * CHUNK_SIZE - 1, 0, q * CHUNK_SIZE - 1, 0xff);
+    return e;
+}
+
+
+// Get a block as the open edit transaction leaves it
+// Arguments:
+// - x, y, z: block position
+// Returns:
+// - the block id the position will have once the edits are committed
+int
+edit_get_block(
+        Model *g,
+        int x,
+        int y,
+        int z)
+{
+    EditChunk *e = find_edit_chunk(g, chunked(x), chunked(z), 0);
+    if (!e) {
+        return get_block(g, x, y, z);
+    }
+    int w = map_get(&e->edits, x, y, z);
+    if (w) {
+        return w - 1;
+    }
+    return e->chunk ? map_get(&e->chunk->map, x, y, z) : 0;
+}
+
+
+// Change a block within the open edit transaction (or right away if there is
+// none). A later edit of the same position replaces an earlier one.
+// Arguments:
+// - x, y, z: block position
+// - w: new block id
+// Returns: none
+void
+edit_block(
+        Model *g,
+        int x,
+        int y,
+        int z,
+        int w)
+{
+    if (!g->edit.depth) {
+        set_block(g, x, y, z, w);
+        return;
+    }
+    EditChunk *e = find_edit_chunk(g, chunked(x), chunked(z), 1);
+    map_set(&e->edits, x, y, z, w + 1);
+}
+
+
+// Chunk that an edit commit writes rows to: a chunk with edits, or a neighbor
+// that keeps copies of the edited border blocks
+// - p, q: chunk position
+// - chunk: the loaded chunk, or NULL
+// - changed: flag: a block of the loaded chunk changed
+// - count: number of rows for the database
+// - capacity: number of rows allocated
+// - rows: blocks to insert into the database
+typedef struct {
+    int p;
+    int q;
+    Chunk *chunk;
+    int changed;
+    int count;
+    int capacity;
+    Block *rows;
+} EditTarget;
+
+// Targets of the current commit, and the block updates for the server
+static EditTarget *edit_targets;
+static int edit_target_count;
+static int edit_target_capacity;
+static Block *edit_messages;
+static int edit_message_count;
+static int edit_message_capacity;
+
+
+// Find or add the target of an edit commit for a chunk
+// Arguments:
+// - p, q: chunk position
+// Returns:
+// - index of the target in edit_targets
+static int
+find_edit_target(
+        Model *g,
+        int p,
+        int q)
+{
+    for (int i = edit_target_count - 1; i >= 0; i--) {
+        if (edit_targets[i].p == p && edit_targets[i].q == q) {
+            return i;
+        }
+    }
+    if (edit_target_count == edit_target_capacity) {
+        int capacity = MAX(16, edit_target_capacity * 2);
+        edit_targets = realloc(edit_targets, sizeof(EditTarget) * capacity);
+        memset(edit_targets + edit_target_capacity, 0,
+                sizeof(EditTarget) * (capacity - edit_target_capacity));
+        edit_target_capacity = capacity;
+    }
+    EditTarget *target = edit_targets + edit_target_count;
+    target->p = p;
+    target->q = q;
+    target->chunk = find_chunk(g, p, q);
+    target->changed = 0;
+    target->count = 0;
+    return edit_target_count++;
+}
+
+
+// Append a block to a growable array
+// Arguments:
+// - data, count, capacity: the array
+// - x, y, z, w: the block
+// Returns: none
+static void
+add_edit_block(
+        Block **data,
+        int *count,
+        int *capacity,
+        int x,
+        int y,
+        int z,
+        int w)
+{
+    if (*count == *capacity) {
+        *capacity = MAX(256, *capacity * 2);
+        *data = realloc(*data, sizeof(Block) * *capacity);
+    }
+    Block *b = *data + (*count)++;
+    b->x = x;
+    b->y = y;
+    b->z = z;
+    b->w = w;
+}
+
+
+// Close an edit transaction. When the outermost one is closed, the gathered
+// edits are applied chunk by chunk: the blocks of each chunk (and the border
+// copies in its neighbors) are set, each chunk's database rows are queued as
+// one batch, each changed chunk is marked dirty once, and the changes are
+// sent to the server as one batch of block updates.
+// Arguments: none
+// Returns: none
+void
+edit_commit(
+        Model *g)
+{
+    EditTransaction *t = &g->edit;
+    if (--t->depth > 0) {
+        return;
+    }
+    edit_target_count = 0;
+    edit_message_count = 0;
+    for (int c = 0; c < t->count; c++) {
+        EditChunk *e = t->chunks + c;
+        int p = e->p;
+        int q = e->q;
+        int own = find_edit_target(g, p, q);
+        Chunk *chunk = edit_targets[own].chunk;
+        Map *edits = &e->edits;
+        MAP_FOR_EACH(edits, x, y, z, ew) {
+            int w = ew - 1;
+            int previous = 0;
+            if (chunk) {
+                previous = map_get(&chunk->map, x, y, z);
+                if (!map_set(&chunk->map, x, y, z, w)) {
+                    continue;
+                }
+                edit_targets[own].changed = 1;
+            }
+            EditTarget *target = edit_targets + own;
+            add_edit_block(&target->rows, &target->count, &target->capacity,
+                    x, y, z, w);
+            // The server takes these like "B" lines, which do not place a
+            // block where there is one
+            if (previous && w && is_destructable(previous)) {
+                add_edit_block(&edit_messages, &edit_message_count,
+                        &edit_message_capacity, x, y, z, 0);
+            }
+            add_edit_block(&edit_messages, &edit_message_count,
+                    &edit_message_capacity, x, y, z, w);
+            for (int dx = -1; dx <= 1; dx++) {
+                for (int dz = -1; dz <= 1; dz++) {
+                    if (dx == 0 && dz == 0) { continue; }
+                    if (dx && chunked(x + dx) == p) { continue; }
+                    if (dz && chunked(z + dz) == q) { continue; }
+                    target = edit_targets + find_edit_target(g, p + dx, q + dz);
+                    if (target->chunk &&
+                            map_set(&target->chunk->map, x, y, z, -w)) {
+                        target->changed = 1;
+                    }
+                    add_edit_block(&target->rows, &target->count,
+                            &target->capacity, x, y, z, -w);
+                }
+            }
+            if (!chunk) {
+                if (w == 0) {
+                    unset_sign(g, x, y, z);
+                    set_light(g, p, q, x, y, z, 0);
+                }
+                continue;
+            }
+            if (w == 0) {
+                map_set(&chunk->damage, x, y, z, 0);
+                if (chunk->signs.size) {
+                    unset_sign(g, x, y, z);
+                }
+                if (map_get(&chunk->lights, x, y, z)) {
+                    set_light(g, p, q, x, y, z, 0);
+                }
+            }
+            schedule_block_neighbors(g, chunk, x, y, z);
+        } END_MAP_FOR_EACH;
+        map_free(edits);
+    }
+    t->count = 0;
+    t->last = 0;
+    for (int i = 0; i < edit_target_count; i++) {
+        EditTarget *target = edit_targets + i;
+        db_insert_blocks(target->p, target->q, target->rows, target->count);
+        if (target->changed) {
+            dirty_chunk(g, target->chunk);
+        }
+    }
+    client_blocks(edit_message_count, edit_messages);
+}
+
+
+// Place a block for a builder command, replacing the block there unless it
+// cannot be destroyed. Builder commands run in an edit transaction, so the
+// blocks they place are applied together.
 // Arguments:
 // - x, y, z
 // - w
@@ -2263,89 +3791,335 @@ builder_block(
         int w)
 {
     if (y <= 0 || y >= 256) { return; }
-    if (is_destructable(get_block(g, x, y, z))) {
-        set_block(g, x, y, z, 0);
+    edit_begin(g);
+    if (is_destructable(edit_get_block(g, x, y, z))) {
+        edit_block(g, x, y, z, 0);
     }
     if (w) {
-        set_block(g, x, y, z, w);
+        edit_block(g, x, y, z, w);
+    }
+    edit_commit(g);
+}
+
+
+// Cave culling: find the chunk sections that can be seen from the camera.
+// A breadth-first search starts at the camera's section. It steps into a
+// neighbouring section only through a face that the current section's
+// connectivity links to the face it was entered by, never in the direction
+// opposite to a step already taken, and only into sections in the frustum.
+// Arguments:
+// - v: view to search (the camera is at its centre)
+// - y: camera height
+// - radius: chunk radius around the camera to search
+// - visible: filled with a bit mask of the visible sections of each position
+//   in the grids of the view
+// Returns:
+// - zero if the camera is not in a loaded section and nothing is culled
+static int find_visible_sections(
+        Model *g,
+        Visibility *v,
+        float y,
+        int radius,
+        int *visible)
+{
+    static int *queue = NULL;
+    static int queue_size = 0;
+    Chunk **grid = v->chunks;
+    int width = v->width;
+    int size = width * width;
+    if (size > queue_size) {
+        queue_size = size;
+        queue = realloc(queue, sizeof(int) * size * CHUNK_SECTIONS);
+    }
+    memset(visible, 0, sizeof(int) * size);
+    int p = v->p;
+    int q = v->q;
+    int by = roundf(y);
+    int center = v->radius * width + v->radius;
+    if (by < 0 || by >= 256 || !grid[center]) {
+        return 0;
+    }
+
+    // Queue entries: (cell * CHUNK_SECTIONS + section) << 9 | directions
+    // taken so far << 3 | face entered by (6 for the camera's section)
+    int start = section_of(by);
+    int head = 0;
+    int tail = 0;
+    visible[center] |= 1 << start;
+    queue[tail++] = ((center * CHUNK_SECTIONS + start) << 9) | 6;
+    int steps[6][3] = {
+        {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}
+    };
+    while (head < tail) {
+        int entry = queue[head++];
+        int from = entry & 7;
+        int directions = (entry >> 3) & 0x3f;
+        int cell = (entry >> 9) / CHUNK_SECTIONS;
+        int section = (entry >> 9) % CHUNK_SECTIONS;
+        Chunk *chunk = grid[cell];
+        int dp = cell / width - v->radius;
+        int dq = cell % width - v->radius;
+        for (int d = 0; d < 6; d++) {
+            if (directions & (1 << (d ^ 1))) {
+                continue;
+            }
+            if (from != 6 && !(chunk->connections[section][from] & (1 << d))) {
+                continue;
+            }
+            int np = dp + steps[d][0];
+            int ns = section + steps[d][1];
+            int nq = dq + steps[d][2];
+            if (ABS(np) > radius || ABS(nq) > radius ||
+                    ns < 0 || ns >= CHUNK_SECTIONS)
+            {
+                continue;
+            }
+            int next = (np + v->radius) * width + (nq + v->radius);
+            if (!grid[next] || (visible[next] & (1 << ns))) {
+                continue;
+            }
+            if (!chunk_visible(g, v->planes, p + np, q + nq,
+                        ns * SECTION_SIZE - 1, (ns + 1) * SECTION_SIZE))
+            {
+                continue;
+            }
+            visible[next] |= 1 << ns;
+            queue[tail++] = ((next * CHUNK_SECTIONS + ns) << 9) |
+                ((directions | (1 << d)) << 3) | (d ^ 1);
+        }
+    }
+    return 1;
+}
+
+
+// Position of a section relative to the camera's section
+typedef struct {
+    int dp;
+    int dq;
+    int ds;
+    int distance;
+} SectionOffset;
+
+
+static int
+compare_section_offsets(
+        const void *a,
+        const void *b)
+{
+    const SectionOffset *o1 = (const SectionOffset *)a;
+    const SectionOffset *o2 = (const SectionOffset *)b;
+    return o1->distance - o2->distance;
+}
+
+
+// Get the positions of all the sections within a chunk radius of the camera's
+// section, nearest first. The order only depends on the radius, so it is kept
+// from frame to frame and only sorted again when the radius changes.
+// Arguments:
+// - radius: chunk radius
+// - count: set to the number of offsets
+// Returns:
+// - section offsets, sorted by distance
+static SectionOffset *section_order(
+        int radius,
+        int *count)
+{
+    static SectionOffset *order = NULL;
+    static int order_radius = -1;
+    static int order_count = 0;
+    if (radius != order_radius) {
+        int width = radius * 2 + 1;
+        order_radius = radius;
+        order_count = 0;
+        order = realloc(order, sizeof(SectionOffset) *
+                width * width * (CHUNK_SECTIONS * 2 - 1));
+        for (int dp = -radius; dp <= radius; dp++) {
+            for (int dq = -radius; dq <= radius; dq++) {
+                for (int ds = 1 - CHUNK_SECTIONS; ds < CHUNK_SECTIONS; ds++) {
+                    SectionOffset *o = order + order_count++;
+                    int x = dp * CHUNK_SIZE;
+                    int y = ds * SECTION_SIZE;
+                    int z = dq * CHUNK_SIZE;
+                    o->dp = dp;
+                    o->dq = dq;
+                    o->ds = ds;
+                    o->distance = x * x + y * y + z * z;
+                }
+            }
+        }
+        qsort(order, order_count, sizeof(SectionOffset),
+                compare_section_offsets);
     }
+    *count = order_count;
+    return order;
+}
+
+
+// Find the face groups of a chunk section that can face a camera. Faces that
+// point away from the camera on the far side of the section's bounds can never
+// be seen.
+// Arguments:
+// - p, q: chunk position
+// - section: section index
+// - x, y, z: camera position
+// Returns:
+// - bit mask of the face groups (see mesh_group())
+static int facing_groups(
+        int p,
+        int q,
+        int section,
+        float x,
+        float y,
+        float z)
+{
+    // Faces of the blocks lie between these bounds
+    float x0 = p * CHUNK_SIZE - 0.5;
+    float x1 = x0 + CHUNK_SIZE;
+    float y0 = section * SECTION_SIZE - 0.5;
+    float y1 = y0 + SECTION_SIZE;
+    float z0 = q * CHUNK_SIZE - 0.5;
+    float z1 = z0 + CHUNK_SIZE;
+    int groups = 1 << (FACE_GROUPS - 1);
+    groups |= (x < x1) << 0;
+    groups |= (x > x0) << 1;
+    groups |= (y > y0) << 2;
+    groups |= (y < y1) << 3;
+    groups |= (z < z1) << 4;
+    groups |= (z > z0) << 5;
+    return groups;
 }
 
 
+// Draw the visible chunk sections, nearest first so that the depth test
+// rejects hidden faces before they are shaded. Only the faces that can face
+// the camera are drawn.
 // Arguments:
 // - attrib
-// - player
+// - v: view to draw, set up by update_visibility()
 // Returns:
 // - number of faces
 int render_chunks(
         Model *g,
         Attrib *attrib,
-        Player *player)
+        Visibility *v)
 {
     int result = 0;
-    State *s = &player->state;
+    State *s = &v->player->state;
     float eye_y = player_eye_y(s->y);
-    ensure_chunks(g, player);
-    int p = chunked(s->x);
-    int q = chunked(s->z);
+    int p = v->p;
+    int q = v->q;
     float light = get_daylight(g);
-    float matrix[16];
-    set_matrix_3d_player_camera(g, matrix, player);
-    float planes[6][4];
-    frustum_planes(planes, g->render_radius, matrix);
     glUseProgram(attrib->program);
-    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
+    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, v->matrix);
     glUniform3f(attrib->camera, s->x, eye_y, s->z);
     glUniform1i(attrib->sampler, 0);
     glUniform1i(attrib->extra1, 2);
     glUniform1f(attrib->extra2, light);
-    glUniform1f(attrib->extra3, g->render_radius * CHUNK_SIZE);
+    glUniform1f(attrib->extra3, view_radius(g) * CHUNK_SIZE);
     glUniform1i(attrib->extra4, g->ortho);
     glUniform1f(attrib->timer, time_of_day(g));
-    for (int i = 0; i < g->chunk_count; i++) {
-        Chunk *chunk = g->chunks + i;
-        if (chunk_distance(chunk, p, q) > g->render_radius) {
+    static Chunk *queue[MAX_CHUNKS * CHUNK_SECTIONS];
+    static int sections[MAX_CHUNKS * CHUNK_SECTIONS];
+    static int groups[MAX_CHUNKS * CHUNK_SECTIONS];
+    static int *grid = NULL;
+    static int *masks = NULL;
+    static int grid_size = 0;
+    int radius = g->render_radius;
+    if (v->capacity > grid_size) {
+        grid_size = v->capacity;
+        grid = realloc(grid, sizeof(int) * grid_size);
+        masks = realloc(masks, sizeof(int) * grid_size);
+    }
+    int culling = USE_CAVE_CULLING && !g->ortho &&
+        find_visible_sections(g, v, eye_y, radius, grid);
+    memset(masks, 0, sizeof(int) * v->width * v->width);
+    g->culled_faces = 0;
+    for (int i = 0; i < v->visible_count; i++) {
+        Chunk *chunk = v->visible[i];
+        if (chunk_distance(chunk, p, q) > radius) {
+            continue;
+        }
+        int cell = visibility_cell(v, chunk->p, chunk->q);
+        int mask = (1 << CHUNK_SECTIONS) - 1;
+        if (culling) {
+            mask = grid[cell];
+        }
+        int faces = 0;
+        for (int j = 0; j < CHUNK_SECTIONS; j++) {
+            if (mask & (1 << j)) {
+                faces += chunk->section_faces[j];
+            }
+        }
+        g->culled_faces += chunk->faces - faces;
+        result += faces;
+        if (faces) {
+            masks[cell] = mask;
+        }
+    }
+
+    // Queue the sections to draw, nearest first
+    int start = section_of(roundf(eye_y));
+    int order_count;
+    SectionOffset *order = section_order(radius, &order_count);
+    int count = 0;
+    for (int i = 0; i < order_count; i++) {
+        SectionOffset *o = order + i;
+        int section = start + o->ds;
+        if (section < 0 || section >= CHUNK_SECTIONS) {
+            continue;
+        }
+        int cell = visibility_cell(v, p + o->dp, q + o->dq);
+        if (!(masks[cell] & (1 << section))) {
             continue;
         }
-        if (!chunk_visible(g, planes, chunk->p, chunk->q, chunk->miny, chunk->maxy)) {
+        if (!v->chunks[cell]->section_faces[section]) {
             continue;
         }
-        draw_chunk(attrib, chunk);
-        result += chunk->faces;
+        queue[count] = v->chunks[cell];
+        sections[count] = section;
+        groups[count] = (1 << FACE_GROUPS) - 1;
+        if (!g->ortho) {
+            groups[count] = facing_groups(p + o->dp, q + o->dq, section,
+                    s->x, eye_y, s->z);
+        }
+        count++;
+    }
+    draw_chunks(attrib, &g->chunk_arena, queue, sections, groups, count);
+
+    // Simplified chunks, beyond the render radius and in place of chunks
+    // that are not meshed yet
+    static LodChunk *lods[MAX_LOD_CHUNKS];
+    int lod_count = 0;
+    for (int i = 0; i < g->lod_count; i++) {
+        LodChunk *lod = g->lod_chunks + i;
+        if (chunk_visible(g, v->planes, lod->p, lod->q, lod->miny, lod->maxy)) {
+            lods[lod_count++] = lod;
+            result += lod->mesh.count / 6;
+        }
     }
+    draw_lod_chunks(attrib, &g->chunk_arena, lods, lod_count);
     return result;
 }
 
 
+// Draw the signs of the chunks visible in a view
 // Arguments:
 // - attrib
-// - player
+// - v: view to draw, set up by update_visibility()
 // Returns: none
 void
 render_signs(
         Model *g,
         Attrib *attrib,
-        Player *player)
+        Visibility *v)
 {
-    State *s = &player->state;
-    int p = chunked(s->x);
-    int q = chunked(s->z);
-    float matrix[16];
-    set_matrix_3d_player_camera(g, matrix, player);
-    float planes[6][4];
-    frustum_planes(planes, g->render_radius, matrix);
     glUseProgram(attrib->program);
-    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
+    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, v->matrix);
     glUniform1i(attrib->sampler, 3);
     glUniform1i(attrib->extra1, 1);
-    for (int i = 0; i < g->chunk_count; i++) {
-        Chunk *chunk = g->chunks + i;
-        if (chunk_distance(chunk, p, q) > g->sign_radius) {
-            continue;
-        }
-        if (!chunk_visible(
-                    g, planes, chunk->p, chunk->q, chunk->miny, chunk->maxy))
-        {
+    for (int i = 0; i < v->visible_count; i++) {
+        Chunk *chunk = v->visible[i];
+        if (chunk_distance(chunk, v->p, v->q) > g->sign_radius) {
             continue;
         }
         draw_signs(attrib, chunk);
@@ -2381,32 +4155,84 @@ render_sign(
     text[MAX_SIGN_LENGTH - 1] = '\0';
     GLfloat *data = malloc_faces(5, strlen(text));
     int length = _gen_sign_buffer(data, x, y, z, face, text);
-    GLuint buffer = gen_faces(5, length, data);
-    draw_sign(attrib, buffer, length);
-    del_buffer(buffer);
+    int first = transient_append(&g->transient, 5, length * 6, data);
+    draw_sign(attrib, g->transient.buffer, first, length);
+    free(data);
 }
 
 
-// Render the other players for the given player
+// Check whether any part of a player's model can be in a view frustum
+// Arguments:
+// - planes: frustum planes of the view
+// - s: state of the player
+// Returns:
+// - non-zero if the player may be visible
+static int
+player_visible(
+        Model *g,
+        float planes[6][4],
+        State *s)
+{
+    // The model (head and body) fits in this sphere around the body
+    const float radius = 1.5;
+    int n = g->ortho ? 4 : 6;
+    for (int i = 0; i < n; i++) {
+        float d =
+            planes[i][0] * s->x +
+            planes[i][1] * s->y +
+            planes[i][2] * s->z +
+            planes[i][3];
+        if (d < -radius * sqrtf(
+            planes[i][0] * planes[i][0] +
+            planes[i][1] * planes[i][1] +
+            planes[i][2] * planes[i][2]))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+// Render the other players in a view. Players outside of the view frustum
+// are left out.
+// Arguments:
+// - attrib: attributes of the player shader
+// - v: view to draw, set up by update_visibility()
+// - buffer: player model buffer (see gen_player_model_buffer())
+// Returns: none
 void
 render_players(
         Model *g,
         Attrib *attrib,
-        Player *player)
+        Visibility *v,
+        GLuint buffer)
 {
+    Player *player = v->player;
     State *s = &player->state;
     float eye_y = player_eye_y(s->y);
-    float matrix[16];
-    set_matrix_3d_player_camera(g, matrix, player);
     glUseProgram(attrib->program);
-    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
+    glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, v->matrix);
     glUniform3f(attrib->camera, s->x, eye_y, s->z);
     glUniform1i(attrib->sampler, 0);
+    glUniform1i(attrib->extra1, 2);
+    glUniform1f(attrib->extra2, get_daylight(g));
+    glUniform1f(attrib->extra3, view_radius(g) * CHUNK_SIZE);
+    glUniform1i(attrib->extra4, g->ortho);
     glUniform1f(attrib->timer, time_of_day(g));
+    GLfloat data[MAX_PLAYERS * 6];
+    int count = 0;
     for (int i = 0; i < g->player_count; i++) {
         Player *other = g->players + i;
         if (other == player) { continue; }
-        draw_player(attrib, other);
+        State *os = &other->state;
+        if (!player_visible(g, v->planes, os)) { continue; }
+        GLfloat *d = data + count++ * 6;
+        d[0] = os->x; d[1] = os->y; d[2] = os->z;
+        d[3] = os->rx; d[4] = os->ry; d[5] = os->brx;
+    }
+    if (count) {
+        draw_players(attrib, buffer, &g->transient, data, count);
     }
 }
 
@@ -2450,9 +4276,11 @@ render_wireframe(
         glLineWidth(1);
         glEnable(GL_COLOR_LOGIC_OP);
         glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
-        GLuint wireframe_buffer = gen_wireframe_buffer(hx, hy, hz, 0.53);
-        draw_lines(attrib, wireframe_buffer, 3, 24);
-        del_buffer(wireframe_buffer);
+        // (6 faces)*(4 points)*(3 dimensions) = 72 floats
+        float data[72];
+        make_cube_wireframe(data, hx, hy, hz, 0.53);
+        int first = transient_append(&g->transient, 3, 24, data);
+        draw_lines(attrib, g->transient.buffer, 3, first, 24);
         glDisable(GL_COLOR_LOGIC_OP);
     }
 }
@@ -2474,7 +4302,7 @@ render_box_wireframe(
     glUseProgram(attrib->program);
     //glEnable(GL_COLOR_LOGIC_OP);
     glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
-    draw_lines(attrib, box->buffer, 3, 24);
+    draw_lines(attrib, box->buffer, 3, 0, 24);
     glLineWidth(1);
     //glDisable(GL_COLOR_LOGIC_OP);
 }
@@ -2502,9 +4330,10 @@ render_players_hitboxes(
             State *os = &other->state;
             float ex, ey, ez;
             player_hitbox_extent(&ex, &ey, &ez);
-            GLuint box_buffer = gen_box_wireframe_buffer(os->x, os->y, os->z, ex, ey, ez);
-            draw_lines(attrib, box_buffer, 3, 24);
-            del_buffer(box_buffer);
+            float data[72];
+            make_box_wireframe(data, os->x, os->y, os->z, ex, ey, ez);
+            int first = transient_append(&g->transient, 3, 24, data);
+            draw_lines(attrib, g->transient.buffer, 3, first, 24);
         }
     }
 }
@@ -2523,9 +4352,15 @@ render_crosshairs(
     glLineWidth(4 * g->scale);
     glEnable(GL_COLOR_LOGIC_OP);
     glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
-    GLuint crosshair_buffer = gen_crosshair_buffer(g);
-    draw_lines(attrib, crosshair_buffer, 2, 4);
-    del_buffer(crosshair_buffer);
+    int x = g->width / 2;
+    int y = g->height / 2;
+    int p = 10 * g->scale;
+    float data[] = {
+        x, y - p, x, y + p,
+        x - p, y, x + p, y
+    };
+    int first = transient_append(&g->transient, 2, 4, data);
+    draw_lines(attrib, g->transient.buffer, 2, first, 4);
     glDisable(GL_COLOR_LOGIC_OP);
 }
 
@@ -2545,20 +4380,22 @@ render_item(
     glUniform1i(attrib->sampler, 0);
     glUniform1f(attrib->timer, time_of_day(g));
     int w = items[g->item_index];
+    // Each face has 10 component float properties, and a cube has 6 faces
+    GLfloat data[6 * 10 * 6];
     if (is_plant(w)) {
-        GLuint buffer = gen_plant_buffer(0, 0, 0, 0.5, w);
-        draw_plant(attrib, buffer);
-        del_buffer(buffer);
+        make_item_plant(data, 0, 0, 0, 0.5, w);
+        int first = transient_append(&g->transient, 10, 24, data);
+        draw_plant(attrib, g->transient.buffer, first);
     }
     else {
-        GLuint buffer = gen_cube_buffer(0, 0, 0, 0.5, w);
-        draw_cube(attrib, buffer);
-        del_buffer(buffer);
+        make_item_cube(data, 0, 0, 0, 0.5, w);
+        int first = transient_append(&g->transient, 10, 36, data);
+        draw_cube(attrib, g->transient.buffer, first);
     }
 }
 
+// Queue a line of 2D text. Queued text is drawn by render_text_batch().
 // Arguments:
-// - attrib
 // - justify
 // - x
 // - y
@@ -2568,24 +4405,51 @@ render_item(
 void
 render_text(
         Model *g,
-        Attrib *attrib,
         int justify,
         float x,
         float y,
         float n,
         char *text)
 {
+    int length = strlen(text);
+    int total = g->text_length + length;
+    if (total > g->text_capacity) {
+        g->text_capacity = MAX(total, g->text_capacity * 2);
+        g->text_data = realloc(g->text_data,
+                sizeof(GLfloat) * 6 * 4 * g->text_capacity);
+    }
+    x -= n * justify * (length - 1) / 2;
+    GLfloat *data = g->text_data + g->text_length * 24;
+    for (int i = 0; i < length; i++) {
+        // Multiply by 24 because there are 24 properties per character
+        make_character(data + i * 24, x, y, n / 2, n, text[i]);
+        x += n;
+    }
+    g->text_length = total;
+}
+
+// Draw all of the text queued by render_text() at once
+// Arguments:
+// - attrib
+// Returns: none
+void
+render_text_batch(
+        Model *g,
+        Attrib *attrib)
+{
+    if (!g->text_length) {
+        return;
+    }
     float matrix[16];
     set_matrix_2d(matrix, g->width, g->height);
     glUseProgram(attrib->program);
     glUniformMatrix4fv(attrib->matrix, 1, GL_FALSE, matrix);
     glUniform1i(attrib->sampler, 1);
     glUniform1i(attrib->extra1, 0);
-    int length = strlen(text);
-    x -= n * justify * (length - 1) / 2;
-    GLuint buffer = gen_text_buffer(x, y, n, text);
-    draw_text(attrib, buffer, length);
-    del_buffer(buffer);
+    int first = transient_append(
+            &g->transient, 4, g->text_length * 6, g->text_data);
+    draw_text(attrib, g->transient.buffer, first, g->text_length);
+    g->text_length = 0;
 }
 
 // Arguments:
@@ -2629,40 +4493,129 @@ void login()
 }
 
 
-// Player copies block
+// Player copies the area between the last two blocks they changed, over
+// the full height of the world. The blocks that are not empty are read out
+// of the chunk maps into the clipboard, at offsets from the older corner
+// that grow towards the newer one.
+// Arguments: none
+// Returns: none
 void
 copy(
         Model *g)
 {
-    memcpy(&g->copy0, &g->block0, sizeof(Block));
-    memcpy(&g->copy1, &g->block1, sizeof(Block));
+    Block *c1 = &g->block1;
+    Block *c2 = &g->block0;
+    Clipboard *clipboard = &g->clipboard;
+    int scx = c2->x < c1->x ? -1 : 1;
+    int scz = c2->z < c1->z ? -1 : 1;
+    int x1 = MIN(c1->x, c2->x);
+    int z1 = MIN(c1->z, c2->z);
+    int x2 = MAX(c1->x, c2->x);
+    int z2 = MAX(c1->z, c2->z);
+    clipboard->width = x2 - x1 + 1;
+    clipboard->depth = z2 - z1 + 1;
+    clipboard->count = 0;
+    for (int i = 0; i < g->chunk_count; i++) {
+        Chunk *chunk = g->chunks + i;
+        int cx = chunk->p * CHUNK_SIZE;
+        int cz = chunk->q * CHUNK_SIZE;
+        if (cx > x2 || cx + CHUNK_SIZE <= x1 ||
+                cz > z2 || cz + CHUNK_SIZE <= z1) {
+            continue;
+        }
+        Map *map = &chunk->map;
+        MAP_FOR_EACH(map, ex, ey, ez, ew) {
+            // Blocks of the neighbors (negative ids) are copied from the
+            // neighbors themselves
+            if (ew <= 0 || ex < x1 || ex > x2 || ez < z1 || ez > z2) {
+                continue;
+            }
+            if (clipboard->count == clipboard->capacity) {
+                clipboard->capacity = MAX(1024, clipboard->capacity * 2);
+                clipboard->blocks = realloc(clipboard->blocks,
+                        sizeof(Block) * clipboard->capacity);
+            }
+            Block *b = clipboard->blocks + clipboard->count++;
+            b->x = (ex - c1->x) * scx;
+            b->y = ey - c1->y;
+            b->z = (ez - c1->z) * scz;
+            b->w = ew;
+        } END_MAP_FOR_EACH;
+    }
+}
+
+
+// Turn the clipboard's blocks by a quarter turn clockwise (seen from above)
+// a number of times
+// Arguments:
+// - turns: number of quarter turns (negative turns counter-clockwise)
+// Returns: none
+void
+rotate_clipboard(
+        Model *g,
+        int turns)
+{
+    Clipboard *clipboard = &g->clipboard;
+    turns = ((turns % 4) + 4) % 4;
+    for (int t = 0; t < turns; t++) {
+        for (int i = 0; i < clipboard->count; i++) {
+            Block *b = clipboard->blocks + i;
+            int x = b->x;
+            b->x = clipboard->depth - 1 - b->z;
+            b->z = x;
+        }
+        int width = clipboard->width;
+        clipboard->width = clipboard->depth;
+        clipboard->depth = width;
+    }
+}
+
+
+// Mirror the clipboard's blocks along the x or z axis
+// Arguments:
+// - mx: flag: reverse the x offsets
+// - mz: flag: reverse the z offsets
+// Returns: none
+void
+mirror_clipboard(
+        Model *g,
+        int mx,
+        int mz)
+{
+    Clipboard *clipboard = &g->clipboard;
+    for (int i = 0; i < clipboard->count; i++) {
+        Block *b = clipboard->blocks + i;
+        if (mx) {
+            b->x = clipboard->width - 1 - b->x;
+        }
+        if (mz) {
+            b->z = clipboard->depth - 1 - b->z;
+        }
+    }
 }
 
 
-// Player pastes structure
+// Player pastes the clipboard, with the corner it was copied from at the
+// older of the last two blocks they changed, and the offsets growing towards
+// the newer one. Only the copied blocks are placed, in one edit transaction.
+// Arguments: none
+// Returns: none
 void
 paste(
         Model *g) 
 {
-    Block *c1 = &g->copy1;
-    Block *c2 = &g->copy0;
     Block *p1 = &g->block1;
     Block *p2 = &g->block0;
-    int scx = SIGN(c2->x - c1->x);
-    int scz = SIGN(c2->z - c1->z);
-    int spx = SIGN(p2->x - p1->x);
-    int spz = SIGN(p2->z - p1->z);
-    int oy = p1->y - c1->y;
-    int dx = ABS(c2->x - c1->x);
-    int dz = ABS(c2->z - c1->z);
-    for (int y = 0; y < 256; y++) {
-        for (int x = 0; x <= dx; x++) {
-            for (int z = 0; z <= dz; z++) {
-                int w = get_block(g, c1->x + x * scx, y, c1->z + z * scz);
-                builder_block(g, p1->x + x * spx, y + oy, p1->z + z * spz, w);
-            }
-        }
-    }
+    Clipboard *clipboard = &g->clipboard;
+    int spx = p2->x < p1->x ? -1 : 1;
+    int spz = p2->z < p1->z ? -1 : 1;
+    edit_begin(g);
+    for (int i = 0; i < clipboard->count; i++) {
+        Block *b = clipboard->blocks + i;
+        builder_block(g, p1->x + b->x * spx, p1->y + b->y,
+                p1->z + b->z * spz, b->w);
+    }
+    edit_commit(g);
 }
 
 // (Used as a chat command).
@@ -2692,6 +4645,7 @@ array(
     xc = dx ? xc : 1;
     yc = dy ? yc : 1;
     zc = dz ? zc : 1;
+    edit_begin(g);
     for (int i = 0; i < xc; i++) {
         int x = b1->x + dx * i;
         for (int j = 0; j < yc; j++) {
@@ -2702,6 +4656,7 @@ array(
             }
         }
     }
+    edit_commit(g);
 }
 
 // Place a cube made out of blocks (Used as a chat command).
@@ -2726,6 +4681,7 @@ cube(
     int y2 = MAX(b1->y, b2->y);
     int z2 = MAX(b1->z, b2->z);
     int a = (x1 == x2) + (y1 == y2) + (z1 == z2);
+    edit_begin(g);
     for (int x = x1; x <= x2; x++) {
         for (int y = y1; y <= y2; y++) {
             for (int z = z1; z <= z2; z++) {
@@ -2742,6 +4698,7 @@ cube(
             }
         }
     }
+    edit_commit(g);
 }
 
 
@@ -2778,6 +4735,7 @@ sphere(
     int cy = center->y;
     int cz = center->z;
     int w = center->w;
+    edit_begin(g);
     for (int x = cx - radius; x <= cx + radius; x++) {
         if (fx && x != cx) {
             continue;
@@ -2810,6 +4768,7 @@ sphere(
             }
         }
     }
+    edit_commit(g);
 }
 
 
@@ -2845,6 +4804,7 @@ cylinder(
         return;
     }
     Block block = {x1, y1, z1, w};
+    edit_begin(g);
     if (fx) {
         for (int x = x1; x <= x2; x++) {
             block.x = x;
@@ -2863,6 +4823,7 @@ cylinder(
             sphere(g, &block, radius, fill, 0, 0, 1);
         }
     }
+    edit_commit(g);
 }
 
 
@@ -2878,6 +4839,7 @@ tree(
     int bx = block->x;
     int by = block->y;
     int bz = block->z;
+    edit_begin(g);
     for (int y = by + 3; y < by + 8; y++) {
         for (int dx = -3; dx <= 3; dx++) {
             for (int dz = -3; dz <= 3; dz++) {
@@ -2892,6 +4854,7 @@ tree(
     for (int y = by; y < by + 7; y++) {
         builder_block(g, bx, y, bz, 5);
     }
+    edit_commit(g);
 }
 
 // Parse a player chat command
@@ -2901,8 +4864,12 @@ tree(
 // - /login <username>
 // - /online <address> <port>
 // - /offline [file]
+// - /compress
+// - /timings [file]
 // - /copy
 // - /paste
+// - /rotate [turns]
+// - /mirror <x|z>
 // - /tree
 // - /cylinder
 // - /fcylinder
@@ -2965,6 +4932,38 @@ parse_command(
         g->mode = MODE_OFFLINE;
         snprintf(g->db_path, MAX_PATH_LENGTH, "%s", DB_PATH);
     }
+    else if (strcmp(buffer, "/compress") == 0) {
+        // Toggle stream compression, reconnecting if currently online
+        g->compress = !g->compress;
+        add_message(g, g->compress ?
+                "Stream compression will be requested." :
+                "Stream compression is off.");
+        if (g->mode == MODE_ONLINE) {
+            g->mode_changed = 1;
+        }
+    }
+    else if (sscanf(buffer, "/timings %128s", filename) == 1) {
+        // Log per-frame timings to the given file
+        if (open_frame_log(g, filename)) {
+            add_message(g, "Logging frame timings.");
+        }
+        else {
+            add_message(g, "Could not open the frame log.");
+        }
+    }
+    else if (strcmp(buffer, "/timings") == 0) {
+        // Toggle logging per-frame timings to the default file
+        if (g->frame_log) {
+            close_frame_log(g);
+            add_message(g, "Stopped logging frame timings.");
+        }
+        else if (open_frame_log(g, FRAME_LOG_PATH)) {
+            add_message(g, "Logging frame timings to " FRAME_LOG_PATH ".");
+        }
+        else {
+            add_message(g, "Could not open the frame log.");
+        }
+    }
     else if (sscanf(buffer, "/view %d", &radius) == 1) {
         // Set view radius
         if (radius >= 1 && radius <= 24) {
@@ -2976,12 +4975,33 @@ parse_command(
             add_message(g, "Viewing distance must be between 1 and 24.");
         }
     }
+    else if (sscanf(buffer, "/lod %d", &radius) == 1) {
+        // Set the radius of the simplified distant terrain
+        if (radius >= 0 && radius <= 63) {
+            g->lod_radius = radius;
+        }
+        else {
+            add_message(g, "LOD distance must be between 0 and 63.");
+        }
+    }
     else if (strcmp(buffer, "/copy") == 0) {
         copy(g);
     }
     else if (strcmp(buffer, "/paste") == 0) {
         paste(g);
     }
+    else if (sscanf(buffer, "/rotate %d", &count) == 1) {
+        rotate_clipboard(g, count);
+    }
+    else if (strcmp(buffer, "/rotate") == 0) {
+        rotate_clipboard(g, 1);
+    }
+    else if (strcmp(buffer, "/mirror x") == 0) {
+        mirror_clipboard(g, 1, 0);
+    }
+    else if (strcmp(buffer, "/mirror z") == 0) {
+        mirror_clipboard(g, 0, 1);
+    }
     else if (strcmp(buffer, "/tree") == 0) {
         // Place tree
         tree(g, &g->block0);
@@ -3405,9 +5425,20 @@ handle_dynamic_collision(  // Returns whether there was a collision or not
     // Reset this flag because collision will set it if necessary.
     p->attrs.is_grounded = 0;
 
+    // Copy the blocks the sweeps below can touch once for the whole tick:
+    // the box's reach over dt, plus a margin for the covered face tests and
+    // the small moves of the collision response.
+    static BlockCache cache;
+    float rx = ex + ABS(s->vx * dt) + 2;
+    float ry = ey + ABS(s->vy * dt) + 2;
+    float rz = ez + ABS(s->vz * dt) + 2;
+    block_cache_fill(g, &cache,
+            floorf(bx - rx), floorf(by - ry), floorf(bz - rz),
+            ceilf(bx + rx), ceilf(by + ry), ceilf(bz + rz));
+
     // "t" = collision time relative to this frame (between 0.0 and 1.0)
     float t = box_sweep_world(
-            g, bx, by, bz, ex, ey, ez, s->vx * dt, s->vy * dt, s->vz * dt,
+            &cache, bx, by, bz, ex, ey, ez, s->vx * dt, s->vy * dt, s->vz * dt,
             &nx, &ny, &nz);
     if (0.0 <= t && t < 1.0) {
         // There was a collision
@@ -3419,7 +5450,7 @@ handle_dynamic_collision(  // Returns whether there was a collision or not
         float vx0 = s->vx, vy0 = s->vy, vz0 = s->vz; // save original velocity for damage calculation
         for (int i = 0; i < steps; i++) {
             t = box_sweep_world(
-                    g, bx, by, bz, ex, ey, ez, s->vx * ut, s->vy * ut, s->vz * ut,
+                    &cache, bx, by, bz, ex, ey, ez, s->vx * ut, s->vy * ut, s->vz * ut,
                     &nx, &ny, &nz);
             // Move up to the collision moment
             bx += s->vx * t * ut;
@@ -3517,6 +5548,162 @@ handle_movement(
     }
 }
 
+// Put the local player back at the position of the last simulation tick,
+// which was replaced by an interpolated one for drawing. If something else
+// moved the player since (a teleport, a position from the server), the new
+// position is kept and the interpolation starts over from it.
+// Arguments: none
+// Returns: none
+static void
+restore_tick_position(
+        Model *g)
+{
+    State *s = &g->players->state;
+    float *shown = g->tick_shown;
+    if (s->x == shown[0] && s->y == shown[1] && s->z == shown[2]) {
+        s->x = g->tick_to[0];
+        s->y = g->tick_to[1];
+        s->z = g->tick_to[2];
+        return;
+    }
+    g->tick_from[0] = g->tick_to[0] = s->x;
+    g->tick_from[1] = g->tick_to[1] = s->y;
+    g->tick_from[2] = g->tick_to[2] = s->z;
+}
+
+
+// Run one fixed-length simulation tick of the local player's movement
+// Arguments: none
+// Returns: none
+void
+tick_movement(
+        Model *g)
+{
+    State *s = &g->players->state;
+    restore_tick_position(g);
+    g->tick_from[0] = s->x;
+    g->tick_from[1] = s->y;
+    g->tick_from[2] = s->z;
+    handle_movement(g, 1.0 / TICK_RATE);
+    g->tick_to[0] = g->tick_shown[0] = s->x;
+    g->tick_to[1] = g->tick_shown[1] = s->y;
+    g->tick_to[2] = g->tick_shown[2] = s->z;
+}
+
+
+// Place the local player between its positions before and after the last
+// simulation tick, for drawing the current frame
+// Arguments:
+// - alpha: fraction of a tick that has passed since the last tick (0 to 1)
+// Returns: none
+void
+interpolate_movement(
+        Model *g,
+        float alpha)
+{
+    State *s = &g->players->state;
+    restore_tick_position(g);
+    float *from = g->tick_from;
+    float *to = g->tick_to;
+    s->x = g->tick_shown[0] = from[0] + (to[0] - from[0]) * alpha;
+    s->y = g->tick_shown[1] = from[1] + (to[1] - from[1]) * alpha;
+    s->z = g->tick_shown[2] = from[2] + (to[2] - from[2]) * alpha;
+}
+
+
+// Blocks that entities collide with in one update_entities(). The chunk of
+// the last block looked up is kept, since the blocks an entity sweeps past
+// are nearly always in one chunk.
+typedef struct {
+    Model *g;
+    Chunk *chunk;
+    int p;
+    int q;
+} EntityBlocks;
+
+
+// Block callback for entity collision. Blocks in chunks that are not loaded
+// are not known, so entities there stay put until their chunk arrives.
+static int
+entity_block(
+        int x,
+        int y,
+        int z,
+        void *arg)
+{
+    EntityBlocks *blocks = (EntityBlocks *)arg;
+    int p = chunked(x);
+    int q = chunked(z);
+    if (!blocks->chunk || blocks->p != p || blocks->q != q) {
+        blocks->chunk = find_chunk(blocks->g, p, q);
+        blocks->p = p;
+        blocks->q = q;
+    }
+    if (!blocks->chunk) {
+        return ENTITY_BLOCK_FROZEN;
+    }
+    return is_obstacle(map_get(&blocks->chunk->map, x, y, z)) ?
+        ENTITY_BLOCK_SOLID : ENTITY_BLOCK_OPEN;
+}
+
+
+// Pair callback for entity collision: push two overlapping entities apart
+// horizontally, along the axis they overlap least on. The push is a change
+// of velocity, so the next move still stops them at blocks.
+static void
+separate_entities(
+        int a,
+        int b,
+        void *arg)
+{
+    EntityList *list = (EntityList *)arg;
+    float dx = list->x[b] - list->x[a];
+    float dz = list->z[b] - list->z[a];
+    float ox = list->ex[a] + list->ex[b] - ABS(dx);
+    float oz = list->ez[a] + list->ez[b] - ABS(dz);
+    // Resolve the overlap over about two ticks
+    const float rate = TICK_RATE / 4.0;
+    if (ox < oz) {
+        float v = ox * rate * (dx < 0 ? -1 : 1);
+        list->vx[a] -= v;
+        list->vx[b] += v;
+    }
+    else {
+        float v = oz * rate * (dz < 0 ? -1 : 1);
+        list->vz[a] -= v;
+        list->vz[b] += v;
+    }
+}
+
+
+// Run one simulation step of the entities: gravity and resistance, movement
+// with block collision, and pushing overlapping entities apart. Entities that
+// fall out of the bottom of the world are removed.
+// Arguments:
+// - dt: delta time
+// Returns: none
+void
+update_entities(
+        Model *g,
+        float dt)
+{
+    EntityList *list = &g->entities;
+    if (!list->size) {
+        return;
+    }
+    entity_list_accelerate(list, &g->physics, dt);
+    EntityBlocks blocks = {g, NULL, 0, 0};
+    entity_list_move(list, dt, entity_block, &blocks);
+    for (int i = list->size - 1; i >= 0; i--) {
+        if (list->y[i] < 0) {
+            entity_list_remove(list, i);
+        }
+    }
+    entity_list_hash(list, 1);
+    entity_list_pairs(list, separate_entities, list);
+}
+
+
 // Parse response string from server
 // Arguments:
 // - buffer: the response string to parse
@@ -3588,7 +5775,6 @@ parse_buffer(
                 player = g->players + g->player_count;
                 g->player_count++;
                 player->id = pid;
-                player->buffer = 0;
                 snprintf(player->name, MAX_NAME_LENGTH, "player%d", pid);
                 update_player(player, px, py, pz, prx, pry, 1); // twice
             }
@@ -3651,6 +5837,74 @@ parse_buffer(
 }
 
 
+// Start logging per-frame timings to a CSV file.
+// Any log already open is closed first.
+// Arguments:
+// - path: file to write (truncated)
+// Returns:
+// - non-zero if the file was opened
+int
+open_frame_log(
+        Model *g,
+        const char *path)
+{
+    close_frame_log(g);
+    g->frame_log = fopen(path, "w");
+    if (!g->frame_log) {
+        return 0;
+    }
+    fprintf(g->frame_log,
+            "frame,time,dt,ticks,tick_ms,recv_ms,parse_ms,workers_ms,bytes\n");
+    return 1;
+}
+
+
+// Stop logging per-frame timings.
+// Arguments: none
+// Returns: none
+void
+close_frame_log(
+        Model *g)
+{
+    if (g->frame_log) {
+        fclose(g->frame_log);
+        g->frame_log = NULL;
+    }
+}
+
+
+// Write one frame's timings to the frame log, if one is open, and reset the
+// simulation tick and check_workers() times for the next frame.
+// Arguments:
+// - frame: frame number
+// - now: perf_time() at the start of the frame
+// - dt: seconds since the previous frame
+// - recv_time: seconds spent in client_recv() (part of the tick time)
+// - parse_time: seconds spent in parse_buffer() (part of the tick time)
+// - bytes: length of the data received from the server this frame
+// Returns: none
+void
+log_frame(
+        Model *g,
+        int frame,
+        double now,
+        double dt,
+        double recv_time,
+        double parse_time,
+        int bytes)
+{
+    if (g->frame_log) {
+        fprintf(g->frame_log, "%d,%.6f,%.3f,%d,%.3f,%.3f,%.3f,%.3f,%d\n",
+                frame, now, dt * 1000, g->tick_count, g->tick_time * 1000,
+                recv_time * 1000, parse_time * 1000,
+                g->workers_time * 1000, bytes);
+    }
+    g->workers_time = 0;
+    g->tick_time = 0;
+    g->tick_count = 0;
+}
+
+
 static void set_default_physics(
         PhysicsConfig *p)
 {
@@ -3683,8 +5937,11 @@ reset_model(
 {
     memset(g->chunks, 0, sizeof(Chunk) * MAX_CHUNKS);
     g->chunk_count = 0;
+    g->chunk_requests = 0;
     memset(g->players, 0, sizeof(Player) * MAX_PLAYERS);
     g->player_count = 0;
+    g->entities.size = 0;
+    g->block_update_count = 0;
     g->observe1 = 0;
     g->observe2 = 0;
     g->item_index = 0;
@@ -3704,13 +5961,14 @@ reset_model(
 // Get whether a certain block face is covered or exposed.
 // A face is exposed unless an obstacle block is in front of it.
 // Arguments:
+// - cache: blocks around the face
 // - x, y, z: block to check
 // - nx, ny, nz: normal of the block's face to check
 // Returns:
 // - non-zero if the given block face is covered
 int
 is_block_face_covered(
-        Model *g,
+        const BlockCache *cache,
         int x,
         int y,
         int z,
@@ -3719,19 +5977,21 @@ is_block_face_covered(
         float nz)
 {
     assert(nx != 0.0 || ny != 0.0 || nz != 0.0);
-    int w = get_block(g, roundf(x + nx), roundf(y + ny), roundf(z + nz));
+    int w = block_cache_get(
+            cache, roundf(x + nx), roundf(y + ny), roundf(z + nz));
     return is_obstacle(w);
 }
 
 
 // Return whether a bounding box currently intersects a block in the world.
 // Arguments:
+// - cache: blocks around the box
 // - x, y, z: box center position
 // - ex, ey, ez: box extents
 // Returns: intersected block location through cx, cy, cz
 int
 box_intersect_world(
-        Model *g,
+        const BlockCache *cache,
         float x,
         float y,
         float z,
@@ -3750,7 +6010,7 @@ box_intersect_world(
     for (int bx = x0; bx <= x1; bx++) {
         for (int by = y0; by <= y1; by++) {
             for (int bz = z0; bz <= z1; bz++) {
-                int w = get_block(g, bx, by, bz);
+                int w = block_cache_get(cache, bx, by, bz);
                 if (!is_obstacle(w)) {
                     continue;
                 }
@@ -3779,12 +6039,14 @@ box_intersect_world(
 
 // Sweep moving bounding box with all nearby blocks in the world. Returns the
 // info for the earliest intersection time.
+// The cache must hold the blocks around the swept box, one block further than
+// its broad-phase box in every direction.
 // Returns:
 // - earliest collision time, between 0.0 and 1.0
 // - writes values out to nx, ny, and nz
 float
 box_sweep_world(
-        Model *g,
+        const BlockCache *cache, // blocks around the swept box
         float x,        // box center x
         float y,        // box center y
         float z,        // box center z
@@ -3826,7 +6088,7 @@ box_sweep_world(
                 // Skip the current block
                 if (bx == cx && by == cy && bz == cz) { continue; }
                 // Only collide with obstacle blocks
-                int w = get_block(g, bx, by, bz);
+                int w = block_cache_get(cache, bx, by, bz);
                 if (!is_obstacle(w)) { continue; }
                 // Box must intersect the broad-phase bounding box
                 if (!box_intersect_block(bbx, bby, bbz, bbex, bbey, bbez, bx, by, bz)) {
@@ -3844,7 +6106,7 @@ box_sweep_world(
                 // Can only collide with an exposed block face or a face covered
                 // by the current block the player is in
                 if (!((bx + snx == cx) && (by + sny == cy) && (bz + sny == cz))
-                        && is_block_face_covered(g, bx, by, bz, snx, sny, snz))
+                        && is_block_face_covered(cache, bx, by, bz, snx, sny, snz))
                 {
                     continue;
                 }
@@ -3892,5 +6154,5 @@ set_matrix_3d_player_camera(  // Everything except the player pointer is output
             p->state.ry,
             g->fov,
             g->ortho,
-            g->render_radius);
+            view_radius(g));
 }
@@ -2,6 +2,7 @@
 #define _game_h_
 
 
+#include "BlockCache.h"
 #include "GameModel.h"
 #include "config.h"
 #include "cube.h"
@@ -35,6 +36,9 @@ enum {
 // - position:
 // - normal:
 // - uv:
+// - head: (player shader) flag for head vertices of the player model
+// - offset: (player shader) player position instance attribute
+// - rotation: (player shader) player rotation instance attribute
 // - matrix:
 // - sampler:
 // - camera:
@@ -48,6 +52,9 @@ typedef struct {
     GLuint position;
     GLuint normal;
     GLuint uv;
+    GLuint head;
+    GLuint offset;
+    GLuint rotation;
     GLuint matrix;
     GLuint sampler;
     GLuint camera;
@@ -78,21 +85,6 @@ _gen_sign_buffer(
         int face,
         const char *text);
 
-int
-_hit_test(
-        Map *map,
-        float max_distance,
-        int previous,
-        float x,
-        float y,
-        float z,
-        float vx,
-        float vy,
-        float vz,
-        int *hx,
-        int *hy,
-        int *hz);
-
 void
 _set_block(
         Model *g,
@@ -138,9 +130,27 @@ array(
         int yc,
         int zc);
 
+void
+block_cache_fill(
+        Model *g,
+        BlockCache *cache,
+        int x0,
+        int y0,
+        int z0,
+        int x1,
+        int y1,
+        int z1);
+
+int
+block_cache_get(
+        const BlockCache *cache,
+        int x,
+        int y,
+        int z);
+
 int
 box_intersect_world(
-        Model *g,
+        const BlockCache *cache,
         float x,
         float y,
         float z,
@@ -153,7 +163,7 @@ box_intersect_world(
 
 float
 box_sweep_world(
-        Model *g,
+        const BlockCache *cache,
         float x,
         float y,
         float z,
@@ -211,6 +221,14 @@ void
 compute_chunk(
         WorkerItem *item);
 
+void
+compute_lod_chunk(
+        WorkerItem *item);
+
+void
+close_frame_log(
+        Model *g);
+
 void
 copy(
         Model *g);
@@ -260,25 +278,25 @@ dirty_chunk(
         Chunk *chunk);
 
 void
-draw_chunk(
+draw_chunks(
         Attrib *attrib,
-        Chunk *chunk);
+        Arena *arena,
+        Chunk **chunks,
+        int *sections,
+        int *groups,
+        int count);
 
 void
 draw_cube(
-        Attrib *attrib,
-        GLuint buffer);
-
-void
-draw_cube_offset(
         Attrib *attrib,
         GLuint buffer,
-        int offset);
+        int first);
 
 void
 draw_item(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int count);
 
 void
@@ -286,22 +304,35 @@ draw_lines(
         Attrib *attrib,
         GLuint buffer,
         int components,
+        int first,
+        int count);
+
+void
+draw_lod_chunks(
+        Attrib *attrib,
+        Arena *arena,
+        LodChunk **lods,
         int count);
 
 void
 draw_plant(
         Attrib *attrib,
-        GLuint buffer);
+        GLuint buffer,
+        int first);
 
 void
-draw_player(
+draw_players(
         Attrib *attrib,
-        Player *player);
+        GLuint buffer,
+        Transient *transient,
+        const GLfloat *data,
+        int count);
 
 void
 draw_sign(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int length);
 
 void
@@ -313,12 +344,14 @@ void
 draw_text(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int length);
 
 void
 draw_triangles_2d(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int count);
 
 void
@@ -331,23 +364,55 @@ void
 draw_triangles_3d_ao(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int count);
 
 void
 draw_triangles_3d_text(
         Attrib *attrib,
         GLuint buffer,
+        int first,
         int count);
 
+void
+edit_begin(
+        Model *g);
+
+void
+edit_block(
+        Model *g,
+        int x,
+        int y,
+        int z,
+        int w);
+
+void
+edit_commit(
+        Model *g);
+
+int
+edit_get_block(
+        Model *g,
+        int x,
+        int y,
+        int z);
+
 void
 ensure_chunks(
         Model *g,
         Player *player);
 
-void
+int
 ensure_chunks_worker(
         Model *g,
-        Player *player,
+        Worker *worker);
+
+void
+ensure_lod_chunks(
+        Model *g);
+
+void
+ensure_lod_worker(
         Worker *worker);
 
 Chunk *
@@ -377,24 +442,6 @@ gen_chunk_buffer(
         Model *g,
         Chunk *chunk);
 
-GLuint
-gen_crosshair_buffer();
-
-GLuint
-gen_cube_buffer(
-        float x,
-        float y,
-        float z,
-        float n,
-        int w);
-
-GLuint
-gen_plant_buffer(
-        float x,
-        float y,
-        float z,
-        float n,
-        int w);
 
 void
 gen_sign_buffer(
@@ -403,25 +450,17 @@ gen_sign_buffer(
 GLuint
 gen_sky_buffer();
 
-GLuint
-gen_text_buffer(
-        float x,
-        float y,
-        float n,
-        char *text);
-
-GLuint
-gen_wireframe_buffer(
-        float x,
-        float y,
-        float z,
-        float n);
-
 void
 generate_chunk(
+        Model *g,
         Chunk *chunk,
         WorkerItem *item);
 
+void
+generate_lod_chunk(
+        Model *g,
+        WorkerItem *item);
+
 int
 get_block(
         Model *g,
@@ -513,6 +552,23 @@ hit_test_face(
         int *z,
         int *face);
 
+int
+hit_test_ray(
+        Model *g,
+        float max_distance,
+        float x,
+        float y,
+        float z,
+        float vx,
+        float vy,
+        float vz,
+        int *hx,
+        int *hy,
+        int *hz,
+        int *px,
+        int *py,
+        int *pz);
+
 void
 init_chunk(
         Model *g,
@@ -520,9 +576,14 @@ init_chunk(
         int p,
         int q);
 
+void
+interpolate_movement(
+        Model *g,
+        float alpha);
+
 int
 is_block_face_covered(
-        Model *g,
+        const BlockCache *cache,
         int x,
         int y,
         int z,
@@ -547,6 +608,34 @@ load_chunk(
 void
 login();
 
+void
+log_frame(
+        Model *g,
+        int frame,
+        double now,
+        double dt,
+        double recv_time,
+        double parse_time,
+        int bytes);
+
+void
+make_item_cube(
+        GLfloat *data,
+        float x,
+        float y,
+        float z,
+        float n,
+        int w);
+
+void
+make_item_plant(
+        GLfloat *data,
+        float x,
+        float y,
+        float z,
+        float n,
+        int w);
+
 void
 map_set_func(
         int x,
@@ -555,6 +644,12 @@ map_set_func(
         int w,
         void *arg);
 
+void
+mirror_clipboard(
+        Model *g,
+        int mx,
+        int mz);
+
 void
 occlusion(
         char neighbors[27],
@@ -578,6 +673,11 @@ on_middle_click(
 void
 on_right_click();
 
+int
+open_frame_log(
+        Model *g,
+        const char *path);
+
 void
 parse_buffer(
         Model *g,
@@ -641,7 +741,7 @@ int
 render_chunks(
         Model *g,
         Attrib *attrib,
-        Player *player);
+        Visibility *v);
 
 void
 render_crosshairs(
@@ -657,7 +757,8 @@ void
 render_players(
         Model *g,
         Attrib *attrib,
-        Player *player);
+        Visibility *v,
+        GLuint buffer);
 
 void
 render_players_hitboxes(
@@ -675,7 +776,7 @@ void
 render_signs(
         Model *g,
         Attrib *attrib,
-        Player *player);
+        Visibility *v);
 
 void
 render_sky(
@@ -687,13 +788,17 @@ render_sky(
 void
 render_text(
         Model *g,
-        Attrib *attrib,
         int justify,
         float x,
         float y,
         float n,
         char *text);
 
+void
+render_text_batch(
+        Model *g,
+        Attrib *attrib);
+
 void
 render_wireframe(
         Model *g,
@@ -702,13 +807,31 @@ render_wireframe(
 
 void
 request_chunk(
-        int p,
-        int q);
+        Model *g,
+        Chunk *chunk);
 
 void
 reset_model(
         Model *g);
 
+void
+rotate_clipboard(
+        Model *g,
+        int turns);
+
+void
+schedule_block_update(
+        Model *g,
+        int x,
+        int y,
+        int z,
+        int delay);
+
+void
+send_chunk_requests(
+        Model *g,
+        Player *player);
+
 void
 set_block(
         Model *g,
@@ -751,6 +874,10 @@ sphere(
         int fy,
         int fz);
 
+void
+tick_movement(
+        Model *g);
+
 float
 time_of_day(
         Model *g);
@@ -782,6 +909,21 @@ unset_sign_face(
         int z,
         int face);
 
+void
+update_blocks(
+        Model *g);
+
+void
+update_entities(
+        Model *g,
+        float dt);
+
+void
+update_visibility(
+        Model *g,
+        Visibility *v,
+        Player *player);
+
 int
 worker_run(
         void *arg);
@@ -150,6 +150,16 @@ int is_destructable(int w) {
     }
 }
 
+// Predicate function for whether a block id falls when there is nothing under
+// it (sand)
+// Arguments:
+// - w: block id (block type)
+// Returns:
+// - boolean whether block type falls
+int is_falling(int w) {
+    return w == SAND;
+}
+
 
 // Return the minimum amount of damage that is required in order to
 // change the block's damage value.
@@ -61,6 +61,9 @@ int is_transparent(
 int is_destructable(
         int w);
 
+int is_falling(
+        int w);
+
 int block_get_max_damage(
         int w);
 
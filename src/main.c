@@ -288,6 +288,9 @@ main(
     glfwSetScrollCallback(game->window, on_scroll);
 
     if (glewInit() != GLEW_OK) { return -1; }
+    arena_init(&game->chunk_arena, 10, CHUNK_ARENA_SIZE);
+    transient_init(&game->transient, TRANSIENT_SIZE);
+    entity_list_alloc(&game->entities, 64);
 
     // Initialize some OpenGL settings
     glEnable(GL_CULL_FACE);
@@ -335,6 +338,7 @@ main(
     Attrib line_attrib = {0};
     Attrib text_attrib = {0};
     Attrib sky_attrib = {0};
+    Attrib player_attrib = {0};
     GLuint program;
 
     program = load_program(
@@ -377,6 +381,24 @@ main(
     sky_attrib.sampler  = glGetUniformLocation(program, "sampler");
     sky_attrib.timer    = glGetUniformLocation(program, "timer");
 
+    program = load_program(
+        "shaders/player_vertex.glsl", "shaders/block_fragment.glsl");
+    player_attrib.program  = program;
+    player_attrib.position = glGetAttribLocation(program, "position");
+    player_attrib.normal   = glGetAttribLocation(program, "normal");
+    player_attrib.uv       = glGetAttribLocation(program, "uv");
+    player_attrib.head     = glGetAttribLocation(program, "head");
+    player_attrib.offset   = glGetAttribLocation(program, "offset");
+    player_attrib.rotation = glGetAttribLocation(program, "rotation");
+    player_attrib.matrix   = glGetUniformLocation(program, "matrix");
+    player_attrib.sampler  = glGetUniformLocation(program, "sampler");
+    player_attrib.extra1   = glGetUniformLocation(program, "sky_sampler");
+    player_attrib.extra2   = glGetUniformLocation(program, "daylight");
+    player_attrib.extra3   = glGetUniformLocation(program, "fog_distance");
+    player_attrib.extra4   = glGetUniformLocation(program, "ortho");
+    player_attrib.camera   = glGetUniformLocation(program, "camera");
+    player_attrib.timer    = glGetUniformLocation(program, "timer");
+
     // CHECK COMMAND LINE ARGUMENTS //
     if (argc == 2 || argc == 3) {
         game->mode = MODE_ONLINE;
@@ -393,8 +415,13 @@ main(
     // Configure game radius settings
     game->create_radius = CREATE_CHUNK_RADIUS;
     game->render_radius = RENDER_CHUNK_RADIUS;
+    game->lod_radius = LOD_CHUNK_RADIUS;
     game->delete_radius = DELETE_CHUNK_RADIUS;
     game->sign_radius = RENDER_SIGN_RADIUS;
+    game->compress = USE_COMPRESSION;
+    if (LOG_FRAME_TIMES) {
+        open_frame_log(game, FRAME_LOG_PATH);
+    }
 
     // INITIALIZE WORKER THREADS
     for (int i = 0; i < WORKERS; i++) {
@@ -433,7 +460,11 @@ main(
             client_connect(game->server_addr, game->server_port);
             client_start();
             client_version(1);
+            if (game->compress) {
+                client_compress();
+            }
             login();
+            client_flush();
         }
 
         // LOCAL VARIABLES //
@@ -442,6 +473,7 @@ main(
         double last_commit = glfwGetTime();
         double last_update = glfwGetTime();
         GLuint sky_buffer = gen_sky_buffer();
+        GLuint player_buffer = gen_player_model_buffer();
 
         // Init local player
         Player *me = game->players;
@@ -449,7 +481,6 @@ main(
         memset(me, 0, sizeof(*me));
         me->id = 0;
         me->name[0] = '\0';
-        me->buffer = 0;
         me->attrs.attack_damage = 1;
         me->attrs.reach = 8;
         game->player_count = 1;
@@ -465,7 +496,11 @@ main(
 
         // BEGIN MAIN LOOP //
         double previous = glfwGetTime();
+        double frame_previous = perf_time();
+        double lag = 0;
+        int frame = 0;
         while (1) {
+            double frame_start = perf_time();
             // WINDOW SIZE AND SCALE //
             game->scale = get_scale_factor(game);
             glfwGetFramebufferSize(game->window, &game->width, &game->height);
@@ -488,55 +523,91 @@ main(
             // HANDLE MOUSE INPUT //
             handle_mouse_input(game);
 
-            // HANDLE MOVEMENT //
-            handle_movement(game, dt);
+            // SIMULATION TICKS //
+            // Movement, server data and database commits advance in fixed
+            // steps of 1 / TICK_RATE seconds, as many as the time since the
+            // last frame holds; the remainder carries over to the next frame
+            // and places the local player between the last two ticks.
+            double recv_time = 0;
+            double parse_time = 0;
+            int bytes = 0;
+            double tick_start = perf_time();
+            lag += dt;
+            while (lag >= 1.0 / TICK_RATE) {
+                lag -= 1.0 / TICK_RATE;
+                game->tick_count++;
+
+                // HANDLE MOVEMENT //
+                tick_movement(game);
+                update_entities(game, 1.0 / TICK_RATE);
+                update_blocks(game);
+
+                // HANDLE DATA FROM SERVER //
+                double recv_start = perf_time();
+                char *buffer = client_recv();
+                recv_time += perf_time() - recv_start;
+                if (buffer) {
+                    bytes += strlen(buffer);
+                    double parse_start = perf_time();
+                    parse_buffer(game, buffer);
+                    parse_time += perf_time() - parse_start;
+                    free(buffer);
+                }
 
-            // HANDLE DATA FROM SERVER //
-            char *buffer = client_recv();
-            if (buffer) {
-                parse_buffer(game, buffer);
-                free(buffer);
-            }
+                // FLUSH DATABASE //
+                if (now - last_commit > COMMIT_INTERVAL) {
+                    last_commit = now;
+                    db_commit();
+                }
 
-            // FLUSH DATABASE //
-            if (now - last_commit > COMMIT_INTERVAL) {
-                last_commit = now;
-                db_commit();
-            }
+                // SEND POSITION TO SERVER //
+                if (now - last_update > 0.1) {
+                    last_update = now;
+                    client_position(s->x, s->y, s->z, s->rx, s->ry);
+                }
 
-            // SEND POSITION TO SERVER //
-            if (now - last_update > 0.1) {
-                last_update = now;
-                client_position(s->x, s->y, s->z, s->rx, s->ry);
+                // FLUSH MESSAGES TO SERVER //
+                // Everything sent during this tick goes out in one write.
+                client_flush();
             }
+            interpolate_movement(game, lag * TICK_RATE);
+            game->tick_time += perf_time() - tick_start;
 
             // PREPARE TO RENDER //
             game->observe1 = game->observe1 % game->player_count;
             game->observe2 = game->observe2 % game->player_count;
             delete_chunks(game);
-            del_buffer(me->buffer);
-            me->buffer = gen_player_buffer(
-                    s->x, s->y, s->z, s->rx, s->ry, s->brx);
             for (int i = 1; i < game->player_count; i++) {
                 interpolate_player(game->players + i);
             }
             Player *player = game->players + game->observe1;
 
+            // SET UP THE MAIN VIEW AND LOAD CHUNKS //
+            // Chunk work is scheduled once per frame; the views drawn below
+            // only use what their update_visibility() found.
+            ensure_chunks(game, player);
+            Visibility *view = &game->visibility;
+
             // RENDER 3-D SCENE //
             glClear(GL_COLOR_BUFFER_BIT);
             glClear(GL_DEPTH_BUFFER_BIT);
             render_sky(game, &sky_attrib, player, sky_buffer);
             glClear(GL_DEPTH_BUFFER_BIT);
             // Get the face count while rendering for displaying the number on screen
-            int face_count = render_chunks(game, &block_attrib, player);
-            render_signs(game, &text_attrib, player);
+            int face_count = render_chunks(game, &block_attrib, view);
+            render_signs(game, &text_attrib, view);
             render_sign(game, &text_attrib, player);
-            render_players(game, &block_attrib, player);
+            render_players(game, &player_attrib, view, player_buffer);
             if (SHOW_WIREFRAME) {
                 render_wireframe(game, &line_attrib, player);
                 render_players_hitboxes(game, &line_attrib, player);
             }
 
+            // The check_workers() time is known once the chunks are rendered
+            log_frame(game, frame++, frame_start,
+                    frame_start - frame_previous, recv_time, parse_time, bytes);
+            frame_previous = frame_start;
+
             // RENDER HUD //
             glClear(GL_DEPTH_BUFFER_BIT);
             if (SHOW_CROSSHAIRS) {
@@ -560,13 +631,36 @@ main(
                 hour = hour ? hour : 12;
                 snprintf(
                     text_buffer, 1024,
-                    "(%d, %d) (%.2f, %.2f, %.2f) [%d, %d, %d] %d%cm %dfps v:<%.2f, %.2f, %.2f>",
+                    "(%d, %d) (%.2f, %.2f, %.2f) [%d, %d, %d, culled %d] %d%cm %dfps v:<%.2f, %.2f, %.2f>",
                     chunked(s->x), chunked(s->z), s->x, s->y, s->z,
                     game->player_count, game->chunk_count,
-                    face_count * 2, hour, am_pm, fps.fps,
+                    face_count * 2, game->culled_faces * 2, hour, am_pm, fps.fps,
                     s->vx, s->vy, s->vz);
-                render_text(game, &text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                render_text(game, ALIGN_LEFT, tx, ty, ts, text_buffer);
                 ty -= ts * 2;
+                if (get_client_enabled()) {
+                    int sent, received, writes, max_queued;
+                    get_client_stats(&sent, &received, &writes, &max_queued);
+                    snprintf(
+                        text_buffer, 1024,
+                        "net: sent %d recv %d writes %d queued %d (max %d)",
+                        sent, received, writes,
+                        get_client_send_queue_size(), max_queued);
+                    render_text(game, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                    ty -= ts * 2;
+                }
+                if (get_client_compressed()) {
+                    int raw_sent, wire_sent, raw_received, wire_received;
+                    get_client_compression_stats(
+                        &raw_sent, &wire_sent, &raw_received, &wire_received);
+                    snprintf(
+                        text_buffer, 1024,
+                        "compression: up %.2fx down %.2fx",
+                        (float)raw_sent / MAX(wire_sent, 1),
+                        (float)raw_received / MAX(wire_received, 1));
+                    render_text(game, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                    ty -= ts * 2;
+                }
             }
 
             /* Health debug text
@@ -574,7 +668,7 @@ main(
                 snprintf(text_buffer, sizeof(text_buffer),
                         "damage: %d",
                         me->attrs.taken_damage);
-                render_text(game, &text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                render_text(game, ALIGN_LEFT, tx, ty, ts, text_buffer);
                 ty -= ts * 2;
             }
             */
@@ -584,7 +678,7 @@ main(
                 for (int i = 0; i < MAX_MESSAGES; i++) {
                     int index = (game->message_index + i) % MAX_MESSAGES;
                     if (strlen(game->messages[index])) {
-                        render_text(game, &text_attrib, ALIGN_LEFT, tx, ty, ts,
+                        render_text(game, ALIGN_LEFT, tx, ty, ts,
                                 game->messages[index]);
                         ty -= ts * 2;
                     }
@@ -593,18 +687,18 @@ main(
             // Current typing text
             if (game->typing) {
                 snprintf(text_buffer, 1024, "> %s", game->typing_buffer);
-                render_text(game, &text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                render_text(game, ALIGN_LEFT, tx, ty, ts, text_buffer);
                 ty -= ts * 2;
             }
 
             if (SHOW_PLAYER_NAMES) {
                 if (player != me) {
-                    render_text(game, &text_attrib, ALIGN_CENTER,
+                    render_text(game, ALIGN_CENTER,
                         game->width / 2, ts, ts, player->name);
                 }
                 Player *other = player_crosshair(game, player);
                 if (other) {
-                    render_text(game, &text_attrib, ALIGN_CENTER,
+                    render_text(game, ALIGN_CENTER,
                             game->width / 2, game->height / 2 - ts - 24, ts,
                             other->name);
                 }
@@ -620,12 +714,59 @@ main(
                     int damage = get_block_damage(game, hx, hy, hz);
                     if (damage) {
                         snprintf(text_buffer, 1024, "block: %d, damage: %d", hw, damage);
-                        render_text(game, &text_attrib, ALIGN_LEFT, tx, ty, ts, text_buffer);
+                        render_text(game, ALIGN_LEFT, tx, ty, ts, text_buffer);
                     }
                 }
             }
             */
 
+            // RENDER PICTURE IN PICTURE //
+            if (game->observe2) {
+                Player *other = game->players + game->observe2;
+                Visibility *inset = &game->inset_visibility;
+                int width = game->width;
+                int height = game->height;
+                int ortho = game->ortho;
+                float fov = game->fov;
+                int pw = 256 * game->scale;
+                int ph = 256 * game->scale;
+                int offset = 32 * game->scale;
+                int pad = 3 * game->scale;
+                int sw = pw + pad * 2;
+                int sh = ph + pad * 2;
+
+                glEnable(GL_SCISSOR_TEST);
+                glScissor(width - sw - offset + pad, offset - pad, sw, sh);
+                glClear(GL_COLOR_BUFFER_BIT);
+                glDisable(GL_SCISSOR_TEST);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                glViewport(width - pw - offset, offset, pw, ph);
+
+                game->width = pw;
+                game->height = ph;
+                game->ortho = 0;
+                game->fov = 65;
+                update_visibility(game, inset, other);
+
+                render_sky(game, &sky_attrib, other, sky_buffer);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                render_chunks(game, &block_attrib, inset);
+                render_signs(game, &text_attrib, inset);
+                render_players(game, &player_attrib, inset, player_buffer);
+
+                game->width = width;
+                game->height = height;
+                game->ortho = ortho;
+                game->fov = fov;
+                glViewport(0, 0, width, height);
+                if (SHOW_PLAYER_NAMES) {
+                    render_text(game, ALIGN_CENTER,
+                        width - offset - pw / 2, offset + ts, ts, other->name);
+                }
+            }
+
+            render_text_batch(game, &text_attrib);
+
             // SWAP AND POLL //
             glfwSwapBuffers(game->window);
             glfwPollEvents();
@@ -652,11 +793,19 @@ main(
         client_stop();
         client_disable();
         del_buffer(sky_buffer);
+        del_buffer(player_buffer);
         delete_all_chunks(game);
         delete_all_players(game);
     }
 
     // Final program closing
+    close_frame_log(game);
+    arena_free(&game->chunk_arena);
+    transient_free(&game->transient);
+    entity_list_free(&game->entities);
+    free(game->block_updates);
+    free(game->clipboard.blocks);
+    free(game->text_data);
     glfwTerminate();
     curl_global_cleanup();
     return 0;
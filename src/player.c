@@ -8,6 +8,7 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 
@@ -78,27 +79,29 @@ void update_player(
     else {
         State *s = &player->state;
         s->x = x; s->y = y; s->z = z; s->rx = rx; s->ry = ry;
-        del_buffer(player->buffer);
-        player->buffer = gen_player_buffer(
-                s->x, s->y, s->z, s->rx, s->ry, s->brx);
     }
 }
 
 
-// Create buffer for player model
+// Create the buffer of the player model that every player is drawn from.
+// The model stands at the origin without any rotation; it is moved and turned
+// for each player by the player shader. Each vertex has the 10 components of
+// make_player() and a flag that is 1 for head vertices, which turn with the
+// head rotation instead of the body rotation.
 GLuint 
-gen_player_buffer(  // returns OpenGL buffer handle
-        float x,           // player x
-        float y,           // player y
-        float z,           // player z
-        float rx,          // player rotation x
-        float ry,          // player rotation y
-        float brx)         // player body rotation x
+gen_player_model_buffer()  // returns OpenGL buffer handle
 {
     const unsigned faces = 6 * 6;  // 6 limbs, 6 faces each
-    GLfloat *data = malloc_faces(10, faces);
-    make_player(data, x, y, z, rx, ry, brx);
-    return gen_faces(10, faces, data);
+    const unsigned head_faces = 6;
+    GLfloat *model = malloc_faces(10, faces);
+    make_player(model, 0, 0, 0, 0, 0, 0);
+    GLfloat *data = malloc_faces(11, faces);
+    for (unsigned i = 0; i < faces * 6; i++) {
+        memcpy(data + i * 11, model + i * 10, sizeof(GLfloat) * 10);
+        data[i * 11 + 10] = i < head_faces * 6;
+    }
+    free(model);
+    return gen_faces(11, faces, data);
 }
 
 
@@ -63,14 +63,12 @@ typedef struct {
 // - state: current player position state
 // - state1: another state, for interpolation
 // - state2: another state, for interpolation
-// - buffer: some GL buffer id (?)
 typedef struct {
     int id;
     char name[MAX_NAME_LENGTH];
     State state;
     State state1;
     State state2;
-    GLuint buffer;
     PlayerAttributes attrs;
 } Player;
 
@@ -80,13 +78,7 @@ void player_hitbox_extent(
         float *ey,
         float *ez);
 
-GLuint gen_player_buffer(
-        float x,
-        float y,
-        float z,
-        float rx,
-        float ry,
-        float brx);
+GLuint gen_player_model_buffer();
 
 void make_player(
         float *data,
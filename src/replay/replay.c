@@ -0,0 +1,601 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+#include "tools/tools.h"
+#include <arpa/inet.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// Scripted stand-in server for client benchmarks.
+// Plays a fixed script of server messages to each client that connects, so
+// the client's network and chunk-integration path can be measured with the
+// same inbound traffic every run. Whatever the client sends is read and
+// thrown away: chunk requests, edits and chat get no answers, and a request
+// for compression is ignored so the stream stays plain text.
+//
+// The script is either:
+// - synthetic: generated from a seed. The client is placed at the origin,
+//   then chunks around it arrive ring by ring (B, L, S, K and R lines) at a
+//   fixed rate while simulated players walk in circles (P) and blocks near
+//   the origin are placed and broken (B and R).
+// - a file of protocol lines. A line "@SECONDS" gives the time the lines
+//   after it are due, counted from when the client connected. Lines starting
+//   with '#' and empty lines are skipped.
+//
+// Record mode makes such a file: the stand-in forwards a client to a real
+// server and writes what the server sends, with "@SECONDS" lines, to a file.
+
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT 4080
+#define TICK_MS 1
+#define RECV_SIZE 4096
+// Synthetic edits near the origin stay within this many blocks of it
+#define EDIT_RANGE 48
+#define PLAYER_RATE 10
+
+
+// Script line
+// - t: seconds after the client connected that the line is due
+// - offset: start of the line (including its newline) in the script text
+// - length: length of the line including its newline
+typedef struct {
+    double t;
+    int offset;
+    int length;
+} Line;
+
+// Script of server messages, ordered by time
+// - lines: the lines
+// - count: number of lines
+// - capacity: number of lines allocated
+// - text: the text of all lines
+typedef struct {
+    Line *lines;
+    int count;
+    int capacity;
+    Buffer text;
+} Script;
+
+// Settings
+// - host, port: address to listen on
+// - path: script file to replay, or NULL for a synthetic script
+// - record_path: file to record to (record mode), or NULL
+// - upstream_host, upstream_port: server to record from
+// - speed: playback speed multiplier (0 sends everything at once)
+// - line_rate: if non-zero, send this many lines per second instead of
+//   following the script's times
+// - seed: synthetic script seed
+// - duration: synthetic script length in seconds
+// - radius: synthetic chunk radius around the origin
+// - chunk_rate: synthetic chunks per second
+// - blocks: synthetic block rows per chunk
+// - players: synthetic players walking around
+// - edit_rate: synthetic edits per second
+typedef struct {
+    const char *host;
+    int port;
+    const char *path;
+    const char *record_path;
+    char upstream_host[256];
+    int upstream_port;
+    double speed;
+    double line_rate;
+    unsigned int seed;
+    double duration;
+    int radius;
+    double chunk_rate;
+    int blocks;
+    int players;
+    double edit_rate;
+} Options;
+
+
+static volatile sig_atomic_t running = 1;
+static unsigned int random_state = 1;
+
+
+// Get a pseudo-random number.
+// A generator of our own keeps synthetic scripts the same on every platform.
+// Arguments:
+// - n: number of possible values
+// Returns:
+// - integer from 0 to n - 1
+static int random_int(int n) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state % n;
+}
+
+
+// Add a line to a script
+// Arguments:
+// - script: script to add to
+// - t: time the line is due
+// - format, ...: the line, without its newline
+// Returns: none
+static void script_add(Script *script, double t, const char *format, ...) {
+    va_list args;
+    if (script->count == script->capacity) {
+        script->capacity = script->capacity ? script->capacity * 2 : 1024;
+        script->lines = realloc(script->lines,
+            sizeof(Line) * script->capacity);
+    }
+    Line *entry = script->lines + script->count++;
+    entry->t = t;
+    entry->offset = script->text.size;
+    va_start(args, format);
+    buffer_vprintf(&script->text, format, args);
+    va_end(args);
+    buffer_printf(&script->text, "\n");
+    entry->length = script->text.size - entry->offset;
+}
+
+
+// Order script lines by time, keeping the order of lines due together
+static int compare_lines(const void *a, const void *b) {
+    const Line *x = a;
+    const Line *y = b;
+    if (x->t != y->t) {
+        return x->t < y->t ? -1 : 1;
+    }
+    return x->offset - y->offset;
+}
+
+
+// Add the lines the server sends for one chunk
+// Arguments:
+// - script: script to add to
+// - t: time the chunk is due
+// - p, q: chunk position
+// - blocks: number of block rows
+// Returns: none
+static void synthetic_chunk(Script *script, double t, int p, int q, int blocks) {
+    for (int i = 0; i < blocks; i++) {
+        int x = p * CHUNK_SIZE + random_int(CHUNK_SIZE);
+        int z = q * CHUNK_SIZE + random_int(CHUNK_SIZE);
+        int y = 1 + random_int(64);
+        int w = random_int(4) ? 1 + random_int(15) : 0;
+        script_add(script, t, "B,%d,%d,%d,%d,%d,%d", p, q, x, y, z, w);
+    }
+    for (int i = 0; i < 2; i++) {
+        int x = p * CHUNK_SIZE + random_int(CHUNK_SIZE);
+        int z = q * CHUNK_SIZE + random_int(CHUNK_SIZE);
+        int y = 1 + random_int(64);
+        script_add(script, t, "L,%d,%d,%d,%d,%d,%d", p, q, x, y, z, 15);
+    }
+    int x = p * CHUNK_SIZE + random_int(CHUNK_SIZE);
+    int z = q * CHUNK_SIZE + random_int(CHUNK_SIZE);
+    int y = 1 + random_int(64);
+    int face = random_int(4);
+    script_add(script, t, "S,%d,%d,%d,%d,%d,%d,replay %d %d",
+        p, q, x, y, z, face, p, q);
+    script_add(script, t, "K,%d,%d,%d", p, q, 1);
+    script_add(script, t, "R,%d,%d", p, q);
+}
+
+
+// Generate a synthetic script
+// Arguments:
+// - script: empty script to fill
+// - options: settings
+// Returns: none
+static void synthetic_script(Script *script, const Options *options) {
+    random_state = options->seed ? options->seed : 1;
+    script_add(script, 0, "U,1,0,0,0,0,0");
+    script_add(script, 0, "E,%d,%d", DAY_LENGTH / 3, DAY_LENGTH);
+
+    // Chunks, nearest ring first
+    int index = 0;
+    for (int r = 0; r <= options->radius; r++) {
+        for (int p = -r; p <= r; p++) {
+            for (int q = -r; q <= r; q++) {
+                if (abs(p) != r && abs(q) != r) {
+                    continue;
+                }
+                double t = options->chunk_rate > 0 ?
+                    index / options->chunk_rate : 0;
+                synthetic_chunk(script, t, p, q, options->blocks);
+                index++;
+            }
+        }
+    }
+
+    // Players walking in circles around the origin
+    for (int i = 0; i < options->players; i++) {
+        double radius = 8 + 2 * i;
+        double speed = 4.3 / radius;
+        double phase = random_int(628) / 100.0;
+        for (double t = 0; t < options->duration; t += 1.0 / PLAYER_RATE) {
+            double a = phase + t * speed;
+            script_add(script, t, "P,%d,%.2f,%.2f,%.2f,%.2f,%.2f",
+                i + 2, cos(a) * radius, 40.0, sin(a) * radius, a, 0.0);
+        }
+    }
+
+    // Edits near the origin, each block placed and later broken
+    if (options->edit_rate > 0) {
+        int x = 0, y = 0, z = 0;
+        int count = options->duration * options->edit_rate;
+        for (int i = 0; i < count; i++) {
+            if (i % 2 == 0) {
+                x = random_int(EDIT_RANGE * 2) - EDIT_RANGE;
+                y = 30 + random_int(32);
+                z = random_int(EDIT_RANGE * 2) - EDIT_RANGE;
+            }
+            double t = i / options->edit_rate;
+            int p = chunked(x);
+            int q = chunked(z);
+            int w = i % 2 ? 0 : 1 + random_int(15);
+            script_add(script, t, "B,%d,%d,%d,%d,%d,%d", p, q, x, y, z, w);
+            script_add(script, t, "R,%d,%d", p, q);
+        }
+    }
+    qsort(script->lines, script->count, sizeof(Line), compare_lines);
+}
+
+
+// Load a script file
+// Arguments:
+// - script: empty script to fill
+// - path: file of protocol lines and "@SECONDS" lines
+// Returns: none
+static void load_script(Script *script, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    char *line = NULL;
+    size_t size = 0;
+    double t = 0;
+    while (getline(&line, &size, file) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '@') {
+            t = atof(line + 1);
+        }
+        else if (line[0] && line[0] != '#') {
+            script_add(script, t, "%s", line);
+        }
+    }
+    free(line);
+    fclose(file);
+    qsort(script->lines, script->count, sizeof(Line), compare_lines);
+}
+
+
+// Send all data, or fail
+// Arguments:
+// - sd: socket
+// - data, length: data to send
+// Returns:
+// - 0 on success, -1 if the connection is gone
+static int sendall(int sd, const char *data, int length) {
+    while (length > 0) {
+        int n = send(sd, data, length, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+
+// Play the script to one client until it disconnects
+// Arguments:
+// - sd: client socket
+// - script: lines to send
+// - options: settings
+// Returns: none
+static void play(int sd, const Script *script, const Options *options) {
+    char data[RECV_SIZE];
+    Buffer output = {0};
+    int index = 0;
+    double start = now();
+    double done = 0;
+    long long bytes = 0;
+    while (running) {
+        // Send every line that is due
+        double elapsed = now() - start;
+        output.size = 0;
+        while (index < script->count) {
+            const Line *line = script->lines + index;
+            int due = options->line_rate > 0 ?
+                index <= elapsed * options->line_rate :
+                options->speed <= 0 || line->t <= elapsed * options->speed;
+            if (!due) {
+                break;
+            }
+            buffer_printf(&output, "%.*s",
+                line->length, script->text.data + line->offset);
+            index++;
+        }
+        if (output.size) {
+            if (sendall(sd, output.data, output.size) == -1) {
+                break;
+            }
+            bytes += output.size;
+            if (index == script->count) {
+                done = now() - start;
+                printf("SENT %d lines, %lld bytes in %.3f s\n",
+                    script->count, bytes, done);
+                fflush(stdout);
+            }
+        }
+
+        // Throw away whatever the client sent
+        struct pollfd fd = {sd, POLLIN, 0};
+        if (poll(&fd, 1, TICK_MS) > 0) {
+            if (recv(sd, data, sizeof(data), 0) <= 0) {
+                break;
+            }
+        }
+    }
+    if (index < script->count) {
+        printf("LEFT after %d of %d lines\n", index, script->count);
+        fflush(stdout);
+    }
+    free(output.data);
+}
+
+
+// Connect to a server
+// Arguments:
+// - host, port: server address
+// Returns:
+// - socket, or -1 on failure
+static int connect_to(const char *host, int port) {
+    struct hostent *entry = gethostbyname(host);
+    if (!entry) {
+        fprintf(stderr, "gethostbyname: %s\n", host);
+        return -1;
+    }
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    memcpy(&address.sin_addr, entry->h_addr_list[0], entry->h_length);
+    address.sin_port = htons(port);
+    int sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sd == -1) {
+        perror("socket");
+        return -1;
+    }
+    if (connect(sd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        perror("connect");
+        close(sd);
+        return -1;
+    }
+    return sd;
+}
+
+
+// Forward one client to the upstream server, writing what the server sends
+// to the record file
+// Arguments:
+// - sd: client socket
+// - options: settings
+// Returns: none
+static void record(int sd, const Options *options) {
+    int upstream = connect_to(options->upstream_host, options->upstream_port);
+    if (upstream == -1) {
+        return;
+    }
+    FILE *file = fopen(options->record_path, "w");
+    if (!file) {
+        perror(options->record_path);
+        exit(1);
+    }
+    char data[RECV_SIZE];
+    // Partial lines from the client and from the server
+    Buffer from_client = {0};
+    Buffer from_server = {0};
+    double start = now();
+    double last = -1;
+    int lines = 0;
+    while (running) {
+        struct pollfd fds[2] = {{sd, POLLIN, 0}, {upstream, POLLIN, 0}};
+        if (poll(fds, 2, 100) <= 0) {
+            continue;
+        }
+        if (fds[0].revents) {
+            // Client to server, leaving out compression requests
+            int n = recv(sd, data, sizeof(data), 0);
+            if (n <= 0) {
+                break;
+            }
+            buffer_printf(&from_client, "%.*s", n, data);
+            char *end;
+            while ((end = strchr(from_client.data, '\n'))) {
+                int length = end - from_client.data + 1;
+                if (strncmp(from_client.data, "Z,", 2) != 0 &&
+                    sendall(upstream, from_client.data, length) == -1)
+                {
+                    running = 0;
+                    break;
+                }
+                from_client.size -= length;
+                memmove(from_client.data, end + 1, from_client.size + 1);
+            }
+        }
+        if (fds[1].revents) {
+            // Server to client, recording every complete line
+            int n = recv(upstream, data, sizeof(data), 0);
+            if (n <= 0 || sendall(sd, data, n) == -1) {
+                break;
+            }
+            double t = now() - start;
+            if (t - last >= 0.001) {
+                fprintf(file, "@%.3f\n", t);
+                last = t;
+            }
+            buffer_printf(&from_server, "%.*s", n, data);
+            char *end = strrchr(from_server.data, '\n');
+            if (end) {
+                int length = end - from_server.data + 1;
+                fwrite(from_server.data, 1, length, file);
+                for (int i = 0; i < length; i++) {
+                    lines += from_server.data[i] == '\n';
+                }
+                from_server.size -= length;
+                memmove(from_server.data, end + 1, from_server.size + 1);
+            }
+        }
+    }
+    printf("RECORDED %d lines in %.3f s to %s\n",
+        lines, now() - start, options->record_path);
+    fclose(file);
+    close(upstream);
+    free(from_client.data);
+    free(from_server.data);
+}
+
+
+// Stop at the next chance
+static void on_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+
+// Print usage and exit
+static void usage(const char *program) {
+    fprintf(stderr,
+        "usage: %s [-f FILE] [-x SPEED] [-l LINES/S] [-s SEED] "
+        "[-d SECONDS] [-r RADIUS] [-c CHUNKS/S] [-b BLOCKS] [-p PLAYERS] "
+        "[-e EDITS/S] [-o FILE -u HOST[:PORT]] [HOST [PORT]]\n",
+        program);
+    exit(1);
+}
+
+
+// Run the stand-in server
+// Arguments:
+// - argc: number of arguments
+// - argv: options (see usage)
+// Returns:
+// - 0 on a clean shutdown
+int main(int argc, char **argv) {
+    Options options = {
+        DEFAULT_HOST, DEFAULT_PORT, NULL, NULL, "", DEFAULT_PORT,
+        1, 0, 1, 60, 10, 100, 64, 8, 2};
+    int opt;
+    char *colon;
+    while ((opt = getopt(argc, argv, "f:x:l:s:d:r:c:b:p:e:o:u:")) != -1) {
+        switch (opt) {
+            case 'f': options.path = optarg; break;
+            case 'x': options.speed = atof(optarg); break;
+            case 'l': options.line_rate = atof(optarg); break;
+            case 's': options.seed = atoi(optarg); break;
+            case 'd': options.duration = atof(optarg); break;
+            case 'r': options.radius = atoi(optarg); break;
+            case 'c': options.chunk_rate = atof(optarg); break;
+            case 'b': options.blocks = atoi(optarg); break;
+            case 'p': options.players = atoi(optarg); break;
+            case 'e': options.edit_rate = atof(optarg); break;
+            case 'o': options.record_path = optarg; break;
+            case 'u':
+                snprintf(options.upstream_host,
+                    sizeof(options.upstream_host), "%s", optarg);
+                if ((colon = strchr(options.upstream_host, ':'))) {
+                    *colon = '\0';
+                    options.upstream_port = atoi(colon + 1);
+                }
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        options.host = argv[optind++];
+    }
+    if (optind < argc) {
+        options.port = atoi(argv[optind++]);
+    }
+    if (!options.record_path != !options.upstream_host[0] ||
+        options.radius < 0 || options.blocks < 0 || options.players < 0)
+    {
+        usage(argv[0]);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    Script script = {0};
+    if (options.record_path) {
+        printf("RECORD %s:%d to %s\n", options.upstream_host,
+            options.upstream_port, options.record_path);
+    }
+    else if (options.path) {
+        load_script(&script, options.path);
+        printf("SCRIPT %s: %d lines\n", options.path, script.count);
+    }
+    else {
+        synthetic_script(&script, &options);
+        printf("SCRIPT synthetic: %d lines, %d bytes\n",
+            script.count, script.text.size);
+    }
+
+    // Listen
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr(options.host);
+    address.sin_port = htons(options.port);
+    int sd;
+    if ((sd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        perror("socket");
+        exit(1);
+    }
+    int reuse = 1;
+    setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(reuse));
+    if (bind(sd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        perror("bind");
+        exit(1);
+    }
+    if (listen(sd, 1) == -1) {
+        perror("listen");
+        exit(1);
+    }
+    printf("SERV %s %d\n", options.host, options.port);
+    fflush(stdout);
+
+    // Serve one client at a time, each from the start of the script
+    while (running) {
+        struct pollfd fd = {sd, POLLIN, 0};
+        if (poll(&fd, 1, 100) <= 0) {
+            continue;
+        }
+        int client_sd = accept(sd, NULL, NULL);
+        if (client_sd == -1) {
+            continue;
+        }
+        printf("CONN\n");
+        fflush(stdout);
+        if (options.record_path) {
+            record(client_sd, &options);
+        }
+        else {
+            play(client_sd, &script, &options);
+        }
+        close(client_sd);
+        printf("DISC\n");
+        fflush(stdout);
+    }
+    close(sd);
+    free(script.lines);
+    free(script.text.data);
+    return 0;
+}
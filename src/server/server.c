@@ -0,0 +1,1236 @@
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #include <windows.h>
+    #define close closesocket
+    #define SHUT_RDWR SD_BOTH
+#else
+    #include <arpa/inet.h>
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <sys/select.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#endif
+
+
+#include "config.h"
+#include "db.h"
+#include "map.h"
+#include "sign.h"
+#include "tinycthread.h"
+#include "tools/tools.h"
+#include "world.h"
+#include <ctype.h>
+#include <curl/curl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// Headless dedicated server.
+// Serves the same line protocol as server.py, using the engine's own world
+// generation and database code. Nothing here needs a window or OpenGL.
+//
+// Each client gets a thread that reads and handles its commands and a thread
+// that writes its queued output. Shared state (the client list and the world
+// cache used to validate edits) is guarded by model_mtx. Chunk requests only
+// read the database, so they are served without holding model_mtx.
+
+
+#define DEFAULT_HOST "0.0.0.0"
+#define DEFAULT_PORT 4080
+#define LOG_PATH "log.txt"
+#define MAX_CLIENTS 128
+#define RECV_SIZE 4096
+// Clients sending a longer line than this are disconnected
+#define MAX_LINE_LENGTH 65536
+// Number of generated chunks kept around to validate edits
+#define WORLD_CACHE_SIZE 64
+#define MAX_SIGN_TEXT 48
+
+#define AUTH_REQUIRED 1
+#define AUTH_URL "https://craft.michaelfogleman.com/api/1/access"
+#define MAX_RESPONSE_LENGTH 1024
+
+#define SPAWN_X 0
+#define SPAWN_Y 0
+#define SPAWN_Z 0
+#define INDESTRUCTIBLE_ITEM 16
+
+
+// Connected client
+// - sd: socket descriptor
+// - id: client id sent to other players
+// - user_id: authenticated user id, or 0 for guests
+// - version: protocol version, or 0 before the client sent one
+// - nick: name shown to other players
+// - position: x, y, z, rx, ry
+// - address: remote address for the log
+// - port: remote port for the log
+// - running: cleared to stop the send thread
+// - output: text waiting to be sent
+// - mtx: guards running and output
+// - cnd: signalled when output is queued
+// - send_thread: writes queued output
+typedef struct {
+    int sd;
+    int id;
+    int user_id;
+    int version;
+    char nick[MAX_NAME_LENGTH];
+    float position[5];
+    char address[64];
+    int port;
+    int running;
+    Buffer output;
+    mtx_t mtx;
+    cnd_t cnd;
+    thrd_t send_thread;
+} Client;
+
+// Generated chunk plus saved edits, used to check what is at a position
+// - p, q: chunk position
+// - used: tick of the last lookup, or 0 if the slot is empty
+// - blocks: block map
+// - lights: light map
+typedef struct {
+    int p;
+    int q;
+    int used;
+    Map blocks;
+    Map lights;
+} WorldChunk;
+
+// Rows of a chunk being turned into packets
+// - output: buffer to write packets to
+// - p, q: chunk position
+// - count: number of rows written
+typedef struct {
+    Buffer *output;
+    int p;
+    int q;
+    int count;
+} ChunkPackets;
+
+
+// Server state
+
+static volatile sig_atomic_t running = 1;
+
+static mtx_t model_mtx;
+static Client *clients[MAX_CLIENTS];
+static int client_count = 0;
+static WorldChunk world_cache[WORLD_CACHE_SIZE];
+static int world_tick = 0;
+
+
+// Write a timestamped line to stdout and the log file
+// Arguments:
+// - format: printf format string
+// Returns: none
+static void server_log(const char *format, ...) {
+    char line[1024];
+    char stamp[32];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", gmtime(&now));
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    printf("%s %s\n", stamp, line);
+    fflush(stdout);
+    FILE *file = fopen(LOG_PATH, "a");
+    if (file) {
+        fprintf(file, "%s %s\n", stamp, line);
+        fclose(file);
+    }
+}
+
+
+// Check whether clients may place an item
+// Arguments:
+// - w: block id
+// Returns:
+// - non-zero if the item is allowed
+static int is_allowed_item(int w) {
+    return (w >= 0 && w <= 23 && w != INDESTRUCTIBLE_ITEM) ||
+        (w >= 32 && w <= 63);
+}
+
+
+// Queue formatted text to be sent to a client
+// Arguments:
+// - client: destination client
+// - format: printf format string
+// Returns: none
+static void client_printf(Client *client, const char *format, ...) {
+    va_list args;
+    mtx_lock(&client->mtx);
+    va_start(args, format);
+    buffer_vprintf(&client->output, format, args);
+    va_end(args);
+    cnd_signal(&client->cnd);
+    mtx_unlock(&client->mtx);
+}
+
+
+// Queue a chat message to a client
+// Arguments:
+// - client: destination client
+// - format: printf format string for the message text
+// Returns: none
+static void client_talk(Client *client, const char *format, ...) {
+    va_list args;
+    mtx_lock(&client->mtx);
+    buffer_printf(&client->output, "T,");
+    va_start(args, format);
+    buffer_vprintf(&client->output, format, args);
+    va_end(args);
+    buffer_printf(&client->output, "\n");
+    cnd_signal(&client->cnd);
+    mtx_unlock(&client->mtx);
+}
+
+
+// Queue a whole buffer of packets to be sent to a client
+// Arguments:
+// - client: destination client
+// - buffer: packets to send
+// Returns: none
+static void client_send_buffer(Client *client, Buffer *buffer) {
+    if (!buffer->size) {
+        return;
+    }
+    mtx_lock(&client->mtx);
+    buffer_printf(&client->output, "%s", buffer->data);
+    cnd_signal(&client->cnd);
+    mtx_unlock(&client->mtx);
+}
+
+
+// Send all of the data through a socket
+// Arguments:
+// - sd: socket descriptor
+// - data: bytes to send
+// - length: number of bytes to send
+// Returns:
+// - 0 on success, -1 on error
+static int sendall(int sd, char *data, int length) {
+    while (length > 0) {
+        int n = send(sd, data, length, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+
+// Send thread for a client.
+// Swaps the client's output buffer for an empty one and writes it, so that
+// handlers never wait on the network.
+// Arguments:
+// - arg: the client
+// Returns:
+// - 0
+static int send_worker(void *arg) {
+    Client *client = (Client *)arg;
+    Buffer spare = {0};
+    int failed = 0;
+    while (1) {
+        mtx_lock(&client->mtx);
+        while (client->running && !client->output.size) {
+            cnd_wait(&client->cnd, &client->mtx);
+        }
+        if (!client->output.size) {
+            mtx_unlock(&client->mtx);
+            break;
+        }
+        Buffer data = client->output;
+        spare.size = 0;
+        client->output = spare;
+        mtx_unlock(&client->mtx);
+        if (!failed && sendall(client->sd, data.data, data.size) == -1) {
+            // The recv thread notices the broken socket and cleans up
+            failed = 1;
+            shutdown(client->sd, SHUT_RDWR);
+        }
+        spare = data;
+    }
+    free(spare.data);
+    return 0;
+}
+
+
+// World map callback used with create_world
+// Arguments:
+// - x, y, z: block position
+// - w: block id
+// - arg: the destination map
+// Returns: none
+static void map_set_func(int x, int y, int z, int w, void *arg) {
+    map_set((Map *)arg, x, y, z, w);
+}
+
+
+// Find the cached world chunk, generating and loading it if needed.
+// Must be called with model_mtx held.
+// Arguments:
+// - p, q: chunk position
+// Returns:
+// - the cached chunk
+static WorldChunk *world_chunk(int p, int q) {
+    WorldChunk *oldest = world_cache;
+    world_tick++;
+    for (int i = 0; i < WORLD_CACHE_SIZE; i++) {
+        WorldChunk *chunk = world_cache + i;
+        if (chunk->used && chunk->p == p && chunk->q == q) {
+            chunk->used = world_tick;
+            return chunk;
+        }
+        if (chunk->used < oldest->used) {
+            oldest = chunk;
+        }
+    }
+    WorldChunk *chunk = oldest;
+    if (chunk->used) {
+        map_free(&chunk->blocks);
+        map_free(&chunk->lights);
+    }
+    int dx = p * CHUNK_SIZE - 1;
+    int dz = q * CHUNK_SIZE - 1;
+    map_alloc(&chunk->blocks, dx, 0, dz, 0x7fff);
+    map_alloc(&chunk->lights, dx, 0, dz, 0xf);
+    create_world(p, q, map_set_func, &chunk->blocks);
+    // Edits are written by the database worker; read them only once written
+    db_flush();
+    db_load_blocks(&chunk->blocks, p, q);
+    db_load_lights(&chunk->lights, p, q);
+    chunk->p = p;
+    chunk->q = q;
+    chunk->used = world_tick;
+    return chunk;
+}
+
+
+// Get the block at a position, including saved edits.
+// Must be called with model_mtx held.
+// Arguments:
+// - x, y, z: block position
+// Returns:
+// - block id
+static int get_block(int x, int y, int z) {
+    WorldChunk *chunk = world_chunk(chunked(x), chunked(z));
+    return map_get(&chunk->blocks, x, y, z);
+}
+
+
+// Send packets to every client except one.
+// Must be called with model_mtx held.
+// Arguments:
+// - client: client to skip (may be NULL)
+// - format: printf format string for the packet text
+// Returns: none
+static void broadcast(Client *client, const char *format, ...) {
+    Buffer line = {0};
+    va_list args;
+    va_start(args, format);
+    buffer_vprintf(&line, format, args);
+    va_end(args);
+    for (int i = 0; i < client_count; i++) {
+        if (clients[i] != client) {
+            client_printf(clients[i], "%s", line.data);
+        }
+    }
+    free(line.data);
+}
+
+
+// Send a chat message to every client and log it.
+// Must be called with model_mtx held.
+// Arguments:
+// - format: printf format string for the message text
+// Returns: none
+static void send_talk(const char *format, ...) {
+    Buffer text = {0};
+    va_list args;
+    va_start(args, format);
+    buffer_vprintf(&text, format, args);
+    va_end(args);
+    server_log("%s", text.data);
+    broadcast(NULL, "T,%s\n", text.data);
+    free(text.data);
+}
+
+
+// Send a client's position to the other clients.
+// Must be called with model_mtx held.
+// Arguments:
+// - client: client that moved
+// Returns: none
+static void send_position(Client *client) {
+    float *s = client->position;
+    broadcast(client, "P,%d,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+        client->id, s[0], s[1], s[2], s[3], s[4]);
+}
+
+
+// Send a client's nick to every client.
+// Must be called with model_mtx held.
+// Arguments:
+// - client: client whose nick changed
+// Returns: none
+static void send_nick(Client *client) {
+    broadcast(NULL, "N,%d,%s\n", client->id, client->nick);
+}
+
+
+// Move a client and tell everyone, including the client itself.
+// Must be called with model_mtx held.
+// Arguments:
+// - client: client to move
+// - position: x, y, z, rx, ry
+// Returns: none
+static void teleport(Client *client, const float *position) {
+    memcpy(client->position, position, sizeof(client->position));
+    float *s = client->position;
+    client_printf(client, "U,%d,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+        client->id, s[0], s[1], s[2], s[3], s[4]);
+    send_position(client);
+}
+
+
+// Find a connected client by nick.
+// Must be called with model_mtx held.
+// Arguments:
+// - nick: nick to look for
+// Returns:
+// - the client, or NULL if there is none
+static Client *find_client(const char *nick) {
+    for (int i = 0; i < client_count; i++) {
+        if (strcmp(clients[i]->nick, nick) == 0) {
+            return clients[i];
+        }
+    }
+    return NULL;
+}
+
+
+// Add a new client and send it the current state of the server
+// Arguments:
+// - client: the new client
+// Returns:
+// - 0 on success, -1 if the server is full
+static int on_connect(Client *client) {
+    mtx_lock(&model_mtx);
+    if (client_count >= MAX_CLIENTS) {
+        mtx_unlock(&model_mtx);
+        return -1;
+    }
+    int id = 1;
+    for (int i = 0; i < client_count; i++) {
+        if (clients[i]->id == id) {
+            id++;
+            i = -1;
+        }
+    }
+    client->id = id;
+    snprintf(client->nick, MAX_NAME_LENGTH, "guest%d", id);
+    server_log("CONN %d %s %d", id, client->address, client->port);
+    clients[client_count++] = client;
+    float spawn[5] = {SPAWN_X, SPAWN_Y, SPAWN_Z, 0, 0};
+    teleport(client, spawn);
+    client_printf(client, "E,%.0f,%d\n", (double)time(NULL), DAY_LENGTH);
+    client_talk(client, "Welcome to Craft!");
+    client_talk(client, "Type \"/help\" for a list of commands.");
+    for (int i = 0; i < client_count; i++) {
+        Client *other = clients[i];
+        if (other == client) {
+            continue;
+        }
+        float *s = other->position;
+        client_printf(client, "P,%d,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+            other->id, s[0], s[1], s[2], s[3], s[4]);
+        client_printf(client, "N,%d,%s\n", other->id, other->nick);
+    }
+    send_nick(client);
+    mtx_unlock(&model_mtx);
+    return 0;
+}
+
+
+// Remove a client that has disconnected
+// Arguments:
+// - client: the client
+// Returns: none
+static void on_disconnect(Client *client) {
+    mtx_lock(&model_mtx);
+    server_log("DISC %d %s %d", client->id, client->address, client->port);
+    for (int i = 0; i < client_count; i++) {
+        if (clients[i] == client) {
+            clients[i] = clients[--client_count];
+            break;
+        }
+    }
+    broadcast(NULL, "D,%d\n", client->id);
+    send_talk("%s has disconnected from the server.", client->nick);
+    mtx_unlock(&model_mtx);
+}
+
+
+// Handle a version packet
+// Arguments:
+// - client: sending client
+// - version: protocol version
+// Returns:
+// - 0 to keep the client, -1 to disconnect it
+static int on_version(Client *client, int version) {
+    if (client->version) {
+        return 0;
+    }
+    if (version != 1) {
+        return -1;
+    }
+    client->version = version;
+    return 0;
+}
+
+
+// Curl write callback collecting the response into a fixed size string
+// Arguments:
+// - data: response bytes
+// - size: size of each element
+// - count: number of elements
+// - arg: destination string of MAX_RESPONSE_LENGTH characters
+// Returns:
+// - number of bytes handled
+static size_t auth_write(char *data, size_t size, size_t count, void *arg) {
+    size_t length = size * count;
+    char *dst = (char *)arg;
+    size_t used = strlen(dst);
+    size_t n = MAX_RESPONSE_LENGTH - used - 1;
+    if (length < n) {
+        n = length;
+    }
+    memcpy(dst + used, data, n);
+    dst[used + n] = '\0';
+    return length;
+}
+
+
+// Ask the authentication server who owns an access token
+// Arguments:
+// - username: claimed username
+// - access_token: token given by the client
+// Returns:
+// - the user id, or 0 if the token was not accepted
+static int authenticate(const char *username, const char *access_token) {
+    int result = 0;
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+        return 0;
+    }
+    char *name = curl_easy_escape(curl, username, 0);
+    char *token = curl_easy_escape(curl, access_token, 0);
+    char post[1024];
+    char response[MAX_RESPONSE_LENGTH] = {0};
+    long http_code = 0;
+    snprintf(post, sizeof(post), "username=%s&access_token=%s", name, token);
+    curl_free(name);
+    curl_free(token);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, auth_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)response);
+    curl_easy_setopt(curl, CURLOPT_URL, AUTH_URL);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post);
+    CURLcode code = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_cleanup(curl);
+    if (code == CURLE_OK && http_code == 200 && response[0] &&
+        strspn(response, "0123456789") == strlen(response))
+    {
+        result = atoi(response);
+    }
+    return result;
+}
+
+
+// Handle an authentication packet: A,username,access_token
+// Arguments:
+// - client: sending client
+// - args: text after "A,"
+// Returns: none
+static void on_authenticate(Client *client, const char *args) {
+    char username[MAX_NAME_LENGTH] = {0};
+    char token[128] = {0};
+    int user_id = 0;
+    if (sscanf(args, "%31[^,],%127s", username, token) == 2) {
+        // Talks to the network, so model_mtx is not held here
+        user_id = authenticate(username, token);
+    }
+    mtx_lock(&model_mtx);
+    client->user_id = user_id;
+    if (user_id) {
+        snprintf(client->nick, MAX_NAME_LENGTH, "%s", username);
+    }
+    else {
+        snprintf(client->nick, MAX_NAME_LENGTH, "guest%d", client->id);
+        client_talk(client, "Visit craft.michaelfogleman.com to register!");
+    }
+    send_nick(client);
+    send_talk("%s has joined the game.", client->nick);
+    mtx_unlock(&model_mtx);
+}
+
+
+// db_load_block_rows callback writing one block packet
+static void block_packet(int x, int y, int z, int w, void *arg) {
+    ChunkPackets *packets = (ChunkPackets *)arg;
+    buffer_printf(packets->output, "B,%d,%d,%d,%d,%d,%d\n",
+        packets->p, packets->q, x, y, z, w);
+    packets->count++;
+}
+
+
+// db_load_light_rows callback writing one light packet
+static void light_packet(int x, int y, int z, int w, void *arg) {
+    ChunkPackets *packets = (ChunkPackets *)arg;
+    buffer_printf(packets->output, "L,%d,%d,%d,%d,%d,%d\n",
+        packets->p, packets->q, x, y, z, w);
+    packets->count++;
+}
+
+
+// Write the response to one chunk request: the block rows changed since the
+// client's key, all lights and signs, the new key and the end of chunk packet.
+// Arguments:
+// - output: buffer to write packets to
+// - p, q: chunk position
+// - key: client's cache key for the chunk
+// Returns: none
+static void chunk_packets(Buffer *output, int p, int q, int key) {
+    ChunkPackets blocks = {output, p, q, 0};
+    ChunkPackets lights = {output, p, q, 0};
+    // Edits are acknowledged as soon as they are queued for the database
+    // worker, so wait for the queued ones to be written first
+    db_flush();
+    int max_rowid = db_load_block_rows(p, q, key, block_packet, &blocks);
+    db_load_light_rows(p, q, light_packet, &lights);
+    SignList signs;
+    sign_list_alloc(&signs, 16);
+    db_load_signs(&signs, p, q);
+    for (unsigned int i = 0; i < signs.size; i++) {
+        Sign *e = signs.data + i;
+        buffer_printf(output, "S,%d,%d,%d,%d,%d,%d,%s\n",
+            p, q, e->x, e->y, e->z, e->face, e->text);
+    }
+    if (blocks.count) {
+        buffer_printf(output, "K,%d,%d,%d\n", p, q, max_rowid);
+    }
+    if (blocks.count || lights.count || signs.size) {
+        buffer_printf(output, "R,%d,%d\n", p, q);
+    }
+    buffer_printf(output, "C,%d,%d\n", p, q);
+    sign_list_free(&signs);
+}
+
+
+// Handle a chunk request: C,p,q,key[,p,q,key...]
+// Chunks are answered in the order listed, each one as soon as it is ready.
+// Only the database is read, so model_mtx is not held.
+// Arguments:
+// - client: sending client
+// - args: text after "C,"
+// Returns: none
+static void on_chunk(Client *client, const char *args) {
+    Buffer output = {0};
+    int p, q, key, n;
+    while (1) {
+        key = 0;
+        int count = sscanf(args, "%d,%d,%d%n", &p, &q, &key, &n);
+        if (count < 2) {
+            break;
+        }
+        if (count == 2) {
+            sscanf(args, "%d,%d%n", &p, &q, &n);
+        }
+        output.size = 0;
+        chunk_packets(&output, p, q, key);
+        client_send_buffer(client, &output);
+        args += n;
+        if (*args != ',') {
+            break;
+        }
+        args++;
+    }
+    free(output.data);
+}
+
+
+// Tell the other clients about a block change.
+// Must be called with model_mtx held.
+// Arguments:
+// - client: client that made the change
+// - p, q, x, y, z, w: block packet values
+// Returns: none
+static void send_block(Client *client, int p, int q, int x, int y, int z, int w) {
+    broadcast(client, "B,%d,%d,%d,%d,%d,%d\nR,%d,%d\n",
+        p, q, x, y, z, w, p, q);
+}
+
+
+// Handle a block edit: B,x,y,z,w
+// Arguments:
+// - client: sending client
+// - x, y, z: block position
+// - w: new block id
+// Returns: none
+static void on_block(Client *client, int x, int y, int z, int w) {
+    int p = chunked(x);
+    int q = chunked(z);
+    mtx_lock(&model_mtx);
+    int previous = get_block(x, y, z);
+    const char *message = NULL;
+    if (AUTH_REQUIRED && !client->user_id) {
+        message = "Only logged in users are allowed to build.";
+    }
+    else if (y <= 0 || y > 255) {
+        message = "Invalid block coordinates.";
+    }
+    else if (!is_allowed_item(w)) {
+        message = "That item is not allowed.";
+    }
+    else if (w && previous) {
+        message = "Cannot create blocks in a non-empty space.";
+    }
+    else if (!w && !previous) {
+        message = "That space is already empty.";
+    }
+    else if (previous == INDESTRUCTIBLE_ITEM) {
+        message = "Cannot destroy that type of block.";
+    }
+    if (message) {
+        client_printf(client, "B,%d,%d,%d,%d,%d,%d\nR,%d,%d\n",
+            p, q, x, y, z, previous, p, q);
+        client_talk(client, "%s", message);
+        mtx_unlock(&model_mtx);
+        return;
+    }
+    WorldChunk *chunk = world_chunk(p, q);
+    map_set(&chunk->blocks, x, y, z, w);
+    db_insert_block(p, q, x, y, z, w);
+    send_block(client, p, q, x, y, z, w);
+    for (int dx = -1; dx <= 1; dx++) {
+        for (int dz = -1; dz <= 1; dz++) {
+            if (dx == 0 && dz == 0) {
+                continue;
+            }
+            if (dx && chunked(x + dx) == p) {
+                continue;
+            }
+            if (dz && chunked(z + dz) == q) {
+                continue;
+            }
+            db_insert_block(p + dx, q + dz, x, y, z, -w);
+            send_block(client, p + dx, q + dz, x, y, z, -w);
+        }
+    }
+    if (w == 0) {
+        db_delete_signs(x, y, z);
+        if (map_get(&chunk->lights, x, y, z)) {
+            map_set(&chunk->lights, x, y, z, 0);
+            db_insert_light(p, q, x, y, z, 0);
+        }
+    }
+    mtx_unlock(&model_mtx);
+}
+
+
+// Handle a batch of block changes: x,y,z,w groups, each applied in order
+// like a "B" line.
+// Arguments:
+// - client: client that made the changes
+// - args: the groups, comma separated
+// Returns: none
+static void on_blocks(Client *client, const char *args) {
+    int x, y, z, w, n;
+    while (sscanf(args, "%d,%d,%d,%d%n", &x, &y, &z, &w, &n) == 4) {
+        on_block(client, x, y, z, w);
+        args += n;
+        if (*args != ',') {
+            break;
+        }
+        args++;
+    }
+}
+
+
+// Handle a light edit: L,x,y,z,w
+// Arguments:
+// - client: sending client
+// - x, y, z: block position
+// - w: light value
+// Returns: none
+static void on_light(Client *client, int x, int y, int z, int w) {
+    int p = chunked(x);
+    int q = chunked(z);
+    mtx_lock(&model_mtx);
+    const char *message = NULL;
+    if (AUTH_REQUIRED && !client->user_id) {
+        message = "Only logged in users are allowed to build.";
+    }
+    else if (get_block(x, y, z) == 0) {
+        message = "Lights must be placed on a block.";
+    }
+    else if (w < 0 || w > 15) {
+        message = "Invalid light value.";
+    }
+    if (message) {
+        client_printf(client, "R,%d,%d\n", p, q);
+        client_talk(client, "%s", message);
+        mtx_unlock(&model_mtx);
+        return;
+    }
+    WorldChunk *chunk = world_chunk(p, q);
+    map_set(&chunk->lights, x, y, z, w);
+    db_insert_light(p, q, x, y, z, w);
+    broadcast(client, "L,%d,%d,%d,%d,%d,%d\nR,%d,%d\n",
+        p, q, x, y, z, w, p, q);
+    mtx_unlock(&model_mtx);
+}
+
+
+// Handle a sign edit: S,x,y,z,face,text (the text may contain commas)
+// Arguments:
+// - client: sending client
+// - args: text after "S,"
+// Returns: none
+static void on_sign(Client *client, const char *args) {
+    int x, y, z, face, n = 0;
+    if (sscanf(args, "%d,%d,%d,%d%n", &x, &y, &z, &face, &n) != 4) {
+        return;
+    }
+    const char *text = args + n;
+    if (*text == ',') {
+        text++;
+    }
+    if (AUTH_REQUIRED && !client->user_id) {
+        client_talk(client, "Only logged in users are allowed to build.");
+        return;
+    }
+    if (y <= 0 || y > 255 || face < 0 || face > 7) {
+        return;
+    }
+    if (strlen(text) > MAX_SIGN_TEXT) {
+        return;
+    }
+    int p = chunked(x);
+    int q = chunked(z);
+    mtx_lock(&model_mtx);
+    if (*text) {
+        db_insert_sign(p, q, x, y, z, face, text);
+    }
+    else {
+        db_delete_sign(x, y, z, face);
+    }
+    broadcast(client, "S,%d,%d,%d,%d,%d,%d,%s\n",
+        p, q, x, y, z, face, text);
+    mtx_unlock(&model_mtx);
+}
+
+
+// Handle a position update: P,x,y,z,rx,ry
+// Arguments:
+// - client: sending client
+// - s: x, y, z, rx, ry
+// Returns: none
+static void on_position(Client *client, const float *s) {
+    mtx_lock(&model_mtx);
+    memcpy(client->position, s, sizeof(client->position));
+    send_position(client);
+    mtx_unlock(&model_mtx);
+}
+
+
+// Reply to /help [TOPIC].
+// Must be called with model_mtx held.
+// Arguments:
+// - client: asking client
+// - topic: help topic, or empty for the command list
+// Returns: none
+static void on_help(Client *client, const char *topic) {
+    static const char *help[][3] = {
+        {"goto", "Help: /goto [NAME]", "Teleport to another user."},
+        {"list", "Help: /list", "Display a list of connected users."},
+        {"login", "Help: /login NAME", "Switch to another registered username."},
+        {"logout", "Help: /logout", "Unauthenticate and become a guest user."},
+        {"offline", "Help: /offline [FILE]", "Switch to offline mode."},
+        {"online", "Help: /online HOST [PORT]", "Connect to the specified server."},
+        {"nick", "Help: /nick [NICK]", "Get or set your nickname."},
+        {"pq", "Help: /pq P Q", "Teleport to the specified chunk."},
+        {"spawn", "Help: /spawn", "Teleport back to the spawn point."},
+        {"view", "Help: /view N", "Set viewing distance, 1 - 24."},
+    };
+    if (!*topic) {
+        client_talk(client, "Type \"t\" to chat. Type \"/\" to type commands:");
+        client_talk(client, "/goto [NAME], /help [TOPIC], /list, /login NAME, /logout, /nick");
+        client_talk(client, "/offline [FILE], /online HOST [PORT], /pq P Q, /spawn, /view N");
+        return;
+    }
+    for (unsigned int i = 0; i < sizeof(help) / sizeof(help[0]); i++) {
+        if (strcmp(help[i][0], topic) == 0) {
+            client_talk(client, "%s", help[i][1]);
+            client_talk(client, "%s", help[i][2]);
+            return;
+        }
+    }
+}
+
+
+// Handle a chat line: a /command, an @nick private message or plain chat
+// Arguments:
+// - client: sending client
+// - text: chat text
+// Returns: none
+static void on_talk(Client *client, const char *text) {
+    char name[MAX_NAME_LENGTH];
+    char topic[32];
+    int p, q;
+    mtx_lock(&model_mtx);
+    if (text[0] == '/') {
+        if (strcmp(text, "/nick") == 0) {
+            client_talk(client, "Your nickname is %s", client->nick);
+        }
+        else if (sscanf(text, "/nick %31[^, ]", name) == 1) {
+            if (AUTH_REQUIRED) {
+                client_talk(client, "You cannot change your nick on this server.");
+            }
+            else {
+                send_talk("%s is now known as %s", client->nick, name);
+                snprintf(client->nick, MAX_NAME_LENGTH, "%s", name);
+                send_nick(client);
+            }
+        }
+        else if (strcmp(text, "/spawn") == 0) {
+            float spawn[5] = {SPAWN_X, SPAWN_Y, SPAWN_Z, 0, 0};
+            teleport(client, spawn);
+        }
+        else if (strcmp(text, "/goto") == 0) {
+            if (client_count > 1) {
+                Client *other;
+                do {
+                    other = clients[rand() % client_count];
+                } while (other == client);
+                teleport(client, other->position);
+            }
+        }
+        else if (sscanf(text, "/goto %31s", name) == 1) {
+            Client *other = find_client(name);
+            if (other) {
+                teleport(client, other->position);
+            }
+        }
+        else if (sscanf(text, "/pq %d %d", &p, &q) == 2 ||
+            sscanf(text, "/pq %d,%d", &p, &q) == 2)
+        {
+            if (abs(p) <= 1000 && abs(q) <= 1000) {
+                float position[5] = {p * CHUNK_SIZE, 0, q * CHUNK_SIZE, 0, 0};
+                teleport(client, position);
+            }
+        }
+        else if (strcmp(text, "/help") == 0) {
+            on_help(client, "");
+        }
+        else if (sscanf(text, "/help %31s", topic) == 1) {
+            for (char *c = topic; *c; c++) {
+                *c = tolower(*c);
+            }
+            on_help(client, topic);
+        }
+        else if (strcmp(text, "/list") == 0) {
+            Buffer players = {0};
+            buffer_printf(&players, "Players: ");
+            for (int i = 0; i < client_count; i++) {
+                buffer_printf(&players, i ? ", %s" : "%s", clients[i]->nick);
+            }
+            client_talk(client, "%s", players.data);
+            free(players.data);
+        }
+        else {
+            client_talk(client, "Unrecognized command: \"%s\"", text);
+        }
+    }
+    else if (text[0] == '@') {
+        sscanf(text + 1, "%31[^ ]", name);
+        Client *other = find_client(name);
+        if (other) {
+            client_talk(client, "%s> %s", client->nick, text);
+            client_talk(other, "%s> %s", client->nick, text);
+        }
+        else {
+            client_talk(client, "Unrecognized nick: \"%s\"", name);
+        }
+    }
+    else {
+        send_talk("%s> %s", client->nick, text);
+    }
+    mtx_unlock(&model_mtx);
+}
+
+
+// Handle one line received from a client
+// Arguments:
+// - client: sending client
+// - line: the line, without its newline
+// Returns:
+// - 0 to keep the client, -1 to disconnect it
+static int on_data(Client *client, char *line) {
+    int x, y, z, w, version;
+    float s[5];
+    if (!line[0] || line[1] != ',') {
+        return 0;
+    }
+    char *args = line + 2;
+    switch (line[0]) {
+        case 'A':
+            on_authenticate(client, args);
+            break;
+        case 'B':
+            if (sscanf(args, "%d,%d,%d,%d", &x, &y, &z, &w) == 4) {
+                on_block(client, x, y, z, w);
+            }
+            break;
+        case 'C':
+            on_chunk(client, args);
+            break;
+        case 'M':
+            on_blocks(client, args);
+            break;
+        case 'L':
+            if (sscanf(args, "%d,%d,%d,%d", &x, &y, &z, &w) == 4) {
+                on_light(client, x, y, z, w);
+            }
+            break;
+        case 'P':
+            if (sscanf(args, "%f,%f,%f,%f,%f",
+                &s[0], &s[1], &s[2], &s[3], &s[4]) == 5)
+            {
+                on_position(client, s);
+            }
+            break;
+        case 'S':
+            on_sign(client, args);
+            break;
+        case 'T':
+            on_talk(client, args);
+            break;
+        case 'V':
+            if (sscanf(args, "%d", &version) == 1) {
+                return on_version(client, version);
+            }
+            break;
+        // Stream compression ("Z") is not offered; ignoring the request
+        // keeps the connection uncompressed.
+    }
+    return 0;
+}
+
+
+// Receive thread for a client.
+// Reads lines and handles them until the connection closes, then cleans up.
+// Arguments:
+// - arg: the client
+// Returns:
+// - 0
+static int recv_worker(void *arg) {
+    Client *client = (Client *)arg;
+    int capacity = RECV_SIZE * 2;
+    int length = 0;
+    char *data = malloc(capacity);
+    if (on_connect(client) == 0) {
+        while (1) {
+            if (capacity - length <= RECV_SIZE) {
+                if (capacity >= MAX_LINE_LENGTH) {
+                    break;
+                }
+                capacity *= 2;
+                data = realloc(data, capacity);
+            }
+            int n = recv(client->sd, data + length, RECV_SIZE, 0);
+            if (n <= 0) {
+                break;
+            }
+            length += n;
+            data[length] = '\0';
+            char *start = data;
+            char *end;
+            int status = 0;
+            while (status == 0 && (end = strchr(start, '\n'))) {
+                *end = '\0';
+                if (end > start && end[-1] == '\r') {
+                    end[-1] = '\0';
+                }
+                status = on_data(client, start);
+                start = end + 1;
+            }
+            if (status) {
+                break;
+            }
+            length -= start - data;
+            memmove(data, start, length);
+        }
+        on_disconnect(client);
+    }
+    free(data);
+    mtx_lock(&client->mtx);
+    client->running = 0;
+    cnd_signal(&client->cnd);
+    mtx_unlock(&client->mtx);
+    thrd_join(client->send_thread, NULL);
+    close(client->sd);
+    cnd_destroy(&client->cnd);
+    mtx_destroy(&client->mtx);
+    free(client->output.data);
+    free(client);
+    return 0;
+}
+
+
+// Start serving a newly accepted connection
+// Arguments:
+// - sd: socket descriptor of the connection
+// - address: remote address
+// Returns: none
+static void start_client(int sd, struct sockaddr_in *address) {
+    Client *client = calloc(1, sizeof(Client));
+    client->sd = sd;
+    client->running = 1;
+    snprintf(client->address, sizeof(client->address), "%s",
+        inet_ntoa(address->sin_addr));
+    client->port = ntohs(address->sin_port);
+    mtx_init(&client->mtx, mtx_plain);
+    cnd_init(&client->cnd);
+    thrd_t recv_thread;
+    if (thrd_create(&client->send_thread, send_worker, client) != thrd_success) {
+        perror("thrd_create");
+        exit(1);
+    }
+    if (thrd_create(&recv_thread, recv_worker, client) != thrd_success) {
+        perror("thrd_create");
+        exit(1);
+    }
+    thrd_detach(recv_thread);
+}
+
+
+// Signal handler asking the server to shut down
+static void on_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+
+// Run the server
+// Arguments:
+// - argc: number of arguments
+// - argv: optional host and port
+// Returns:
+// - 0 on a clean shutdown
+int main(int argc, char **argv) {
+    const char *host = DEFAULT_HOST;
+    int port = DEFAULT_PORT;
+    if (argc > 1) {
+        host = argv[1];
+    }
+    if (argc > 2) {
+        port = atoi(argv[2]);
+    }
+    #ifdef _WIN32
+        WSADATA wsa_data;
+        WSAStartup(MAKEWORD(2, 2), &wsa_data);
+    #else
+        signal(SIGPIPE, SIG_IGN);
+    #endif
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    srand(time(NULL));
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    mtx_init(&model_mtx, mtx_plain);
+
+    db_enable();
+    if (db_init(DB_PATH)) {
+        return -1;
+    }
+
+    // Listen
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr(host);
+    address.sin_port = htons(port);
+    int sd;
+    if ((sd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        perror("socket");
+        exit(1);
+    }
+    int reuse = 1;
+    setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(reuse));
+    if (bind(sd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        perror("bind");
+        exit(1);
+    }
+    if (listen(sd, 16) == -1) {
+        perror("listen");
+        exit(1);
+    }
+    server_log("SERV %s %d", host, port);
+
+    // Accept connections, committing the database every COMMIT_INTERVAL
+    time_t last_commit = time(NULL);
+    while (running) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sd, &fds);
+        struct timeval timeout = {1, 0};
+        if (select(sd + 1, &fds, NULL, NULL, &timeout) > 0) {
+            struct sockaddr_in remote;
+            socklen_t size = sizeof(remote);
+            int client_sd = accept(sd, (struct sockaddr *)&remote, &size);
+            if (client_sd != -1) {
+                start_client(client_sd, &remote);
+            }
+        }
+        if (time(NULL) - last_commit >= COMMIT_INTERVAL) {
+            last_commit = time(NULL);
+            db_commit();
+        }
+    }
+
+    // Shut down: disconnect everyone, then save
+    server_log("STOP");
+    close(sd);
+    mtx_lock(&model_mtx);
+    for (int i = 0; i < client_count; i++) {
+        shutdown(clients[i]->sd, SHUT_RDWR);
+    }
+    mtx_unlock(&model_mtx);
+    for (int i = 0; i < 100; i++) {
+        mtx_lock(&model_mtx);
+        int count = client_count;
+        mtx_unlock(&model_mtx);
+        if (!count) {
+            break;
+        }
+        struct timespec delay = {0, 10000000};
+        thrd_sleep(&delay, NULL);
+    }
+    db_close();
+    db_disable();
+    curl_global_cleanup();
+    return 0;
+}
@@ -0,0 +1,67 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "config.h"
+#include "tools.h"
+
+// Helpers shared by the programs that run without the client: the headless
+// server, the load generator, the scripted stand-in server and benchmarks.
+
+// Append formatted text to a buffer, growing it as needed
+// Arguments:
+// - buffer: destination buffer
+// - format: printf format string
+// - args: values for format
+// Returns:
+// - modifies the structure pointed to by buffer
+void buffer_vprintf(Buffer *buffer, const char *format, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (buffer->size + length + 1 > buffer->capacity) {
+        int capacity = buffer->capacity ? buffer->capacity : 1024;
+        while (buffer->size + length + 1 > capacity) {
+            capacity *= 2;
+        }
+        buffer->data = realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
+    }
+    vsnprintf(buffer->data + buffer->size, length + 1, format, args);
+    buffer->size += length;
+}
+
+// Append formatted text to a buffer, growing it as needed
+// Arguments:
+// - buffer: destination buffer
+// - format: printf format string
+// Returns:
+// - modifies the structure pointed to by buffer
+void buffer_printf(Buffer *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    buffer_vprintf(buffer, format, args);
+    va_end(args);
+}
+
+// Convert a world x or z position to a chunk position
+// Arguments:
+// - x: world position
+// Returns:
+// - chunk position
+int chunked(int x) {
+    return (int)floor((double)x / CHUNK_SIZE);
+}
+
+// Get the monotonic time
+// Arguments: none
+// Returns:
+// - time in seconds
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,34 @@
+#ifndef _tools_h_
+#define _tools_h_
+
+#include <stdarg.h>
+
+
+// Growable text buffer
+// - data: characters (always null terminated once anything is written)
+// - size: number of characters in use
+// - capacity: number of characters allocated
+typedef struct {
+    char *data;
+    int size;
+    int capacity;
+} Buffer;
+
+
+void buffer_printf(
+        Buffer *buffer,
+        const char *format,
+        ...);
+
+void buffer_vprintf(
+        Buffer *buffer,
+        const char *format,
+        va_list args);
+
+int chunked(
+        int x);
+
+double now();
+
+
+#endif
@@ -0,0 +1,62 @@
+#include <string.h>
+#include "transient.h"
+
+// Ring of vertex data for geometry that only lives for one frame (HUD text,
+// the held item, wireframes, the crosshairs, the sign being typed). Instead of
+// creating, filling and deleting a buffer for each draw, the data is appended
+// after what was written before. When the buffer is full its storage is
+// orphaned with glBufferData(NULL), so the driver hands out fresh memory
+// instead of waiting for draws that still read from the old one.
+
+// Set up the buffer
+// Arguments:
+// - transient: pointer to structure to modify
+// - size: size of the buffer in bytes
+// Returns:
+// - modifies the structure that transient points to
+void transient_init(Transient *transient, int size) {
+    memset(transient, 0, sizeof(Transient));
+    transient->size = size;
+    glGenBuffers(1, &transient->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, transient->buffer);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Delete the buffer (but does not free the given pointer)
+// Arguments:
+// - transient: pointer to structure
+// Returns: none
+void transient_free(Transient *transient) {
+    glDeleteBuffers(1, &transient->buffer);
+    memset(transient, 0, sizeof(Transient));
+}
+
+// Append vertices to the buffer. The data can be drawn from the buffer until
+// it is overwritten, which is not before the buffer has been filled again.
+// Arguments:
+// - transient: pointer to structure
+// - components: number of floats per vertex
+// - count: number of vertices
+// - data: vertex data (count * components floats)
+// Returns:
+// - index of the first vertex, to be drawn with vertex attributes that start
+//   at the beginning of the buffer
+int transient_append(Transient *transient, int components, int count, const GLfloat *data) {
+    int stride = sizeof(GLfloat) * components;
+    int size = stride * count;
+    // Start at a whole vertex so that the data can be addressed by index
+    int offset = (transient->offset + stride - 1) / stride * stride;
+    glBindBuffer(GL_ARRAY_BUFFER, transient->buffer);
+    if (offset + size > transient->size) {
+        while (transient->size < size) {
+            transient->size *= 2;
+        }
+        glBufferData(GL_ARRAY_BUFFER, transient->size, NULL, GL_STREAM_DRAW);
+        offset = 0;
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    transient->offset = offset + size;
+    return offset / stride;
+}
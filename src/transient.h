@@ -0,0 +1,33 @@
+#ifndef _transient_h_
+#define _transient_h_
+
+
+#include <GL/glew.h>
+
+
+// Vertex buffer for geometry that is rebuilt every frame
+// - buffer: OpenGL buffer handle
+// - size: size of the buffer in bytes
+// - offset: bytes written since the buffer storage was last orphaned
+typedef struct {
+    GLuint buffer;
+    int size;
+    int offset;
+} Transient;
+
+
+void transient_init(
+        Transient *transient,
+        int size);
+
+void transient_free(
+        Transient *transient);
+
+int transient_append(
+        Transient *transient,
+        int components,
+        int count,
+        const GLfloat *data);
+
+
+#endif
@@ -1,3 +1,10 @@
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #define _POSIX_C_SOURCE 200809L
+    #include <time.h>
+#endif
+
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,6 +32,24 @@ double rand_double() {
     return (double)rand() / (double)RAND_MAX;
 }
 
+// Get a monotonic time for measuring how long things take.
+// Unlike glfwGetTime(), this is not moved by time sync from the server.
+// Arguments: none
+// Returns:
+// - time in seconds from an arbitrary starting point
+double perf_time() {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
 // Update frames per second info
 // Arguments:
 // - fps: fps context pointer
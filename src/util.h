@@ -72,6 +72,8 @@ GLfloat *malloc_faces(
         int components,
         int faces);
 
+double perf_time();
+
 double rand_double();
 
 int rand_int(
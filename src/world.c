@@ -1,6 +1,47 @@
 #include "config.h"
 #include "noise.h"
 #include "world.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+// Width of a chunk including the one block border shared with its neighbors
+#define PACKED_SIZE (CHUNK_SIZE + 2)
+
+// Scratch space used to collect the blocks of one chunk for create_world_packed
+// - w: block id at each position
+// - set: non-zero where a block was generated
+typedef struct {
+    signed char w[PACKED_SIZE][PACKED_SIZE][256];
+    unsigned char set[PACKED_SIZE][PACKED_SIZE][256];
+    int p;
+    int q;
+} PackedWorld;
+
+
+// Height of the terrain generated at a world column, without trees or plants
+// Arguments:
+// - x, z: world block position
+// - w: output: block id of the top of the column (grass or sand)
+// Returns:
+// - number of blocks in the column (its top block is at h - 1)
+int world_height(
+        int x,
+        int z,
+        int *w)
+{
+    float f = simplex2(x * 0.01, z * 0.01, 4, 0.5, 2);
+    float g = simplex2(-x * 0.01, -z * 0.01, 2, 0.9, 2);
+    int mh = g * 32 + 16;
+    int h = f * mh;
+    *w = 1; // grass
+    int t = 12;
+    if (h <= t) {
+        h = t;
+        *w = 2; // sand
+    }
+    return h;
+}
 
 
 // Main terrain generation function
@@ -27,17 +68,9 @@ void create_world(
             }
             int x = p * CHUNK_SIZE + dx; // convert p (chunk x) and dx to world x
             int z = q * CHUNK_SIZE + dz; // convert q (chunk z) and dz to world z
-            float f = simplex2(x * 0.01, z * 0.01, 4, 0.5, 2);
-            float g = simplex2(-x * 0.01, -z * 0.01, 2, 0.9, 2);
-            int mh = g * 32 + 16;
-            int h = f * mh;
             // w = block id
-            int w = 1; // grass
-            int t = 12;
-            if (h <= t) {
-                h = t;
-                w = 2; // sand
-            }
+            int w;
+            int h = world_height(x, z, &w);
             // sand and grass terrain
             for (int y = 0; y < h; y++) {
                 func(x, y, z, w * flag, arg);
@@ -94,3 +127,64 @@ void create_world(
     }
 }
 
+
+// World callback recording a block into a PackedWorld
+static void packed_world_func(int x, int y, int z, int w, void *arg) {
+    PackedWorld *world = (PackedWorld *)arg;
+    int dx = x - world->p * CHUNK_SIZE + 1;
+    int dz = z - world->q * CHUNK_SIZE + 1;
+    if (dx < 0 || dz < 0 || dx >= PACKED_SIZE || dz >= PACKED_SIZE ||
+        y < 0 || y >= 256)
+    {
+        return;
+    }
+    world->w[dx][dz][y] = w;
+    world->set[dx][dz][y] = 1;
+}
+
+
+// Generate a chunk into a packed buffer, for callers (such as world.py) that
+// cannot afford a callback per block.
+// Each block is one 32-bit value:
+//   ((dx * (CHUNK_SIZE + 2) + dz) << 16) | (y << 8) | (w & 0xff)
+// where dx and dz are the x and z offsets from the chunk's corner plus one
+// (so the one block border is 0 and CHUNK_SIZE + 1), and w is a signed byte.
+// Values are sorted and there is one per position, with later blocks
+// overwriting earlier ones just like create_world's callers see them.
+// Parameters:
+// - p: chunk p location
+// - q: chunk q location
+// - data: destination buffer
+// - max: number of values data can hold
+// Returns:
+// - the number of blocks in the chunk (only max are written if it is larger)
+int create_world_packed(
+        int p,
+        int q,
+        unsigned int *data,
+        int max)
+{
+    PackedWorld *world = malloc(sizeof(PackedWorld));
+    memset(world->set, 0, sizeof(world->set));
+    world->p = p;
+    world->q = q;
+    create_world(p, q, packed_world_func, world);
+    int count = 0;
+    for (int dx = 0; dx < PACKED_SIZE; dx++) {
+        for (int dz = 0; dz < PACKED_SIZE; dz++) {
+            for (int y = 0; y < 256; y++) {
+                if (!world->set[dx][dz][y]) {
+                    continue;
+                }
+                if (count < max) {
+                    unsigned int column = dx * PACKED_SIZE + dz;
+                    data[count] = (column << 16) | (y << 8) |
+                        (world->w[dx][dz][y] & 0xff);
+                }
+                count++;
+            }
+        }
+    }
+    free(world);
+    return count;
+}
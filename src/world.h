@@ -6,11 +6,22 @@
 typedef void (*world_func)(int x, int y, int z, int w, void *arg);
 
 
+int world_height(
+        int x,
+        int z,
+        int *w);
+
 void create_world(
         int p,
         int q,
         world_func func,
         void *arg);
 
+int create_world_packed(
+        int p,
+        int q,
+        unsigned int *data,
+        int max);
+
 
 #endif
@@ -1,11 +1,19 @@
 # gcc -std=c99 -O3 -shared -o world \
 #   -I src -I deps/noise deps/noise/noise.c src/world.c
 
-from ctypes import CDLL, CFUNCTYPE, c_float, c_int, c_void_p
+from array import array
+from bisect import bisect_left
+from ctypes import CDLL, CFUNCTYPE, POINTER, c_float, c_int, c_uint, c_void_p
+from ctypes import string_at
 from collections import OrderedDict
 
 dll = CDLL('./world')
 
+CHUNK_SIZE = 32
+PACKED_SIZE = CHUNK_SIZE + 2
+# Most blocks create_world_packed can return for one chunk
+PACKED_CAPACITY = PACKED_SIZE * PACKED_SIZE * 256
+
 WORLD_FUNC = CFUNCTYPE(None, c_int, c_int, c_int, c_int, c_void_p)
 
 def dll_seed(x):
@@ -18,6 +26,14 @@ def dll_create_world(p, q):
     dll.create_world(p, q, WORLD_FUNC(world_func), None)
     return result
 
+dll.create_world_packed.restype = c_int
+dll.create_world_packed.argtypes = [c_int, c_int, POINTER(c_uint), c_int]
+def dll_create_world_packed(p, q, buf=(c_uint * PACKED_CAPACITY)()):
+    count = dll.create_world_packed(p, q, buf, PACKED_CAPACITY)
+    data = array('I')
+    data.frombytes(string_at(buf, count * data.itemsize))
+    return data
+
 dll.simplex2.restype = c_float
 dll.simplex2.argtypes = [c_float, c_float, c_int, c_float, c_float]
 def dll_simplex2(x, y, octaves=1, persistence=0.5, lacunarity=2.0):
@@ -28,15 +44,46 @@ dll.simplex3.argtypes = [c_float, c_float, c_float, c_int, c_float, c_float]
 def dll_simplex3(x, y, z, octaves=1, persistence=0.5, lacunarity=2.0):
     return dll.simplex3(x, y, z, octaves, persistence, lacunarity)
 
+class Chunk(object):
+    # The generated blocks of one chunk, as the sorted 32-bit values made by
+    # create_world_packed: (column << 16) | (y << 8) | w. About 4 bytes per
+    # block, and looked up like the dict made by dll_create_world.
+    def __init__(self, p, q, data):
+        self.x = p * CHUNK_SIZE - 1
+        self.z = q * CHUNK_SIZE - 1
+        self.data = data
+    def __len__(self):
+        return len(self.data)
+    def __contains__(self, key):
+        return self.get(key) is not None
+    def get(self, key, default=None):
+        x, y, z = key
+        dx, dz = x - self.x, z - self.z
+        if not (0 <= dx < PACKED_SIZE and 0 <= dz < PACKED_SIZE and
+                0 <= y < 256):
+            return default
+        value = ((dx * PACKED_SIZE + dz) << 16) | (y << 8)
+        index = bisect_left(self.data, value)
+        if index == len(self.data) or self.data[index] >> 8 != value >> 8:
+            return default
+        w = self.data[index] & 0xff
+        return w - 256 if w > 127 else w
+    def items(self):
+        for value in self.data:
+            column, y, w = value >> 16, (value >> 8) & 0xff, value & 0xff
+            x = self.x + column // PACKED_SIZE
+            z = self.z + column % PACKED_SIZE
+            yield (x, y, z), (w - 256 if w > 127 else w)
+
 class World(object):
-    def __init__(self, seed=None, cache_size=64):
+    def __init__(self, seed=None, cache_size=1024):
         self.seed = seed
         self.cache = OrderedDict()
         self.cache_size = cache_size
     def create_chunk(self, p, q):
         if self.seed is not None:
             dll_seed(self.seed)
-        return dll_create_world(p, q)
+        return Chunk(p, q, dll_create_world_packed(p, q))
     def get_chunk(self, p, q):
         try:
             chunk = self.cache.pop((p, q))